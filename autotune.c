@@ -0,0 +1,337 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "autotune.h"
+#include "cache_exhauster.h"
+#include "verbs_wrappers.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "stats.h"
+#include "memutils.h"
+
+#define AUTOTUNE_MAX_ROUNDS 4
+#define AUTOTUNE_MAX_CANDIDATES 16
+#define AUTOTUNE_MAX_POLL_BATCH 64
+// A candidate has to beat the current value (measured in the same sweep) by this much to replace it,
+// so that trial noise doesn't make the search wander.
+#define AUTOTUNE_MIN_GAIN 0.02
+// Trials of the baseline and of the best configuration at the end, for a confidence interval.
+#define AUTOTUNE_CONFIRM_TRIALS 5
+
+typedef struct
+{
+	const char* name;
+	size_t offset;
+	uint32_t candidates[AUTOTUNE_MAX_CANDIDATES];
+	uint32_t number_of_candidates;
+	// Throughput (reads per second) of every candidate in the parameter's latest sweep.
+	double throughput[AUTOTUNE_MAX_CANDIDATES];
+	int swept;
+} TunedParameter;
+
+static TunedParameter parameters[] = {
+	{ .name = "qps", .offset = offsetof(AttackParams, number_of_qps), .candidates = { 1, 2, 4, 8 }, .number_of_candidates = 4 },
+	{ .name = "post_batch", .offset = offsetof(AttackParams, post_batch), .candidates = { 1, 2, 4, 8, 16, 32, 64 }, .number_of_candidates = 7 },
+	{ .name = "signal_interval", .offset = offsetof(AttackParams, signal_interval), .candidates = { 1, 2, 4, 8, 16, 32, 64, 128 }, .number_of_candidates = 8 },
+	{ .name = "window", .offset = offsetof(AttackParams, window), .candidates = { 1, 4, 16, 64, 256, 1024, 2048 }, .number_of_candidates = 7 },
+	{ .name = "poll_batch", .offset = offsetof(AttackParams, poll_batch), .candidates = { 1, 4, 16, 64 }, .number_of_candidates = 4 },
+};
+#define NUMBER_OF_PARAMETERS (sizeof(parameters) / sizeof(parameters[0]))
+
+// The attacker of logic_attacker: one QP, one WR per post, every WR signaled,
+// a send queue worth in flight and one completion per poll.
+static const AttackParams baseline_params = {
+	.number_of_qps = 1,
+	.post_batch = 1,
+	.signal_interval = 1,
+	.window = 2048,
+	.poll_batch = 1
+};
+
+// Per QP state of a trial. The ring numbers WRs from 1 on; since a QP completes its WRs in order,
+// a completion of WR n means that WRs 1..n are done, signaled or not.
+typedef struct
+{
+	ClientLane* lane;
+	WrRing ring;
+	uint64_t completed;
+} TrialLane;
+
+static uint32_t trial_ms = 200;
+static volatile int keep_running = 1;
+
+static void stop_tuning(int value)
+{
+	keep_running = 0;
+}
+
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void configure_autotune(const char* spec)
+{
+	char* end = NULL;
+	unsigned long ms = strtoul(spec, &end, 10);
+	if ('-' == spec[0] || end == spec || '\0' != *end || 0 == ms || ms > AUTOTUNE_MAX_TRIAL_MS)
+	{
+		log_msg("Bad auto-tuner trial length %s: expected 1-%u ms", spec, AUTOTUNE_MAX_TRIAL_MS);
+		exit(-1);
+	}
+	trial_ms = ms;
+}
+
+static uint32_t* param_field(AttackParams* params, const TunedParameter* parameter)
+{
+	return (uint32_t*)((char*)params + parameter->offset);
+}
+
+static void format_params(const AttackParams* params, char* buf, size_t len)
+{
+	snprintf(buf, len, "qps=%u post_batch=%u signal_interval=%u window=%u poll_batch=%u",
+		params->number_of_qps, params->post_batch, params->signal_interval, params->window, params->poll_batch);
+}
+
+// Posts the next n reads of the lane's sweep as one chain.
+static void post_reads(TrialLane* tl, const AttackParams* params, uint32_t n, int signal_last)
+{
+	wr_ring_post(&tl->ring, n, params->signal_interval, signal_last, 0);
+}
+
+static void reap_completions(TrialLane* tl, uint32_t poll_batch)
+{
+	struct ibv_wc wc[AUTOTUNE_MAX_POLL_BATCH];
+	int ne = do_cq_poll(tl->lane->qp, wc, poll_batch);
+	for (int i = 0 ; i < ne ; ++i)
+	{
+		if (wc[i].wr_id > tl->completed)
+		{
+			tl->completed = wc[i].wr_id;
+		}
+	}
+}
+
+// Keeps params->window reads in flight on each of the first params->number_of_qps lanes for one trial.
+// Returns the completed reads per second.
+static double run_trial(TrialLane* lanes, const AttackParams* params)
+{
+	uint32_t number_of_qps = params->number_of_qps;
+	for (uint32_t l = 0 ; l < number_of_qps ; ++l)
+	{
+		lanes[l].ring.posted = 0;
+		lanes[l].ring.last_signaled = 0;
+		lanes[l].completed = 0;
+	}
+	uint64_t start = monotonic_ns();
+	uint64_t deadline = start + (uint64_t)trial_ms * 1000000;
+	while (monotonic_ns() < deadline && keep_running)
+	{
+		for (uint32_t l = 0 ; l < number_of_qps ; ++l)
+		{
+			TrialLane* tl = &lanes[l];
+			uint64_t in_flight = tl->ring.posted - tl->completed;
+			while (in_flight < params->window)
+			{
+				uint32_t n = params->window - in_flight;
+				if (n > params->post_batch)
+				{
+					n = params->post_batch;
+				}
+				// The WR that fills the window must be signaled, or nothing would ever open it again.
+				post_reads(tl, params, n, in_flight + n == params->window);
+				in_flight += n;
+			}
+			reap_completions(tl, params->poll_batch);
+		}
+	}
+	// Wind down: every lane needs a signaled WR at its tail to learn that all of its reads are done.
+	for (uint32_t l = 0 ; l < number_of_qps ; ++l)
+	{
+		TrialLane* tl = &lanes[l];
+		if (tl->ring.posted > tl->ring.last_signaled)
+		{
+			post_reads(tl, params, 1, 1);
+		}
+		while (tl->completed < tl->ring.posted)
+		{
+			reap_completions(tl, params->poll_batch);
+		}
+	}
+	uint64_t elapsed = monotonic_ns() - start;
+	uint64_t reads = 0;
+	for (uint32_t l = 0 ; l < number_of_qps ; ++l)
+	{
+		reads += lanes[l].completed;
+	}
+	return reads * 1e9 / elapsed;
+}
+
+// Tries every candidate of the parameter with the others fixed. Returns non-zero if params changed.
+static int sweep_parameter(TrialLane* lanes, uint32_t number_of_lanes, AttackParams* params, TunedParameter* parameter, uint32_t round)
+{
+	uint32_t* field = param_field(params, parameter);
+	uint32_t current = *field;
+	double current_throughput = 0;
+	uint32_t best = current;
+	double best_throughput = 0;
+	for (uint32_t i = 0 ; i < parameter->number_of_candidates && keep_running ; ++i)
+	{
+		uint32_t value = parameter->candidates[i];
+		parameter->throughput[i] = 0;
+		if ((0 == strcmp(parameter->name, "qps") && value > number_of_lanes) || (0 == strcmp(parameter->name, "window") && value > QP_MAX_SEND_WR))
+		{
+			continue;
+		}
+		AttackParams trial = *params;
+		*param_field(&trial, parameter) = value;
+		double throughput = run_trial(lanes, &trial);
+		parameter->throughput[i] = throughput;
+		timeline_record("autotune", parameter->name, throughput);
+		log_msg("[Autotune] round %u: %s = %4u -> %8.3f Mreads/s", round, parameter->name, value, throughput / 1e6);
+		if (value == current)
+		{
+			current_throughput = throughput;
+		}
+		if (throughput > best_throughput)
+		{
+			best_throughput = throughput;
+			best = value;
+		}
+	}
+	parameter->swept = 1;
+	if (best != current && best_throughput > current_throughput * (1 + AUTOTUNE_MIN_GAIN))
+	{
+		*field = best;
+		return 1;
+	}
+	return 0;
+}
+
+static int compare_sensitivity(const void* a, const void* b)
+{
+	double sa = *(const double*)a;
+	double sb = *(const double*)b;
+	return (sa < sb) - (sa > sb);
+}
+
+// Prints, for every parameter, the spread of the throughput over its candidates in its last sweep
+// (with the other parameters at their tuned values), most influential first.
+static void report_sensitivity()
+{
+	// Pairs of (sensitivity, parameter index), sorted by sensitivity.
+	double order[NUMBER_OF_PARAMETERS][2];
+	uint32_t number_swept = 0;
+	for (uint32_t p = 0 ; p < NUMBER_OF_PARAMETERS ; ++p)
+	{
+		TunedParameter* parameter = &parameters[p];
+		if (!parameter->swept)
+		{
+			continue;
+		}
+		double min = 0;
+		double max = 0;
+		for (uint32_t i = 0 ; i < parameter->number_of_candidates ; ++i)
+		{
+			double t = parameter->throughput[i];
+			if (0 == t)
+			{
+				continue;
+			}
+			min = (0 == min || t < min) ? t : min;
+			max = (t > max) ? t : max;
+		}
+		order[number_swept][0] = (0 == max) ? 0 : (max - min) / max;
+		order[number_swept][1] = p;
+		++number_swept;
+	}
+	qsort(order, number_swept, sizeof(order[0]), compare_sensitivity);
+
+	log_msg("[Autotune] Sensitivity (throughput spread over each parameter's values in its last sweep):");
+	for (uint32_t k = 0 ; k < number_swept ; ++k)
+	{
+		TunedParameter* parameter = &parameters[(uint32_t)order[k][1]];
+		char values[512];
+		size_t used = 0;
+		values[0] = '\0';
+		for (uint32_t i = 0 ; i < parameter->number_of_candidates && used < sizeof(values) ; ++i)
+		{
+			if (0 != parameter->throughput[i])
+			{
+				used += snprintf(values + used, sizeof(values) - used, " %u:%.2f", parameter->candidates[i], parameter->throughput[i] / 1e6);
+			}
+		}
+		log_msg("[Autotune] %-16s %5.1f%%  (value:Mreads/s)%s", parameter->name, order[k][0] * 100, values);
+	}
+}
+
+static void confirm(TrialLane* lanes, const AttackParams* params, const char* label)
+{
+	RunningStats stats;
+	memset(&stats, 0, sizeof(stats));
+	for (uint32_t i = 0 ; i < AUTOTUNE_CONFIRM_TRIALS && keep_running ; ++i)
+	{
+		running_stats_add(&stats, run_trial(lanes, params));
+	}
+	char buf[256];
+	format_params(params, buf, sizeof(buf));
+	log_msg("[Autotune] %-8s %8.3f +- %.3f Mreads/s (95%% CI, %u trials)  %s", label, stats.mean / 1e6, running_stats_ci95(&stats) / 1e6, (uint32_t)stats.n, buf);
+}
+
+void logic_autotune(ClientConnection* conn)
+{
+	__sighandler_t prev = signal(SIGINT, stop_tuning);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+	metrics_register_thread("autotune");
+	log_msg("[Autotune] Tuning over up to %u QPs with %u ms trials, use Ctrl+C (SIGINT) to stop early...", conn->number_of_lanes, trial_ms);
+
+	TrialLane* lanes = do_malloc(conn->number_of_lanes * sizeof(*lanes));
+	for (uint32_t l = 0 ; l < conn->number_of_lanes ; ++l)
+	{
+		lanes[l].lane = &conn->lanes[l];
+		wr_ring_init(&lanes[l].ring, &conn->lanes[l]);
+	}
+
+	AttackParams params = baseline_params;
+	for (uint32_t round = 0 ; round < AUTOTUNE_MAX_ROUNDS && keep_running ; ++round)
+	{
+		int changed = 0;
+		for (uint32_t p = 0 ; p < NUMBER_OF_PARAMETERS && keep_running ; ++p)
+		{
+			changed |= sweep_parameter(lanes, conn->number_of_lanes, &params, &parameters[p], round);
+		}
+		char buf[256];
+		format_params(&params, buf, sizeof(buf));
+		log_msg("[Autotune] after round %u: %s", round, buf);
+		if (!changed)
+		{
+			break;
+		}
+	}
+
+	keep_running = 1;
+	confirm(lanes, &baseline_params, "baseline");
+	confirm(lanes, &params, "best");
+	report_sensitivity();
+
+	for (uint32_t l = 0 ; l < conn->number_of_lanes ; ++l)
+	{
+		wr_ring_destroy(&lanes[l].ring);
+	}
+	free(lanes);
+	prev = signal(SIGINT, prev);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+}
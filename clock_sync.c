@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "clock_sync.h"
+#include "cm.h"
+#include "timeline.h"
+#include "verbs_wrappers.h"
+#include "logging.h"
+#include "memutils.h"
+
+// The timestamp word and the client's copy of it live in a page of their own.
+#define CLOCK_WORD_PAGE 4096
+
+static uint32_t sync_rounds = 0;
+static uint32_t sync_flags = 0;
+static int sync_claimed = 0;
+
+typedef struct
+{
+	// Local time in the middle of the round trip.
+	uint64_t local_ns;
+	// Server clock minus local clock.
+	int64_t offset_ns;
+	uint64_t rtt_ns;
+} ClockSample;
+
+struct ClockSync
+{
+	int sock;
+	uint32_t rounds;
+	int rdma;
+	uint32_t bursts;
+	// The timestamp word QP, if RDMA refinement was asked for.
+	struct ibv_cq* cq;
+	struct ibv_qp* qp;
+	struct ibv_mr* mr;
+	volatile uint64_t* buf;
+	ConnectionInfoExchange* peer_info;
+	// Least squares fit of the offset (ns, relative to the first burst's) over the local time
+	// (seconds since the first burst).
+	uint64_t anchor_ns;
+	int64_t anchor_offset_ns;
+	double n;
+	double sum_x;
+	double sum_y;
+	double sum_xx;
+	double sum_xy;
+	double drift_ppm;
+	pthread_t tracker;
+	volatile int tracking;
+};
+
+struct ClockWord
+{
+	struct ibv_qp* qp;
+	struct ibv_mr* mr;
+	volatile uint64_t* word;
+	pthread_t updater;
+	volatile int updating;
+};
+
+void configure_clock_sync(const char* spec)
+{
+	char* end = NULL;
+	unsigned long rounds = strtoul(spec, &end, 10);
+	if (end == spec || 0 == rounds || rounds > UINT32_MAX)
+	{
+		log_msg("Bad clock sync setting %s, expected rounds[:rdma]", spec);
+		exit(-1);
+	}
+	if (0 == strcmp(end, ":rdma"))
+	{
+		sync_flags |= CLOCK_SYNC_RDMA;
+	}
+	else if ('\0' != *end)
+	{
+		log_msg("Bad clock sync setting %s, expected rounds[:rdma]", spec);
+		exit(-1);
+	}
+	sync_rounds = rounds;
+}
+
+uint32_t clock_sync_claim(uint32_t* flags)
+{
+	*flags = 0;
+	if (0 == sync_rounds || sync_claimed)
+	{
+		return 0;
+	}
+	sync_claimed = 1;
+	*flags = sync_flags;
+	return sync_rounds;
+}
+
+// Small request / answer messages must not wait for Nagle's algorithm.
+static void set_no_delay(int sock)
+{
+	int one = 1;
+	if (0 != setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)))
+	{
+		log_msg("Failed to set TCP_NODELAY! errno = %s", strerror(errno));
+		exit(-1);
+	}
+}
+
+// Sends a request that the server acknowledges with a single byte.
+static void send_request(int sock, char request)
+{
+	do_send(sock, &request, 1);
+	do_recv(sock, &request, 1);
+}
+
+static ClockSample tcp_burst(ClockSync* sync)
+{
+	ClockSample best = { .rtt_ns = UINT64_MAX };
+	for (uint32_t r = 0 ; r < sync->rounds ; ++r)
+	{
+		char request = CLOCK_SYNC_PING;
+		ClockSyncReply reply;
+		uint64_t t1 = timeline_local_ns();
+		do_send(sync->sock, &request, 1);
+		do_recv(sync->sock, (char*)&reply, sizeof(reply));
+		uint64_t t4 = timeline_local_ns();
+		// The time the server held the ping doesn't count towards the uncertainty.
+		uint64_t rtt = (t4 - t1) - (reply.send_ns - reply.receive_ns);
+		if (rtt < best.rtt_ns)
+		{
+			best.local_ns = t1 + (t4 - t1) / 2;
+			best.offset_ns = ((int64_t)(reply.receive_ns - t1) + (int64_t)(reply.send_ns - t4)) / 2;
+			best.rtt_ns = rtt;
+		}
+	}
+	return best;
+}
+
+// Returns 0 if the word couldn't be read (the mock transport moves no data).
+static int rdma_burst(ClockSync* sync, ClockSample* best)
+{
+	const MrEntry* word = &sync->peer_info->mrs[0];
+	struct ibv_wc wc;
+	int valid = 1;
+	best->rtt_ns = UINT64_MAX;
+	send_request(sync->sock, CLOCK_SYNC_WORD_START);
+	for (uint32_t r = 0 ; r < sync->rounds ; ++r)
+	{
+		*sync->buf = 0;
+		uint64_t t1 = timeline_local_ns();
+		do_rdma_read((void*)word->remote_addr, (void*)sync->buf, word->rkey, sync->mr->lkey, sizeof(uint64_t), sync->qp);
+		while (0 == do_cq_poll(sync->qp, &wc, 1));
+		uint64_t t4 = timeline_local_ns();
+		uint64_t server_ns = *sync->buf;
+		if (0 == server_ns)
+		{
+			valid = 0;
+			break;
+		}
+		if (t4 - t1 < best->rtt_ns)
+		{
+			best->local_ns = t1 + (t4 - t1) / 2;
+			best->offset_ns = (int64_t)(server_ns - best->local_ns);
+			best->rtt_ns = t4 - t1;
+		}
+	}
+	send_request(sync->sock, CLOCK_SYNC_WORD_STOP);
+	return valid;
+}
+
+// Refits the clock model with the new sample. Returns the fitted offset at the sample's time.
+static int64_t fit_sample(ClockSync* sync, const ClockSample* sample)
+{
+	if (0 == sync->n)
+	{
+		sync->anchor_ns = sample->local_ns;
+		sync->anchor_offset_ns = sample->offset_ns;
+	}
+	double x = (double)(int64_t)(sample->local_ns - sync->anchor_ns) / 1e9;
+	double y = (double)(sample->offset_ns - sync->anchor_offset_ns);
+	sync->n += 1;
+	sync->sum_x += x;
+	sync->sum_y += y;
+	sync->sum_xx += x * x;
+	sync->sum_xy += x * y;
+
+	// Drift in ns per second, 0 until the bursts span some time.
+	double slope = 0;
+	double denominator = sync->n * sync->sum_xx - sync->sum_x * sync->sum_x;
+	if (sync->n >= 2 && denominator > 0)
+	{
+		slope = (sync->n * sync->sum_xy - sync->sum_x * sync->sum_y) / denominator;
+	}
+	double intercept = (sync->sum_y - slope * sync->sum_x) / sync->n;
+	timeline_set_clock(sync->anchor_offset_ns + (int64_t)intercept, slope / 1e9, sync->anchor_ns);
+	sync->drift_ppm = slope / 1e3;
+	return sync->anchor_offset_ns + (int64_t)(intercept + slope * x);
+}
+
+static void sync_burst(ClockSync* sync)
+{
+	ClockSample sample = tcp_burst(sync);
+	const char* method = "tcp";
+	if (sync->rdma)
+	{
+		ClockSample rdma_sample;
+		if (!rdma_burst(sync, &rdma_sample))
+		{
+			log_msg("[ClockSync] The server's timestamp word reads as zero (the mock transport moves no data), using TCP only");
+			sync->rdma = 0;
+		}
+		else if (rdma_sample.rtt_ns < sample.rtt_ns)
+		{
+			sample = rdma_sample;
+			method = "rdma";
+		}
+	}
+	int64_t model_offset_ns = fit_sample(sync, &sample);
+	++sync->bursts;
+
+	uint64_t now = timeline_now_ns();
+	log_msg("[ClockSync] burst %u: offset %" PRId64 " ns +- %" PRIu64 " ns (%s), fitted offset %" PRId64 " ns, drift %.3f ppm",
+		sync->bursts, sample.offset_ns, sample.rtt_ns / 2, method, model_offset_ns, sync->drift_ppm);
+	timeline_record_at(now, "clock", "offset_ns", sample.offset_ns);
+	timeline_record_at(now, "clock", "uncertainty_ns", sample.rtt_ns / 2);
+	timeline_record_at(now, "clock", "fitted_offset_ns", model_offset_ns);
+	timeline_record_at(now, "clock", "drift_ppm", sync->drift_ppm);
+}
+
+ClockSync* clock_sync_connect(ClientConnection* conn, uint32_t rounds, uint32_t flags)
+{
+	ClockSync* sync = do_malloc(sizeof(*sync));
+	memset(sync, 0, sizeof(*sync));
+	sync->sock = conn->sock;
+	sync->rounds = rounds;
+	set_no_delay(sync->sock);
+	if (flags & CLOCK_SYNC_RDMA)
+	{
+		// A QP of its own, so that bursts while tracking don't steal the lanes' completions.
+		ClientLane* lane = &conn->lanes[0];
+		sync->rdma = 1;
+		sync->peer_info = receive_info_from_peer(sync->sock);
+		sync->cq = create_cq(lane->dev_ctx, CQE_SIZE, NULL, NULL, 0);
+		struct ibv_qp_init_attr qp_attrs = create_qp_init_attr(sync->cq);
+		sync->qp = create_qp(lane->pd, &qp_attrs);
+		sync->buf = alloc_mr(CLOCK_WORD_PAGE);
+		sync->mr = register_mr(lane->pd, (void*)sync->buf, sizeof(uint64_t), IBV_ACCESS_LOCAL_WRITE);
+		send_info_to_peer(sync->sock, sync->qp, lane->dev_ctx, lane->endpoint.port, &sync->mr, 1);
+		setup_qp(sync->peer_info->header.qp_num, sync->peer_info->header.port_lid, lane->endpoint.port, sync->qp);
+	}
+	sync_burst(sync);
+	return sync;
+}
+
+static void* track_clock(void* arg)
+{
+	ClockSync* sync = arg;
+	while (sync->tracking)
+	{
+		for (uint32_t waited_ms = 0 ; waited_ms < CLOCK_SYNC_PERIOD_MS && sync->tracking ; waited_ms += 10)
+		{
+			usleep(10000);
+		}
+		if (sync->tracking)
+		{
+			sync_burst(sync);
+		}
+	}
+	return NULL;
+}
+
+void clock_sync_track(ClockSync* sync)
+{
+	if (NULL == sync)
+	{
+		return;
+	}
+	sync->tracking = 1;
+	int ans = pthread_create(&sync->tracker, NULL, track_clock, sync);
+	if (0 != ans)
+	{
+		log_msg("[ClockSync] Failed to create tracking thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+}
+
+void clock_sync_stop(ClockSync* sync)
+{
+	if (NULL == sync || !sync->tracking)
+	{
+		return;
+	}
+	sync->tracking = 0;
+	pthread_join(sync->tracker, NULL);
+}
+
+void clock_sync_destroy(ClockSync* sync)
+{
+	if (NULL == sync)
+	{
+		return;
+	}
+	clock_sync_stop(sync);
+	if (NULL != sync->qp)
+	{
+		dereg_mr(sync->mr);
+		destroy_qp(sync->qp);
+		destroy_cq(sync->cq);
+		free_mr((void*)sync->buf, CLOCK_WORD_PAGE);
+		free(sync->peer_info);
+	}
+	free(sync);
+}
+
+ClockWord* clock_word_create(int sock, struct ibv_context* dev_ctx, struct ibv_pd* pd, struct ibv_cq* cq, uint8_t port_num)
+{
+	ClockWord* word = do_malloc(sizeof(*word));
+	memset(word, 0, sizeof(*word));
+	word->word = alloc_mr(CLOCK_WORD_PAGE);
+	word->mr = register_mr(pd, (void*)word->word, sizeof(uint64_t), IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
+	struct ibv_qp_init_attr qp_attrs = create_qp_init_attr(cq);
+	word->qp = create_qp(pd, &qp_attrs);
+	send_info_to_peer(sock, word->qp, dev_ctx, port_num, &word->mr, 1);
+	ConnectionInfoExchange* peer_info = receive_info_from_peer(sock);
+	setup_qp(peer_info->header.qp_num, peer_info->header.port_lid, port_num, word->qp);
+	free(peer_info);
+	return word;
+}
+
+void clock_word_destroy(ClockWord* word)
+{
+	if (NULL == word)
+	{
+		return;
+	}
+	destroy_qp(word->qp);
+	dereg_mr(word->mr);
+	free_mr((void*)word->word, CLOCK_WORD_PAGE);
+	free(word);
+}
+
+// Keeps the word current only while the client reads it, so it doesn't take a core during the run.
+static void* update_clock_word(void* arg)
+{
+	ClockWord* word = arg;
+	while (word->updating)
+	{
+		*word->word = timeline_now_ns();
+	}
+	return NULL;
+}
+
+void serve_clock_sync(int sock, ClockWord* word)
+{
+	set_no_delay(sock);
+	for (;;)
+	{
+		char request;
+		do_recv(sock, &request, 1);
+		uint64_t receive_ns = timeline_now_ns();
+		switch (request)
+		{
+			case CLOCK_SYNC_PING:
+			{
+				ClockSyncReply reply = { .receive_ns = receive_ns };
+				reply.send_ns = timeline_now_ns();
+				do_send(sock, (char*)&reply, sizeof(reply));
+				break;
+			}
+			case CLOCK_SYNC_WORD_START:
+			{
+				if (NULL == word)
+				{
+					log_msg("[ClockSync] Peer asked for the timestamp word without setting it up! leaving...");
+					exit(-1);
+				}
+				*word->word = timeline_now_ns();
+				word->updating = 1;
+				int ans = pthread_create(&word->updater, NULL, update_clock_word, word);
+				if (0 != ans)
+				{
+					log_msg("[ClockSync] Failed to create timestamp word thread! errno = %s", strerror(ans));
+					exit(-1);
+				}
+				do_send(sock, &request, 1);
+				break;
+			}
+			case CLOCK_SYNC_WORD_STOP:
+				if (NULL != word && word->updating)
+				{
+					word->updating = 0;
+					pthread_join(word->updater, NULL);
+				}
+				do_send(sock, &request, 1);
+				break;
+			default:
+				// The sync byte of do_sync.
+				do_send(sock, &request, 1);
+				return;
+		}
+	}
+}
@@ -7,10 +7,12 @@
 #include <arpa/inet.h>
 
 #include "cm.h"
+#include "connection.h"
 #include "logging.h"
 #include "memutils.h"
+#include "transport.h"
 
-const uint8_t IB_PORT_NUMBER = 1;
+uint8_t ib_port_number = 1;
 
 void do_send(int sock, char* buf, int size)
 {
@@ -69,7 +71,7 @@ uint64_t recv_buf_from_peer(int peer_sock, void** ptr)
 	return buf_size;
 }
 
-void send_info_to_peer(int peer_sock, struct ibv_qp* qp, struct ibv_context* dev_ctx, struct ibv_mr** mrs, uint32_t number_of_mrs)
+void send_info_to_peer(int peer_sock, struct ibv_qp* qp, struct ibv_context* dev_ctx, uint8_t port_num, struct ibv_mr** mrs, uint32_t number_of_mrs)
 {
 	ConnectionInfoExchange* peer_info = NULL;
 	uint32_t total_bytes_for_struct = sizeof(ConnectionInfoHeader) + number_of_mrs * sizeof(MrEntry);
@@ -81,7 +83,7 @@ void send_info_to_peer(int peer_sock, struct ibv_qp* qp, struct ibv_context* dev
 	}
 
 	struct ibv_port_attr port_attrs;
-	if (0 != ibv_query_port(dev_ctx, IB_PORT_NUMBER, &port_attrs))
+	if (0 != transport->query_port(dev_ctx, port_num, &port_attrs))
 	{
 		log_msg("Failed to fetch port attributes!");
 		exit(-1);
@@ -102,6 +104,43 @@ void send_info_to_peer(int peer_sock, struct ibv_qp* qp, struct ibv_context* dev
 	free(my_info);
 }
 
+void send_fanout_request(int peer_sock, const FanoutRequest* request)
+{
+	do_send(peer_sock, (char*)request, sizeof(*request));
+}
+
+FanoutRequest receive_fanout_request(int peer_sock)
+{
+	FanoutRequest request;
+	do_recv(peer_sock, (char*)&request, sizeof(request));
+	if (0 == request.number_of_qps)
+	{
+		log_msg("Peer asked for no QPs! leaving...");
+		exit(-1);
+	}
+	// A client connects one QP per local endpoint.
+	if (request.number_of_qps > MAX_ENDPOINTS)
+	{
+		log_msg("Peer asked for %u QPs, at most %u are supported! leaving...", request.number_of_qps, MAX_ENDPOINTS);
+		exit(-1);
+	}
+	log_msg("Peer asked for %u QPs", request.number_of_qps);
+	if (0 != request.clock_sync_rounds)
+	{
+		log_msg("Peer asked for clock synchronization, %u rounds per burst%s", request.clock_sync_rounds,
+			(request.clock_sync_flags & CLOCK_SYNC_RDMA) ? ", refined with RDMA reads" : "");
+	}
+	if (0 != request.number_of_ud_qps)
+	{
+		log_msg("Peer asked for %u UD QPs", request.number_of_ud_qps);
+	}
+	if (0 != request.number_of_scale_qps)
+	{
+		log_msg("Peer asked for %u more RC QPs on a shared CQ", request.number_of_scale_qps);
+	}
+	return request;
+}
+
 ConnectionInfoExchange* receive_info_from_peer(int peer_sock)
 {
 	ConnectionInfoExchange* peer_info = NULL;
@@ -110,6 +149,40 @@ ConnectionInfoExchange* receive_info_from_peer(int peer_sock)
 	return peer_info;
 }
 
+void send_qp_batch_to_peer(int peer_sock, struct ibv_qp** qps, uint32_t number_of_qps, struct ibv_context* dev_ctx, uint8_t port_num, uint32_t qkey)
+{
+	uint32_t total_bytes_for_struct = sizeof(QpBatch) + number_of_qps * sizeof(uint32_t);
+	QpBatch* my_info = do_malloc(total_bytes_for_struct);
+	struct ibv_port_attr port_attrs;
+	if (0 != transport->query_port(dev_ctx, port_num, &port_attrs))
+	{
+		log_msg("Failed to fetch port attributes!");
+		exit(-1);
+	}
+	my_info->port_lid = port_attrs.lid;
+	my_info->qkey = qkey;
+	my_info->number_of_qps = number_of_qps;
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		my_info->qp_nums[i] = qps[i]->qp_num;
+	}
+	send_buf_to_peer(peer_sock, (char*)my_info, total_bytes_for_struct);
+	free(my_info);
+}
+
+QpBatch* receive_qp_batch_from_peer(int peer_sock)
+{
+	QpBatch* peer_info = NULL;
+	uint64_t size = recv_buf_from_peer(peer_sock, (void**)(&peer_info));
+	if (size < sizeof(QpBatch) || 0 == peer_info->number_of_qps || size != sizeof(QpBatch) + peer_info->number_of_qps * sizeof(uint32_t))
+	{
+		log_msg("Malformed QP batch from peer (%llu bytes)! leaving...", size);
+		exit(-1);
+	}
+	log_msg("[QP Batch] LID = %hu, %u QPs from QP number %u on", peer_info->port_lid, peer_info->number_of_qps, peer_info->qp_nums[0]);
+	return peer_info;
+}
+
 int do_connect_server(int16_t listen_port)
 {
 	int sock = socket(AF_INET, SOCK_STREAM, 0);
@@ -0,0 +1,202 @@
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "connection.h"
+#include "clock_sync.h"
+#include "ud.h"
+#include "qp_scale.h"
+#include "verbs_wrappers.h"
+#include "numa_placement.h"
+#include "memutils.h"
+#include "logging.h"
+#include "transport.h"
+
+const unsigned int CQE_SIZE = 2048*8;
+const unsigned int CLIENT_BUF_SIZE = 1;
+
+uint32_t parse_endpoints(const char* spec, uint8_t default_port, Endpoint* endpoints, uint32_t max_endpoints)
+{
+	if (NULL == spec)
+	{
+		memset(&endpoints[0], 0, sizeof(endpoints[0]));
+		endpoints[0].port = default_port;
+		return 1;
+	}
+	char* copy = strdup(spec);
+	char* save = NULL;
+	uint32_t count = 0;
+	for (char* item = strtok_r(copy, ",", &save) ; NULL != item ; item = strtok_r(NULL, ",", &save))
+	{
+		if (max_endpoints == count)
+		{
+			log_msg("Too many devices / ports in %s (at most %u)", spec, max_endpoints);
+			exit(-1);
+		}
+		Endpoint* endpoint = &endpoints[count];
+		endpoint->port = default_port;
+		char* colon = strchr(item, ':');
+		if (NULL != colon)
+		{
+			*colon = '\0';
+			char* end = NULL;
+			long port = strtol(colon + 1, &end, 10);
+			if (end == colon + 1 || '\0' != *end || port <= 0 || port > UINT8_MAX)
+			{
+				log_msg("Bad port number in %s", spec);
+				exit(-1);
+			}
+			endpoint->port = port;
+		}
+		if (strlen(item) >= sizeof(endpoint->dev_name))
+		{
+			log_msg("Device name %s is too long", item);
+			exit(-1);
+		}
+		strcpy(endpoint->dev_name, item);
+		++count;
+	}
+	free(copy);
+	if (0 == count)
+	{
+		log_msg("No devices in %s", spec);
+		exit(-1);
+	}
+	return count;
+}
+
+ClientConnection* client_connect(char* server_addr, uint16_t port, const Endpoint* endpoints, uint32_t number_of_endpoints, uint32_t number_of_ud_qps, uint32_t number_of_scale_qps, int attacker_lanes)
+{
+	ClientConnection* conn = do_malloc(sizeof(*conn));
+	conn->sock = do_connect_client(port, server_addr);
+	conn->number_of_lanes = number_of_endpoints;
+	conn->lanes = do_malloc(number_of_endpoints * sizeof(*conn->lanes));
+	conn->clock_sync = NULL;
+	conn->ud = NULL;
+	conn->qp_scale = NULL;
+	FanoutRequest request = {
+		.number_of_qps = number_of_endpoints,
+		.number_of_ud_qps = number_of_ud_qps,
+		.number_of_scale_qps = number_of_scale_qps
+	};
+	request.clock_sync_rounds = clock_sync_claim(&request.clock_sync_flags);
+	send_fanout_request(conn->sock, &request);
+
+	int node = -1;
+	for (uint32_t i = 0 ; i < number_of_endpoints ; ++i)
+	{
+		ClientLane* lane = &conn->lanes[i];
+		lane->endpoint = endpoints[i];
+		lane->peer_info = receive_info_from_peer(conn->sock);
+		lane->dev_ctx = get_dev_context(lane->endpoint.dev_name, lane->endpoint.port);
+		if (0 == i)
+		{
+			node = setup_placement(lane->dev_ctx);
+		}
+		lane->cq = create_cq(lane->dev_ctx, CQE_SIZE, NULL, NULL, select_comp_vector(lane->dev_ctx, node));
+		struct ibv_qp_init_attr qp_attrs = create_qp_init_attr(lane->cq);
+
+		lane->buf = alloc_mr(CLIENT_BUF_SIZE);
+		lane->pd = alloc_pd(lane->dev_ctx);
+		if (attacker_lanes && use_wr_builder)
+		{
+			lane->qp = create_builder_qp(lane->pd, &qp_attrs);
+			lane->qpx = transport->qp_to_qp_ex(lane->qp);
+		}
+		else
+		{
+			lane->qp = create_qp(lane->pd, &qp_attrs);
+			lane->qpx = NULL;
+		}
+		lane->mr = register_mr(lane->pd, lane->buf, CLIENT_BUF_SIZE, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
+		send_info_to_peer(conn->sock, lane->qp, lane->dev_ctx, lane->endpoint.port, &lane->mr, 1);
+		setup_qp(lane->peer_info->header.qp_num, lane->peer_info->header.port_lid, lane->endpoint.port, lane->qp);
+	}
+	if (0 != number_of_ud_qps)
+	{
+		conn->ud = ud_connect(conn, number_of_ud_qps);
+	}
+	if (0 != number_of_scale_qps)
+	{
+		conn->qp_scale = qp_scale_connect(conn, number_of_scale_qps);
+	}
+	// Last, the server serves clock synchronization once every other exchange is done (see do_server).
+	if (0 != request.clock_sync_rounds)
+	{
+		conn->clock_sync = clock_sync_connect(conn, request.clock_sync_rounds, request.clock_sync_flags);
+	}
+	return conn;
+}
+
+void client_disconnect(ClientConnection* conn)
+{
+	clock_sync_destroy(conn->clock_sync);
+	ud_disconnect(conn->ud);
+	qp_scale_disconnect(conn->qp_scale);
+	for (uint32_t i = 0 ; i < conn->number_of_lanes ; ++i)
+	{
+		ClientLane* lane = &conn->lanes[i];
+		dereg_mr(lane->mr);
+		destroy_qp(lane->qp);
+		dealloc_pd(lane->pd);
+
+		free(lane->peer_info);
+		free_mr(lane->buf, CLIENT_BUF_SIZE);
+		destroy_cq(lane->cq);
+		do_close_device(lane->dev_ctx);
+	}
+	free(conn->lanes);
+	close(conn->sock);
+	free(conn);
+}
+
+void setup_qp(uint32_t qp_num, uint16_t port_lid, uint8_t port_num, struct ibv_qp* qp)
+{
+	struct ibv_qp_attr attr;
+
+	//RESET -> INIT 
+	attr.qp_state = IBV_QPS_INIT;
+	attr.pkey_index = 0;
+	attr.port_num = port_num;
+	attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE |  IBV_ACCESS_REMOTE_READ;
+	if (0 != transport->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS))
+	{
+		log_msg("Failed to change states: RESET -> INIT");
+		exit(-1);
+	}
+
+	log_msg("RESET -> INIT QP Set Successfully");
+	attr.qp_state = IBV_QPS_RTR;
+	attr.path_mtu = IBV_MTU_512;
+	attr.ah_attr.dlid = port_lid;
+	attr.ah_attr.is_global = 0;
+	attr.ah_attr.sl = 0;
+	attr.ah_attr.port_num = port_num;
+	attr.dest_qp_num = qp_num;
+	attr.rq_psn = 1;
+	attr.max_dest_rd_atomic = 1;
+	attr.min_rnr_timer = 12;
+
+	if (0 != transport->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PATH_MTU | IBV_QP_AV | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER))
+	{
+		log_msg("Failed to change states: INIT -> RTR");
+		exit(-1);
+	}
+
+	log_msg("INIT -> RTR QP Set Successfully");
+
+	attr.qp_state = IBV_QPS_RTS;
+	attr.timeout = 14;
+	attr.retry_cnt = 7;
+	attr.rnr_retry = 7;
+	attr.sq_psn = 1;
+	attr.max_rd_atomic = 1;
+
+	if (0 != transport->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC))
+	{
+		log_msg("Failed to change state: RTR -> RTS");
+		exit(-1);
+	}
+
+	log_msg("RNR -> RTR QP Set Successfully");
+}
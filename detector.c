@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "detector.h"
+#include "timeline.h"
+#include "logging.h"
+
+DetectorConfig detector_config = {
+	.warmup = 0,
+	.clip = 3,
+	.ewma_alpha = 0.1,
+	.ewma_limit = 4,
+	.cusum_k = 0.5,
+	.cusum_h = 8,
+	.window = 0,
+	.quantile = 0.9,
+	.quantile_ratio = 1.5
+};
+
+static const char* kind_names[NUMBER_OF_DETECTORS] = { "ewma", "cusum", "quantile" };
+
+const char* detector_kind_name(DetectorKind kind)
+{
+	return kind_names[kind];
+}
+
+void configure_detectors(const char* spec)
+{
+	DetectorConfig config = detector_config;
+	char* copy = strdup(spec);
+	char* save = NULL;
+	for (char* item = strtok_r(copy, ",", &save) ; NULL != item ; item = strtok_r(NULL, ",", &save))
+	{
+		char key[32];
+		double value;
+		if (2 != sscanf(item, "%31[a-z_]=%lf", key, &value))
+		{
+			log_msg("Bad detector setting %s, expected key=value", item);
+			exit(-1);
+		}
+		int is_count = (0 == strcmp(key, "warmup") || 0 == strcmp(key, "window"));
+		if (is_count && (value < 0 || value > UINT32_MAX || value != floor(value)))
+		{
+			log_msg("Detector %s must be a non-negative integer, not %s", key, item + strlen(key) + 1);
+			exit(-1);
+		}
+		if (0 == strcmp(key, "warmup"))
+		{
+			config.warmup = value;
+		}
+		else if (0 == strcmp(key, "clip"))
+		{
+			config.clip = value;
+		}
+		else if (0 == strcmp(key, "ewma_alpha"))
+		{
+			config.ewma_alpha = value;
+		}
+		else if (0 == strcmp(key, "ewma_limit"))
+		{
+			config.ewma_limit = value;
+		}
+		else if (0 == strcmp(key, "cusum_k"))
+		{
+			config.cusum_k = value;
+		}
+		else if (0 == strcmp(key, "cusum_h"))
+		{
+			config.cusum_h = value;
+		}
+		else if (0 == strcmp(key, "window"))
+		{
+			config.window = value;
+		}
+		else if (0 == strcmp(key, "quantile"))
+		{
+			config.quantile = value;
+		}
+		else if (0 == strcmp(key, "quantile_ratio"))
+		{
+			config.quantile_ratio = value;
+		}
+		else
+		{
+			log_msg("Unknown detector setting %s", key);
+			exit(-1);
+		}
+	}
+	free(copy);
+	if ((0 != config.window && (config.window < 2 || config.window > DETECTOR_MAX_WINDOW)) ||
+		(0 != config.warmup && config.warmup < ((0 == config.window) ? 2 : config.window)))
+	{
+		log_msg("Detector window must be 2-%u samples and no longer than the warmup", DETECTOR_MAX_WINDOW);
+		exit(-1);
+	}
+	if (config.clip <= 0 || config.ewma_alpha <= 0 || config.ewma_alpha > 1 || config.quantile <= 0 || config.quantile >= 1 || config.quantile_ratio <= 1)
+	{
+		log_msg("Detector settings out of range: need clip > 0, 0 < ewma_alpha <= 1, 0 < quantile < 1 and quantile_ratio > 1");
+		exit(-1);
+	}
+	detector_config = config;
+}
+
+void detector_init(LatencyDetector* d, const char* name, uint64_t probe_interval_us)
+{
+	memset(d, 0, sizeof(*d));
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->config = detector_config;
+	if (0 == d->config.warmup)
+	{
+		uint64_t warmup = DETECTOR_WARMUP_US / ((0 == probe_interval_us) ? 1 : probe_interval_us);
+		warmup = (warmup < DETECTOR_MIN_WARMUP) ? DETECTOR_MIN_WARMUP : warmup;
+		warmup = (warmup > DETECTOR_MAX_WARMUP) ? DETECTOR_MAX_WARMUP : warmup;
+		// An explicit window still has to fit in the warmup.
+		d->config.warmup = (warmup < d->config.window) ? d->config.window : warmup;
+	}
+	if (0 == d->config.window)
+	{
+		uint32_t window = d->config.warmup / 2;
+		d->config.window = (window > DETECTOR_DEFAULT_WINDOW) ? DETECTOR_DEFAULT_WINDOW : window;
+	}
+}
+
+uint32_t detector_alarms(const LatencyDetector* d)
+{
+	uint32_t alarms = 0;
+	for (uint32_t k = 0 ; k < NUMBER_OF_DETECTORS ; ++k)
+	{
+		alarms += d->states[k].degraded;
+	}
+	return alarms;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double da = *(const double*)a;
+	double db = *(const double*)b;
+	return (da > db) - (da < db);
+}
+
+static uint32_t window_size(const LatencyDetector* d)
+{
+	return (d->samples < d->config.window) ? d->samples : d->config.window;
+}
+
+// Position of the quantile in the sorted window.
+static uint32_t quantile_index(const LatencyDetector* d)
+{
+	uint32_t n = window_size(d);
+	uint32_t index = (uint32_t)ceil(d->config.quantile * n);
+	return (0 == index) ? 0 : index - 1;
+}
+
+static double window_quantile(const LatencyDetector* d)
+{
+	double sorted[DETECTOR_MAX_WINDOW];
+	uint32_t n = window_size(d);
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		sorted[i] = d->ring[i].value;
+	}
+	qsort(sorted, n, sizeof(sorted[0]), compare_doubles);
+	return sorted[quantile_index(d)];
+}
+
+// Walks the window from the newest sample back until `needed` samples are above (or, if !above, at most)
+// the threshold, and returns the time of that sample: the start of the shortest suffix that explains the change.
+static uint64_t window_change_point(const LatencyDetector* d, double threshold, int above, uint32_t needed)
+{
+	uint32_t n = window_size(d);
+	uint32_t found = 0;
+	uint64_t time_ns = d->ring[(d->samples - 1) % d->config.window].time_ns;
+	for (uint32_t i = 0 ; i < n && found < needed ; ++i)
+	{
+		const DetectorSample* sample = &d->ring[(d->samples - 1 - i) % d->config.window];
+		if ((sample->value > threshold) == above)
+		{
+			++found;
+			time_ns = sample->time_ns;
+		}
+	}
+	return time_ns;
+}
+
+static void set_state(LatencyDetector* d, DetectorKind kind, int degraded, uint64_t change_ns, uint64_t now)
+{
+	DetectorState* state = &d->states[kind];
+	state->degraded = degraded;
+	state->changed = 1;
+	state->change_ns = (0 == change_ns || change_ns > now) ? now : change_ns;
+	state->detected_ns = now;
+	state->candidate_ns = 0;
+
+	double delay_ms = (now - state->change_ns) / 1e6;
+	char name[DETECTOR_NAME_LEN * 2];
+	snprintf(name, sizeof(name), "%s/%s_%s_delay_ms", d->name, kind_names[kind], degraded ? "onset" : "recovery");
+	timeline_record_at(now, "detector", name, delay_ms);
+	log_msg("[Detector] %s/%s: %s at %" PRIu64 ", detected at %" PRIu64 " (%.3f ms later)", d->name, kind_names[kind],
+		degraded ? "degradation" : "recovery", state->change_ns, now, delay_ms);
+}
+
+// Remembers the first sample after the detector's statistic left its resting value, as the change point estimate.
+static void track_candidate(DetectorState* state, int resting, uint64_t time_ns)
+{
+	if (resting)
+	{
+		state->candidate_ns = 0;
+	}
+	else if (0 == state->candidate_ns)
+	{
+		state->candidate_ns = time_ns;
+	}
+}
+
+static void finish_warmup(LatencyDetector* d)
+{
+	double mean = d->baseline.mean;
+	d->sigma = running_stats_stddev(&d->baseline);
+	// A perfectly steady baseline would turn any jitter into an alarm.
+	if (d->sigma < 0.01 * mean)
+	{
+		d->sigma = 0.01 * mean;
+	}
+	if (d->sigma < 1)
+	{
+		d->sigma = 1;
+	}
+	d->ewma = mean;
+	d->baseline_quantile = d->warmup_quantiles.mean;
+	log_msg("[Detector] %s baseline over %" PRIu64 " samples: mean %.2f us, stddev %.2f us, p%g %.2f us", d->name, d->samples,
+		mean / 1000, d->sigma / 1000, d->config.quantile * 100, d->baseline_quantile / 1000);
+}
+
+static double clip_sample(const LatencyDetector* d, double latency_ns)
+{
+	return fmin(latency_ns, d->baseline.mean + d->config.clip * d->sigma);
+}
+
+static void update_ewma(LatencyDetector* d, uint64_t time_ns, double latency_ns)
+{
+	DetectorState* state = &d->states[DETECTOR_EWMA];
+	double alpha = d->config.ewma_alpha;
+	d->ewma = alpha * clip_sample(d, latency_ns) + (1 - alpha) * d->ewma;
+	double ewma_sigma = d->sigma * sqrt(alpha / (2 - alpha));
+	double mean = d->baseline.mean;
+	if (!state->degraded)
+	{
+		track_candidate(state, d->ewma <= mean, time_ns);
+		if (d->ewma > mean + d->config.ewma_limit * ewma_sigma)
+		{
+			set_state(d, DETECTOR_EWMA, 1, state->candidate_ns, time_ns);
+		}
+	}
+	else
+	{
+		// Recovery at half the alarm limit, so that an EWMA hovering at the limit doesn't flap.
+		double limit = mean + d->config.ewma_limit * ewma_sigma;
+		track_candidate(state, d->ewma >= limit, time_ns);
+		if (d->ewma < mean + d->config.ewma_limit / 2 * ewma_sigma)
+		{
+			set_state(d, DETECTOR_EWMA, 0, state->candidate_ns, time_ns);
+		}
+	}
+}
+
+static void update_cusum(LatencyDetector* d, uint64_t time_ns, double latency_ns)
+{
+	DetectorState* state = &d->states[DETECTOR_CUSUM];
+	double mean = d->baseline.mean;
+	double reference = mean + d->config.cusum_k * d->sigma;
+	double threshold = d->config.cusum_h * d->sigma;
+	if (!state->degraded)
+	{
+		d->cusum_up = fmax(0, d->cusum_up + clip_sample(d, latency_ns) - reference);
+		track_candidate(state, 0 == d->cusum_up, time_ns);
+		if (d->cusum_up > threshold)
+		{
+			d->cusum_up = 0;
+			d->cusum_down = 0;
+			set_state(d, DETECTOR_CUSUM, 1, state->candidate_ns, time_ns);
+		}
+	}
+	else
+	{
+		d->cusum_down = fmax(0, d->cusum_down + reference - latency_ns);
+		track_candidate(state, 0 == d->cusum_down, time_ns);
+		if (d->cusum_down > threshold)
+		{
+			d->cusum_up = 0;
+			d->cusum_down = 0;
+			set_state(d, DETECTOR_CUSUM, 0, state->candidate_ns, time_ns);
+		}
+	}
+}
+
+static void update_quantile(LatencyDetector* d, uint64_t time_ns)
+{
+	DetectorState* state = &d->states[DETECTOR_QUANTILE];
+	double current = window_quantile(d);
+	uint32_t index = quantile_index(d);
+	if (!state->degraded)
+	{
+		double threshold = d->config.quantile_ratio * d->baseline_quantile;
+		if (current > threshold)
+		{
+			// The quantile is above the threshold once the samples from its position up are.
+			set_state(d, DETECTOR_QUANTILE, 1, window_change_point(d, threshold, 1, window_size(d) - index), time_ns);
+		}
+	}
+	else
+	{
+		double threshold = (1 + (d->config.quantile_ratio - 1) / 2) * d->baseline_quantile;
+		if (current <= threshold)
+		{
+			set_state(d, DETECTOR_QUANTILE, 0, window_change_point(d, threshold, 0, index + 1), time_ns);
+		}
+	}
+}
+
+void detector_add(LatencyDetector* d, uint64_t time_ns, double latency_ns)
+{
+	d->ring[d->samples % d->config.window].time_ns = time_ns;
+	d->ring[d->samples % d->config.window].value = latency_ns;
+	++d->samples;
+	for (uint32_t k = 0 ; k < NUMBER_OF_DETECTORS ; ++k)
+	{
+		d->states[k].changed = 0;
+	}
+	if (d->samples <= d->config.warmup)
+	{
+		running_stats_add(&d->baseline, latency_ns);
+		if (0 == d->samples % d->config.window)
+		{
+			running_stats_add(&d->warmup_quantiles, window_quantile(d));
+		}
+		if (d->samples == d->config.warmup)
+		{
+			finish_warmup(d);
+		}
+		return;
+	}
+	update_ewma(d, time_ns, latency_ns);
+	update_cusum(d, time_ns, latency_ns);
+	update_quantile(d, time_ns);
+}
@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "geometry.h"
+#include "logging.h"
+#include "memutils.h"
+
+// The built-in layout: two sets of 1024 regions of 8 pages, one indexed by bits 15-24
+// and one by bits 24-33, placed above the highest address either of them uses.
+RegionGeometry geometry = {
+	.page_size = 0x1000,
+	.prefetch_group_size = 8,
+	.region_size = 0x1000 * 8,
+	.port_stride = ((uint64_t)1) << 36,
+	.number_of_sets = 2,
+	.sets = {
+		{
+			.first_bit = 15,
+			.last_bit = 24,
+			.base_address = ((uint64_t)1) << (33 + 9),
+			.count = 1 << (24 + 1 - 15)
+		},
+		{
+			.first_bit = 24,
+			.last_bit = 33,
+			.base_address = ((uint64_t)1) << (33 + 10),
+			.count = 1 << (33 + 1 - 24)
+		}
+	}
+};
+
+static void geometry_error(const char* path, int line_no, const char* msg, const char* token)
+{
+	log_msg("Bad geometry file %s, line %d: %s (%s)", path, line_no, msg, (NULL == token) ? "" : token);
+	exit(-1);
+}
+
+static uint64_t parse_number(const char* path, int line_no, const char* value)
+{
+	char* end = NULL;
+	errno = 0;
+	uint64_t number = strtoull(value, &end, 0);
+	if (0 != errno || end == value || '\0' != *end)
+	{
+		geometry_error(path, line_no, "bad number", value);
+	}
+	return number;
+}
+
+// Parses a list such as "0,7,100-199" into the set's sparse index list. Runs once the set's count
+// is known, so that ranges past it are rejected before they are expanded.
+static void parse_indices(const char* path, int line_no, char* value, RegionSet* set)
+{
+	uint32_t capacity = 16;
+	set->indices = do_malloc(capacity * sizeof(*set->indices));
+	set->number_of_indices = 0;
+	char* save = NULL;
+	for (char* item = strtok_r(value, ",", &save) ; NULL != item ; item = strtok_r(NULL, ",", &save))
+	{
+		char* dash = strchr(item, '-');
+		uint64_t first = 0;
+		uint64_t last = 0;
+		if (NULL == dash)
+		{
+			first = last = parse_number(path, line_no, item);
+		}
+		else
+		{
+			*dash = '\0';
+			first = parse_number(path, line_no, item);
+			last = parse_number(path, line_no, dash + 1);
+		}
+		if (last < first)
+		{
+			geometry_error(path, line_no, "bad index range", item);
+		}
+		if (last >= set->count)
+		{
+			geometry_error(path, line_no, "index out of range", (NULL == dash) ? item : dash + 1);
+		}
+		for (uint64_t i = first ; i <= last ; ++i)
+		{
+			if (set->number_of_indices == capacity)
+			{
+				capacity *= 2;
+				set->indices = realloc(set->indices, capacity * sizeof(*set->indices));
+				if (NULL == set->indices)
+				{
+					log_msg("Failed to realloc index list! leaving...");
+					exit(-1);
+				}
+			}
+			set->indices[set->number_of_indices++] = i;
+		}
+	}
+}
+
+// Bits index 64 bit addresses.
+static uint32_t parse_bit(const char* path, int line_no, const char* value)
+{
+	uint64_t bit = parse_number(path, line_no, value);
+	if (bit >= 64)
+	{
+		geometry_error(path, line_no, "bit out of range", value);
+	}
+	return bit;
+}
+
+static void parse_set(const char* path, int line_no, char* args, RegionSet* set)
+{
+	memset(set, 0, sizeof(*set));
+	int has_first = 0;
+	int has_last = 0;
+	int has_base = 0;
+	char* indices = NULL;
+	char* save = NULL;
+	for (char* tok = strtok_r(args, " \t\r\n", &save) ; NULL != tok ; tok = strtok_r(NULL, " \t\r\n", &save))
+	{
+		char* eq = strchr(tok, '=');
+		if (NULL == eq)
+		{
+			geometry_error(path, line_no, "expected key=value", tok);
+		}
+		*eq = '\0';
+		char* value = eq + 1;
+		if (0 == strcmp(tok, "first_bit"))
+		{
+			set->first_bit = parse_bit(path, line_no, value);
+			has_first = 1;
+		}
+		else if (0 == strcmp(tok, "last_bit"))
+		{
+			set->last_bit = parse_bit(path, line_no, value);
+			has_last = 1;
+		}
+		else if (0 == strcmp(tok, "base"))
+		{
+			set->base_address = parse_number(path, line_no, value);
+			has_base = 1;
+		}
+		else if (0 == strcmp(tok, "count"))
+		{
+			uint64_t count = parse_number(path, line_no, value);
+			if (count > UINT32_MAX)
+			{
+				geometry_error(path, line_no, "count too large", value);
+			}
+			set->count = count;
+		}
+		else if (0 == strcmp(tok, "indices"))
+		{
+			indices = value;
+		}
+		else
+		{
+			geometry_error(path, line_no, "unknown set attribute", tok);
+		}
+	}
+	if (!has_first || !has_last || !has_base)
+	{
+		geometry_error(path, line_no, "a set needs first_bit, last_bit and base", NULL);
+	}
+	if (set->last_bit < set->first_bit || set->last_bit - set->first_bit >= 31)
+	{
+		geometry_error(path, line_no, "bad bit range", NULL);
+	}
+	uint32_t max_count = ((uint32_t)1) << (set->last_bit + 1 - set->first_bit);
+	if (0 == set->count)
+	{
+		set->count = max_count;
+	}
+	if (set->count > max_count)
+	{
+		geometry_error(path, line_no, "count doesn't fit in the bit range", NULL);
+	}
+	if (NULL != indices)
+	{
+		parse_indices(path, line_no, indices, set);
+	}
+}
+
+void load_geometry(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (NULL == f)
+	{
+		log_msg("Failed to open geometry file %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+
+	RegionGeometry geo = geometry;
+	geo.region_size = 0;
+	geo.number_of_sets = 0;
+	char line[4096];
+	int line_no = 0;
+	while (NULL != fgets(line, sizeof(line), f))
+	{
+		++line_no;
+		char* start = line + strspn(line, " \t");
+		start[strcspn(start, "#\r\n")] = '\0';
+		if ('\0' == *start)
+		{
+			continue;
+		}
+		if (0 == strncmp(start, "set", 3) && (' ' == start[3] || '\t' == start[3]))
+		{
+			if (MAX_REGION_SETS == geo.number_of_sets)
+			{
+				geometry_error(path, line_no, "too many sets", NULL);
+			}
+			parse_set(path, line_no, start + 4, &geo.sets[geo.number_of_sets]);
+			++geo.number_of_sets;
+			continue;
+		}
+
+		char key[64];
+		char value[64];
+		if (2 != sscanf(start, " %63[a-z_] = %63s", key, value))
+		{
+			geometry_error(path, line_no, "expected key = value", start);
+		}
+		if (0 == strcmp(key, "page_size"))
+		{
+			geo.page_size = parse_number(path, line_no, value);
+		}
+		else if (0 == strcmp(key, "prefetch_group_size"))
+		{
+			geo.prefetch_group_size = parse_number(path, line_no, value);
+		}
+		else if (0 == strcmp(key, "region_size"))
+		{
+			geo.region_size = parse_number(path, line_no, value);
+		}
+		else if (0 == strcmp(key, "port_stride"))
+		{
+			geo.port_stride = parse_number(path, line_no, value);
+		}
+		else
+		{
+			geometry_error(path, line_no, "unknown key", key);
+		}
+	}
+	fclose(f);
+
+	if (0 == geo.page_size || 0 == geo.prefetch_group_size)
+	{
+		geometry_error(path, line_no, "page_size and prefetch_group_size must be positive", NULL);
+	}
+	if (0 == geo.region_size)
+	{
+		geo.region_size = geo.page_size * geo.prefetch_group_size;
+	}
+	if (0 == geo.number_of_sets)
+	{
+		geometry_error(path, line_no, "no region sets", NULL);
+	}
+	for (uint32_t i = 0 ; i < geo.number_of_sets ; ++i)
+	{
+		if (geo.region_size > ((uint64_t)1) << geo.sets[i].first_bit)
+		{
+			log_msg("Geometry file %s: regions of set %u overlap (region_size = %u, first_bit = %u)", path, i, geo.region_size, geo.sets[i].first_bit);
+			exit(-1);
+		}
+		// The last region of the set must end within the address space.
+		uint64_t span = (uint64_t)(geo.sets[i].count - 1) << geo.sets[i].first_bit;
+		if (span > UINT64_MAX - geo.sets[i].base_address || geo.region_size > UINT64_MAX - geo.sets[i].base_address - span)
+		{
+			log_msg("Geometry file %s: set %u runs past the end of the address space (base = 0x%" PRIx64 ", count = %u, first_bit = %u)",
+				path, i, geo.sets[i].base_address, geo.sets[i].count, geo.sets[i].first_bit);
+			exit(-1);
+		}
+	}
+	geometry = geo;
+	print_geometry(&geometry);
+}
+
+uint32_t region_set_size(const RegionSet* set)
+{
+	return (NULL == set->indices) ? set->count : set->number_of_indices;
+}
+
+uint32_t geometry_number_of_regions(const RegionGeometry* geo)
+{
+	uint32_t total = 0;
+	for (uint32_t i = 0 ; i < geo->number_of_sets ; ++i)
+	{
+		total += region_set_size(&geo->sets[i]);
+	}
+	return total;
+}
+
+uint64_t geometry_region_address(const RegionSet* set, uint32_t i)
+{
+	uint64_t index = (NULL == set->indices) ? i : set->indices[i];
+	return set->base_address + (index << set->first_bit);
+}
+
+void print_geometry(const RegionGeometry* geo)
+{
+	log_msg("[Geometry] page size = %u, prefetch group = %u, region size = %u, port stride = 0x%" PRIx64, geo->page_size, geo->prefetch_group_size, geo->region_size, geo->port_stride);
+	for (uint32_t i = 0 ; i < geo->number_of_sets ; ++i)
+	{
+		const RegionSet* set = &geo->sets[i];
+		log_msg("[Geometry] set %u: bits %u-%u, base = 0x%" PRIx64 ", count = %u, registered = %u", i, set->first_bit, set->last_bit, set->base_address, set->count, region_set_size(set));
+	}
+}
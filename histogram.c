@@ -0,0 +1,84 @@
+#include <string.h>
+
+#include "histogram.h"
+
+uint64_t histogram_bucket_low(uint32_t bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	uint64_t sub = bucket % HISTOGRAM_SUB_BUCKETS;
+	return (HISTOGRAM_SUB_BUCKETS + sub) << shift;
+}
+
+uint64_t histogram_bucket_high(uint32_t bucket)
+{
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+	uint32_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	return histogram_bucket_low(bucket) + (((uint64_t)1) << shift) - 1;
+}
+
+uint64_t histogram_percentile(const Histogram* h, double fraction)
+{
+	if (0 == h->count)
+	{
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(fraction * h->count);
+	if (rank >= h->count)
+	{
+		rank = h->count - 1;
+	}
+	uint64_t seen = 0;
+	for (uint32_t i = 0 ; i < HISTOGRAM_BUCKETS ; ++i)
+	{
+		seen += h->buckets[i];
+		if (seen > rank)
+		{
+			uint64_t high = histogram_bucket_high(i);
+			return (high > h->max) ? h->max : high;
+		}
+	}
+	return h->max;
+}
+
+double histogram_mean(const Histogram* h)
+{
+	return (0 == h->count) ? 0 : (double)h->sum / h->count;
+}
+
+void histogram_snapshot(const Histogram* src, Histogram* dst)
+{
+	// Reading count first means the buckets hold at least count values.
+	dst->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+	dst->sum = __atomic_load_n(&src->sum, __ATOMIC_RELAXED);
+	dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+	for (uint32_t i = 0 ; i < HISTOGRAM_BUCKETS ; ++i)
+	{
+		dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+	}
+}
+
+void histogram_merge(Histogram* dst, const Histogram* src)
+{
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+	{
+		dst->max = src->max;
+	}
+	for (uint32_t i = 0 ; i < HISTOGRAM_BUCKETS ; ++i)
+	{
+		dst->buckets[i] += src->buckets[i];
+	}
+}
+
+void histogram_reset(Histogram* h)
+{
+	memset(h, 0, sizeof(*h));
+}
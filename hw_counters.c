@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+
+#include "hw_counters.h"
+#include "timeline.h"
+#include "logging.h"
+#include "memutils.h"
+#include "transport.h"
+
+#define COUNTER_NAME_LEN 128
+
+typedef struct
+{
+	char name[COUNTER_NAME_LEN];
+	char path[PATH_MAX];
+	uint64_t last;
+} SysfsCounter;
+
+typedef struct
+{
+	char ifname[IFNAMSIZ];
+	uint32_t number_of_stats;
+	char* names;
+	struct ethtool_stats* stats;
+	uint64_t* last;
+} EthtoolCounters;
+
+typedef struct
+{
+	uint32_t interval_ms;
+	SysfsCounter* counters;
+	uint32_t number_of_counters;
+	EthtoolCounters* netdevs;
+	uint32_t number_of_netdevs;
+	int ethtool_sock;
+} CounterSampler;
+
+static int read_counter(const char* path, uint64_t* value)
+{
+	FILE* f = fopen(path, "r");
+	if (NULL == f)
+	{
+		return -1;
+	}
+	int ans = (1 == fscanf(f, "%" SCNu64, value)) ? 0 : -1;
+	fclose(f);
+	return ans;
+}
+
+// Adds every readable file in the directory as a counter named <prefix>/<file>.
+static void add_sysfs_counters(CounterSampler* sampler, const char* dir_path, const char* prefix)
+{
+	DIR* dir = opendir(dir_path);
+	if (NULL == dir)
+	{
+		return;
+	}
+	struct dirent* entry;
+	while (NULL != (entry = readdir(dir)))
+	{
+		if ('.' == entry->d_name[0])
+		{
+			continue;
+		}
+		SysfsCounter counter;
+		snprintf(counter.name, sizeof(counter.name), "%s/%s", prefix, entry->d_name);
+		snprintf(counter.path, sizeof(counter.path), "%s/%s", dir_path, entry->d_name);
+		if (0 != read_counter(counter.path, &counter.last))
+		{
+			continue;
+		}
+		sampler->counters = realloc(sampler->counters, (sampler->number_of_counters + 1) * sizeof(*sampler->counters));
+		if (NULL == sampler->counters)
+		{
+			log_msg("[HW] Failed to realloc! leaving...");
+			exit(-1);
+		}
+		sampler->counters[sampler->number_of_counters++] = counter;
+	}
+	closedir(dir);
+}
+
+static int ethtool_ioctl(int sock, const char* ifname, void* data)
+{
+	struct ifreq ifr;
+	memset(&ifr, 0, sizeof(ifr));
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+	ifr.ifr_data = data;
+	return ioctl(sock, SIOCETHTOOL, &ifr);
+}
+
+static int read_ethtool_stats(int sock, EthtoolCounters* netdev)
+{
+	netdev->stats->cmd = ETHTOOL_GSTATS;
+	netdev->stats->n_stats = netdev->number_of_stats;
+	return ethtool_ioctl(sock, netdev->ifname, netdev->stats);
+}
+
+// Adds the ethtool statistics ("ethtool -S") of the network interface, if it has any.
+static void add_ethtool_counters(CounterSampler* sampler, const char* ifname)
+{
+	struct
+	{
+		struct ethtool_sset_info hdr;
+		uint32_t buf[1];
+	} sset_info;
+	memset(&sset_info, 0, sizeof(sset_info));
+	sset_info.hdr.cmd = ETHTOOL_GSSET_INFO;
+	sset_info.hdr.sset_mask = 1ULL << ETH_SS_STATS;
+	if (0 != ethtool_ioctl(sampler->ethtool_sock, ifname, &sset_info) || 0 == sset_info.hdr.sset_mask || 0 == sset_info.buf[0])
+	{
+		return;
+	}
+
+	EthtoolCounters netdev;
+	memset(&netdev, 0, sizeof(netdev));
+	snprintf(netdev.ifname, sizeof(netdev.ifname), "%s", ifname);
+	netdev.number_of_stats = sset_info.buf[0];
+
+	struct ethtool_gstrings* strings = do_malloc(sizeof(*strings) + netdev.number_of_stats * ETH_GSTRING_LEN);
+	strings->cmd = ETHTOOL_GSTRINGS;
+	strings->string_set = ETH_SS_STATS;
+	strings->len = netdev.number_of_stats;
+	if (0 != ethtool_ioctl(sampler->ethtool_sock, ifname, strings))
+	{
+		free(strings);
+		return;
+	}
+	netdev.names = do_malloc(netdev.number_of_stats * ETH_GSTRING_LEN);
+	memcpy(netdev.names, strings->data, netdev.number_of_stats * ETH_GSTRING_LEN);
+	free(strings);
+
+	netdev.stats = do_malloc(sizeof(*netdev.stats) + netdev.number_of_stats * sizeof(uint64_t));
+	netdev.last = do_malloc(netdev.number_of_stats * sizeof(uint64_t));
+	if (0 != read_ethtool_stats(sampler->ethtool_sock, &netdev))
+	{
+		free(netdev.names);
+		free(netdev.stats);
+		free(netdev.last);
+		return;
+	}
+	memcpy(netdev.last, netdev.stats->data, netdev.number_of_stats * sizeof(uint64_t));
+
+	sampler->netdevs = realloc(sampler->netdevs, (sampler->number_of_netdevs + 1) * sizeof(*sampler->netdevs));
+	if (NULL == sampler->netdevs)
+	{
+		log_msg("[HW] Failed to realloc! leaving...");
+		exit(-1);
+	}
+	sampler->netdevs[sampler->number_of_netdevs++] = netdev;
+	log_msg("[HW] Sampling %u ethtool statistics of %s", netdev.number_of_stats, ifname);
+}
+
+static void* sampler_thread(void* arg)
+{
+	CounterSampler* sampler = arg;
+	char name[COUNTER_NAME_LEN + IFNAMSIZ + ETH_GSTRING_LEN];
+	while (1)
+	{
+		usleep(sampler->interval_ms * 1000);
+		uint64_t now = timeline_now_ns();
+		for (uint32_t i = 0 ; i < sampler->number_of_counters ; ++i)
+		{
+			SysfsCounter* counter = &sampler->counters[i];
+			uint64_t value;
+			if (0 != read_counter(counter->path, &value))
+			{
+				continue;
+			}
+			if (value != counter->last)
+			{
+				timeline_record_at(now, "hw", counter->name, (double)(value - counter->last));
+				counter->last = value;
+			}
+		}
+		for (uint32_t i = 0 ; i < sampler->number_of_netdevs ; ++i)
+		{
+			EthtoolCounters* netdev = &sampler->netdevs[i];
+			if (0 != read_ethtool_stats(sampler->ethtool_sock, netdev))
+			{
+				continue;
+			}
+			for (uint32_t j = 0 ; j < netdev->number_of_stats ; ++j)
+			{
+				uint64_t value = netdev->stats->data[j];
+				if (value != netdev->last[j])
+				{
+					snprintf(name, sizeof(name), "ethtool/%s/%.*s", netdev->ifname, ETH_GSTRING_LEN, netdev->names + j * ETH_GSTRING_LEN);
+					timeline_record_at(now, "hw", name, (double)(value - netdev->last[j]));
+					netdev->last[j] = value;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+void start_hw_counter_sampler(struct ibv_context* dev_ctx, uint8_t port_num, uint32_t interval_ms)
+{
+	CounterSampler* sampler = do_malloc(sizeof(*sampler));
+	memset(sampler, 0, sizeof(*sampler));
+	sampler->interval_ms = interval_ms;
+
+	const char* ibdev_path = dev_ctx->device->ibdev_path;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/ports/%hhu/counters", ibdev_path, port_num);
+	add_sysfs_counters(sampler, path, "counters");
+	snprintf(path, sizeof(path), "%s/ports/%hhu/hw_counters", ibdev_path, port_num);
+	add_sysfs_counters(sampler, path, "hw_counters");
+	snprintf(path, sizeof(path), "%s/hw_counters", ibdev_path);
+	add_sysfs_counters(sampler, path, "dev_hw_counters");
+	log_msg("[HW] Sampling %u sysfs counters of %s port %hhu every %u ms", sampler->number_of_counters, transport->get_device_name(dev_ctx->device), port_num, interval_ms);
+
+	sampler->ethtool_sock = socket(AF_INET, SOCK_DGRAM, 0);
+	snprintf(path, sizeof(path), "%s/device/net", ibdev_path);
+	DIR* dir = opendir(path);
+	if (NULL != dir && sampler->ethtool_sock >= 0)
+	{
+		struct dirent* entry;
+		while (NULL != (entry = readdir(dir)))
+		{
+			if ('.' != entry->d_name[0])
+			{
+				add_ethtool_counters(sampler, entry->d_name);
+			}
+		}
+	}
+	if (NULL != dir)
+	{
+		closedir(dir);
+	}
+
+	if (0 == sampler->number_of_counters && 0 == sampler->number_of_netdevs)
+	{
+		log_msg("[HW] No counters found for %s, not sampling", transport->get_device_name(dev_ctx->device));
+		if (sampler->ethtool_sock >= 0)
+		{
+			close(sampler->ethtool_sock);
+		}
+		free(sampler);
+		return;
+	}
+
+	pthread_t thread;
+	int ans = pthread_create(&thread, NULL, sampler_thread, sampler);
+	if (0 != ans)
+	{
+		log_msg("[HW] Failed to create sampler thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+	pthread_detach(thread);
+}
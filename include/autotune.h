@@ -0,0 +1,36 @@
+#ifndef __AUTOTUNE_H__
+#define __AUTOTUNE_H__
+
+#include <stdint.h>
+
+#include "connection.h"
+
+// The auto-tuner connects this many QPs and tries using 1 up to all of them.
+#define AUTOTUNE_MAX_QPS 8
+#define AUTOTUNE_MAX_TRIAL_MS 60000
+
+// How the attacker drives its QPs.
+typedef struct
+{
+	// Number of QPs (lanes) reading at once.
+	uint32_t number_of_qps;
+	// Number of WRs chained into one post_send call.
+	uint32_t post_batch;
+	// Every signal_interval-th WR asks for a completion (the WR that fills the window always does).
+	uint32_t signal_interval;
+	// Maximum number of WRs in flight per QP.
+	uint32_t window;
+	// Maximum number of completions taken per poll_cq call.
+	uint32_t poll_batch;
+} AttackParams;
+
+// Parses the length of every trial in milliseconds, 1 to AUTOTUNE_MAX_TRIAL_MS. Defaults to 200 ms.
+// Exits on parse errors.
+void configure_autotune(const char* spec);
+
+// Searches the attack parameters for the highest read throughput, one parameter at a time
+// (coordinate descent) with short timed trials, then prints the best configuration and how
+// sensitive the throughput is to each parameter. Runs until done or SIGINT.
+void logic_autotune(ClientConnection* conn);
+
+#endif
@@ -4,17 +4,16 @@
 #include "verbs_wrappers.h"
 #include "logging.h"
 #include "cm.h"
+#include "geometry.h"
+#include "connection.h"
+#include "wr_ring.h"
 
-const unsigned int PAGE_SIZE;
-const unsigned int PREFETCH_GROUP_SIZE;
-const unsigned int LOWER_INDEX_FIRST_BIT;
-const unsigned int LOWER_INDEX_LAST_BIT;
-const unsigned int UPPER_INDEX_FIRST_BIT;
-const unsigned int UPPER_INDEX_LAST_BIT;
-#define SERVER_NUMBER_OF_MRS \
-	((1<<(LOWER_INDEX_LAST_BIT + 1 - LOWER_INDEX_FIRST_BIT)) + \
-	(1<<(UPPER_INDEX_LAST_BIT + 1 - UPPER_INDEX_FIRST_BIT)))
-
-void logic_attacker(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* local_buf, uint32_t lkey);
+// Posts the reads of the next max_reads prefetch groups of the sweep (at most a send queue worth, every one
+// signaled) without waiting for them. Stops early when the sweep wraps around. Returns the number of reads posted.
+uint32_t attacker_post(WrRing* ring, uint32_t max_reads);
+// Reads the next max_reads prefetch groups of the sweep (at most a send queue worth) and waits for them.
+// Stops early when the sweep wraps around. Returns the number of reads done.
+uint32_t attacker_step(WrRing* ring, uint32_t max_reads);
+void logic_attacker(ClientConnection* conn);
 void sigint_handler(int value);
 #endif
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef __CLOCK_SYNC_H__
+#define __CLOCK_SYNC_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+#include "connection.h"
+
+// Clock synchronization of a client with the server it connects to. The server's CLOCK_REALTIME is the
+// common timebase: once synchronized, timeline_now_ns() maps the client's clock onto it, so the timelines
+// of clients on different hosts synchronized with the same server can be lined up.
+//
+// A burst is `rounds` TCP ping-pongs (CLOCK_SYNC_PING). The round with the shortest round trip gives the
+// offset estimate, which is off by at most half of that round trip. With RDMA refinement the burst also
+// reads a timestamp word that the server keeps updating, through a QP of its own, and takes the read with
+// the shortest round trip instead when it beats the TCP one. Offset and drift are a least squares fit
+// over all bursts: one when connecting and, while tracking, one every CLOCK_SYNC_PERIOD_MS.
+
+#define CLOCK_SYNC_PERIOD_MS 1000
+
+// Parses "rounds[:rdma]". Only the first connection of the process is synchronized. Exits on errors.
+void configure_clock_sync(const char* spec);
+
+typedef struct ClockSync ClockSync;
+
+// Returns the number of rounds per burst (and the FanoutRequest flags) to ask for on a new connection:
+// 0 unless clock synchronization is configured and no other connection has claimed it yet.
+uint32_t clock_sync_claim(uint32_t* flags);
+
+// Runs after the connection's lanes are up: sets up the timestamp word QP (if asked for) and the first burst.
+ClockSync* clock_sync_connect(ClientConnection* conn, uint32_t rounds, uint32_t flags);
+
+// Starts / stops the background thread that keeps re-synchronizing. Nothing else may use the connection's
+// socket meanwhile, so tracking runs between the two do_sync calls around the client's logic.
+// Both accept NULL, for connections that aren't synchronized.
+void clock_sync_track(ClockSync* sync);
+void clock_sync_stop(ClockSync* sync);
+void clock_sync_destroy(ClockSync* sync);
+
+typedef struct ClockWord ClockWord;
+
+// Server side of the RDMA refinement: registers the timestamp word and brings up its QP with the client.
+ClockWord* clock_word_create(int sock, struct ibv_context* dev_ctx, struct ibv_pd* pd, struct ibv_cq* cq, uint8_t port_num);
+void clock_word_destroy(ClockWord* word);
+
+// Server side: answers clock synchronization requests until the client's sync byte arrives, and answers
+// that one like do_sync. The word may be NULL if the client didn't ask for RDMA refinement.
+void serve_clock_sync(int sock, ClockWord* word);
+
+#endif
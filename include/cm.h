@@ -3,7 +3,7 @@
 #include <stdint.h>
 #include <infiniband/verbs.h>
 
-extern const uint8_t IB_PORT_NUMBER;
+extern uint8_t ib_port_number;
 
 #pragma pack(push,1)
 typedef struct
@@ -25,6 +25,51 @@ typedef struct
 	ConnectionInfoHeader header;
 	MrEntry mrs[0];
 } ConnectionInfoExchange;
+
+// Set in FanoutRequest.clock_sync_flags to refine the clock synchronization with RDMA reads.
+#define CLOCK_SYNC_RDMA 0x1
+
+// The first message of a connection, sent by the client: how many QPs it is going to connect.
+// The server answers with one ConnectionInfoExchange per QP, the client with one per QP after it.
+// If the client asked for clock synchronization with CLOCK_SYNC_RDMA, one more QP is exchanged the
+// same way afterwards, exposing the server's timestamp word as its only MR (see clock_sync.h).
+// If the client asked for UD QPs, the server then sends a QpBatch with its UD QPs and the client
+// answers with a QpBatch of its own (see ud.h). Scale QPs are exchanged the same way after them:
+// the regions are those of the first ConnectionInfoExchange, so only QP numbers go over the wire
+// (see qp_scale.h).
+typedef struct
+{
+	uint32_t number_of_qps;
+	// Ping-pong rounds per clock synchronization burst, 0 - no synchronization.
+	uint32_t clock_sync_rounds;
+	uint32_t clock_sync_flags;
+	// UD QPs to create on each side, 0 - none.
+	uint32_t number_of_ud_qps;
+	// RC QPs connected on the first endpoint on top of number_of_qps, sharing a CQ on each side.
+	uint32_t number_of_scale_qps;
+} FanoutRequest;
+
+// A batch of QPs of one side, connected pairwise (in order) with a batch of the other side's.
+// They all share the port (and so the LID) and, for UD QPs, the Q_Key (0 for RC QPs).
+typedef struct
+{
+	uint16_t port_lid;
+	uint32_t qkey;
+	uint32_t number_of_qps;
+	uint32_t qp_nums[0];
+} QpBatch;
+
+// Single byte requests the client may send the server instead of the sync byte (see do_sync).
+#define CLOCK_SYNC_PING 'c'
+#define CLOCK_SYNC_WORD_START 'w'
+#define CLOCK_SYNC_WORD_STOP 'W'
+
+// The server's answer to CLOCK_SYNC_PING: its clock when the ping arrived and when the answer left.
+typedef struct
+{
+	uint64_t receive_ns;
+	uint64_t send_ns;
+} ClockSyncReply;
 #pragma pack(pop)
 
 
@@ -33,8 +78,12 @@ int do_connect_client(uint16_t portno, char* ipv4_addr);
 void do_sync(int sock);
 void do_send(int sock, char* buf, int size);
 void do_recv(int sock, char* buf, int size);
-void send_info_to_peer(int peer_sock, struct ibv_qp* qps, struct ibv_context* dev_ctx, struct ibv_mr** mrs, uint32_t number_of_mrs);
+void send_info_to_peer(int peer_sock, struct ibv_qp* qps, struct ibv_context* dev_ctx, uint8_t port_num, struct ibv_mr** mrs, uint32_t number_of_mrs);
+void send_fanout_request(int peer_sock, const FanoutRequest* request);
+FanoutRequest receive_fanout_request(int peer_sock);
 ConnectionInfoExchange* receive_info_from_peer(int peer_sock);
+void send_qp_batch_to_peer(int peer_sock, struct ibv_qp** qps, uint32_t number_of_qps, struct ibv_context* dev_ctx, uint8_t port_num, uint32_t qkey);
+QpBatch* receive_qp_batch_from_peer(int peer_sock);
 void print_connection_info(ConnectionInfoExchange* info);
 
 #endif 
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef __CONNECTION_H__
+#define __CONNECTION_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+#include "cm.h"
+
+#define MAX_ENDPOINTS 16
+#define ENDPOINT_NAME_LEN 64
+
+extern const unsigned int CQE_SIZE;
+extern const unsigned int CLIENT_BUF_SIZE;
+
+// A port of an RDMA device. An empty device name stands for the first device.
+typedef struct
+{
+	char dev_name[ENDPOINT_NAME_LEN];
+	uint8_t port;
+} Endpoint;
+
+// Parses a comma separated list of device[:port] (e.g. "mlx5_0:1,mlx5_0:2,mlx5_1") into endpoints.
+// Ports default to default_port. A NULL spec yields a single endpoint on the first device.
+// Exits on parse errors. Returns the number of endpoints.
+uint32_t parse_endpoints(const char* spec, uint8_t default_port, Endpoint* endpoints, uint32_t max_endpoints);
+
+// One QP of a client connection, together with the device context it lives on.
+typedef struct
+{
+	Endpoint endpoint;
+	struct ibv_context* dev_ctx;
+	struct ibv_cq* cq;
+	struct ibv_pd* pd;
+	struct ibv_qp* qp;
+	// Set if the QP was created for the WR builder API (see use_wr_builder).
+	struct ibv_qp_ex* qpx;
+	struct ibv_mr* mr;
+	void* buf;
+	ConnectionInfoExchange* peer_info;
+} ClientLane;
+
+struct ClockSync;
+struct UdConnection;
+struct QpScale;
+
+// Everything the client side of a connection to a server owns: one lane per local endpoint.
+typedef struct
+{
+	int sock;
+	uint32_t number_of_lanes;
+	ClientLane* lanes;
+	// Set if this connection synchronizes the process' clock with the server's (see clock_sync.h).
+	struct ClockSync* clock_sync;
+	// Set if the connection has UD QPs (see ud.h).
+	struct UdConnection* ud;
+	// Set if the connection has scale QPs (see qp_scale.h).
+	struct QpScale* qp_scale;
+} ClientConnection;
+
+// Connects to a server (see do_server), opens every endpoint and brings up a QP from each of them
+// to a QP of the server. The calling thread is pinned to the NUMA node of the first endpoint's device.
+// With number_of_ud_qps, that many UD QPs are connected on the first endpoint as well (see ud.h),
+// and with number_of_scale_qps, that many more RC QPs (see qp_scale.h).
+// The first connection then synchronizes the clock with the server, if configured (see clock_sync.h).
+// attacker_lanes marks lanes that post through a WR ring (see wr_ring.h), they get extended QPs with use_wr_builder.
+ClientConnection* client_connect(char* server_addr, uint16_t port, const Endpoint* endpoints, uint32_t number_of_endpoints, uint32_t number_of_ud_qps, uint32_t number_of_scale_qps, int attacker_lanes);
+void client_disconnect(ClientConnection* conn);
+
+void setup_qp(uint32_t qp_num, uint16_t port_lid, uint8_t port_num, struct ibv_qp* qp);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef __DETECTOR_H__
+#define __DETECTOR_H__
+
+#include <stdint.h>
+
+#include "stats.h"
+
+#define DETECTOR_MAX_WINDOW 1024
+// Defaults of the warmup and window for a stream probed every probe_interval_us: a warmup of about
+// DETECTOR_WARMUP_US worth of probes, within [DETECTOR_MIN_WARMUP, DETECTOR_MAX_WARMUP] samples,
+// and a window of half the warmup, at most DETECTOR_DEFAULT_WINDOW samples.
+#define DETECTOR_WARMUP_US 256000
+#define DETECTOR_MIN_WARMUP 16
+#define DETECTOR_MAX_WARMUP 256
+#define DETECTOR_DEFAULT_WINDOW 32
+#define DETECTOR_NAME_LEN 32
+
+typedef enum
+{
+	DETECTOR_EWMA = 0,
+	DETECTOR_CUSUM,
+	DETECTOR_QUANTILE,
+	NUMBER_OF_DETECTORS
+} DetectorKind;
+
+typedef struct
+{
+	// Samples used to learn the baseline (mean, standard deviation and quantile) before detecting,
+	// 0 - derived from the probe interval (see DETECTOR_WARMUP_US).
+	uint32_t warmup;
+	// Samples fed to the EWMA and CUSUM detectors are clipped to `clip` baseline standard deviations
+	// above the mean, so that a single outlier can't raise an alarm.
+	double clip;
+	// EWMA weight of the newest sample; alarm when the EWMA exceeds the baseline mean by
+	// ewma_limit standard deviations of the EWMA.
+	double ewma_alpha;
+	double ewma_limit;
+	// CUSUM slack and decision threshold, in baseline standard deviations.
+	double cusum_k;
+	double cusum_h;
+	// Alarm when the given quantile of the last `window` samples exceeds quantile_ratio times its baseline.
+	// 0 - derived from the warmup.
+	uint32_t window;
+	double quantile;
+	double quantile_ratio;
+} DetectorConfig;
+
+// Defaults, changed by configure_detectors.
+extern DetectorConfig detector_config;
+
+// Parses a comma separated list of key=value (warmup, clip, ewma_alpha, ewma_limit, cusum_k,
+// cusum_h, window, quantile, quantile_ratio) into detector_config. Exits on errors.
+void configure_detectors(const char* spec);
+
+typedef struct
+{
+	int degraded;
+	// Set by the last detector_add if it changed the state.
+	int changed;
+	// Estimated time of the last change point and the time it was detected.
+	uint64_t change_ns;
+	uint64_t detected_ns;
+	// Time of the sample the change point estimate currently points at.
+	uint64_t candidate_ns;
+} DetectorState;
+
+typedef struct
+{
+	uint64_t time_ns;
+	double value;
+} DetectorSample;
+
+// EWMA, CUSUM and windowed quantile detectors over one latency stream, in constant memory.
+typedef struct
+{
+	char name[DETECTOR_NAME_LEN];
+	DetectorConfig config;
+	uint64_t samples;
+	RunningStats baseline;
+	// Quantiles of the consecutive windows of the warmup, averaged into baseline_quantile.
+	RunningStats warmup_quantiles;
+	double baseline_quantile;
+	double sigma;
+	double ewma;
+	double cusum_up;
+	double cusum_down;
+	// The last config.window samples.
+	DetectorSample ring[DETECTOR_MAX_WINDOW];
+	DetectorState states[NUMBER_OF_DETECTORS];
+} LatencyDetector;
+
+// Starts a detector for a stream probed every probe_interval_us, which sizes the default warmup.
+void detector_init(LatencyDetector* d, const char* name, uint64_t probe_interval_us);
+
+// Feeds one latency sample taken at time_ns (timeline time). When a detector flags degradation
+// onset or recovery, it is logged and recorded on the timeline (source "detector") with its
+// detection delay: the time from the estimated change point to the detection.
+void detector_add(LatencyDetector* d, uint64_t time_ns, double latency_ns);
+
+// Number of detectors currently flagging degradation.
+uint32_t detector_alarms(const LatencyDetector* d);
+
+const char* detector_kind_name(DetectorKind kind);
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __GEOMETRY_H__
+#define __GEOMETRY_H__
+
+#include <stdint.h>
+
+#define MAX_REGION_SETS 16
+
+// A set of regions whose addresses differ only in bits [first_bit, last_bit]:
+// region k of the set lives at base_address + (k << first_bit).
+typedef struct
+{
+	uint32_t first_bit;
+	uint32_t last_bit;
+	uint64_t base_address;
+	// Number of regions in the set, at most 1 << (last_bit + 1 - first_bit).
+	uint32_t count;
+	// Sparse registration - if not NULL, only these indices of the set are registered.
+	uint32_t* indices;
+	uint32_t number_of_indices;
+} RegionSet;
+
+// Describes the regions the server registers and how the attacker walks them.
+typedef struct
+{
+	uint32_t page_size;
+	// The attacker reads one byte every prefetch_group_size bytes of each region.
+	uint32_t prefetch_group_size;
+	uint32_t region_size;
+	// With per-port region sets (server -P), the sets of the k-th server port are displaced by k * port_stride.
+	uint64_t port_stride;
+	uint32_t number_of_sets;
+	RegionSet sets[MAX_REGION_SETS];
+} RegionGeometry;
+
+// The geometry in use. Holds the built-in layout until load_geometry is called.
+extern RegionGeometry geometry;
+
+// Loads a geometry description file into the global geometry. Exits on parse errors.
+// The file consists of "key = value" lines and one "set" line per region set:
+//   page_size = 4096
+//   prefetch_group_size = 8
+//   region_size = 32768
+//   port_stride = 0x1000000000
+//   set first_bit=15 last_bit=24 base=0x40000000000 [count=1024] [indices=0,7,100-199]
+// Lines starting with '#' are comments.
+void load_geometry(const char* path);
+
+// Returns the number of regions that are actually registered (taking sparse sets into account).
+uint32_t geometry_number_of_regions(const RegionGeometry* geo);
+
+// Returns the address of the i-th registered region of the set.
+uint64_t geometry_region_address(const RegionSet* set, uint32_t i);
+
+// Returns the number of registered regions in the set.
+uint32_t region_set_size(const RegionSet* set);
+
+void print_geometry(const RegionGeometry* geo);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+
+// Log-linear histogram: values below 8 get a bucket each, every power of two above that is split
+// into 8 buckets, so any recorded value is known to within 12.5%.
+#define HISTOGRAM_SUB_BUCKET_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BUCKET_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BUCKET_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+static inline uint32_t histogram_bucket(uint64_t value)
+{
+	if (value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return value;
+	}
+	uint32_t msb = 63 - __builtin_clzll(value);
+	uint32_t shift = msb - HISTOGRAM_SUB_BUCKET_BITS;
+	return (shift + 1) * HISTOGRAM_SUB_BUCKETS + ((value >> shift) & (HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+// Records a value. A histogram has a single writer; the stores are atomic so other threads
+// may take snapshots concurrently without locking.
+static inline void histogram_record(Histogram* h, uint64_t value)
+{
+	uint32_t bucket = histogram_bucket(value);
+	__atomic_store_n(&h->buckets[bucket], h->buckets[bucket] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->sum, h->sum + value, __ATOMIC_RELAXED);
+	if (value > h->max)
+	{
+		__atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+	}
+	__atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+
+// Returns the smallest / largest value that falls into the bucket.
+uint64_t histogram_bucket_low(uint32_t bucket);
+uint64_t histogram_bucket_high(uint32_t bucket);
+
+// Returns the value below which the given fraction (0..1) of the recorded values fall.
+uint64_t histogram_percentile(const Histogram* h, double fraction);
+double histogram_mean(const Histogram* h);
+
+// Copies a histogram that may be concurrently written by its owner thread.
+void histogram_snapshot(const Histogram* src, Histogram* dst);
+void histogram_merge(Histogram* dst, const Histogram* src);
+void histogram_reset(Histogram* h);
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef __HW_COUNTERS_H__
+#define __HW_COUNTERS_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+// Starts a thread that every interval_ms reads the port counters and hw_counters of the device
+// (from sysfs) and the ethtool statistics of its network interfaces, and records the per-interval
+// delta of every counter that changed on the timeline (see timeline.h).
+// Does nothing (but log) if the device exposes no counters, e.g. with the mock transport.
+void start_hw_counter_sampler(struct ibv_context* dev_ctx, uint8_t port_num, uint32_t interval_ms);
+
+#endif
@@ -2,9 +2,15 @@
 #define __LATENCY_MEASURE_H__
 
 #include "cm.h"
+#include "connection.h"
 #include "logging.h"
 #include "verbs_wrappers.h"
 
-void logic_latency(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* local_buf, uint32_t lkey);
+#define LATENCY_PROBE_INTERVAL_US 1000000
+
+// Reads a single byte of the first server region and returns the round trip time in nanoseconds.
+uint64_t latency_probe(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* local_buf, uint32_t lkey);
+// Probes the first lane of the connection once a second until SIGINT.
+void logic_latency(ClientConnection* conn);
 
 #endif
\ No newline at end of file
@@ -8,10 +8,16 @@
 // If the allocation is impossible (due to overlap with existing mapping) - returns NULL.
 // Otherwise - returns the requested address.
 // If the requested number of bytes is not a multiple of page size, additional bytes will be allocated to fit a whole page.
+// The memory is bound to the placement node (see numa_placement.h), if one was picked.
 void* allocate_at_addr(void* addr, uint32_t size_in_bytes);
 
 // Frees an address allocated using the previous function.
 void free_at_addr(void* ptr, uint32_t size_in_bytes);
 void* do_malloc(uint64_t bytes);
 
+#define CACHE_LINE_SIZE 64
+
+// Allocates memory starting at a cache line boundary. Free with free().
+void* do_malloc_aligned(uint64_t bytes);
+
 #endif
\ No newline at end of file
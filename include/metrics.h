@@ -0,0 +1,46 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+#define METRICS_MAX_THREADS 64
+#define METRICS_ROLE_LEN 32
+
+// Per-thread counters. Each instance is written only by its owner thread (relaxed atomic stores,
+// no locks) and read by the metrics server thread.
+typedef struct
+{
+	char role[METRICS_ROLE_LEN];
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t cq_polls;
+	uint64_t cq_empty_polls;
+	uint64_t completions;
+	// Number of latency degradation detectors currently raising an alarm (see detector.h).
+	uint64_t alarms;
+	// Latency of one measured iteration: a single probe for the latency logic, a whole sweep for the attacker.
+	Histogram latency_ns;
+} __attribute__((aligned(64))) ThreadMetrics;
+
+// The counters of the calling thread. Points to a scratch instance until the thread registers.
+extern __thread ThreadMetrics* thread_metrics;
+
+// Gives the calling thread its own exported set of counters.
+void metrics_register_thread(const char* role);
+
+// Copies the counters of every registered thread, in the order they registered, into out (room for
+// METRICS_MAX_THREADS). Returns the number of threads copied.
+uint32_t metrics_snapshot(ThreadMetrics* out);
+
+// Starts the metrics server thread. Serves Prometheus text format over HTTP on 127.0.0.1:http_port
+// (if non-zero) and a JSON dump on the Unix socket unix_path (if not NULL).
+void start_metrics_server(uint16_t http_port, const char* unix_path);
+
+static inline void metrics_add(uint64_t* counter, uint64_t value)
+{
+	__atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+#endif
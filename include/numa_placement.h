@@ -0,0 +1,34 @@
+#ifndef __NUMA_PLACEMENT_H__
+#define __NUMA_PLACEMENT_H__
+
+#include <stddef.h>
+#include <infiniband/verbs.h>
+
+// Discovers the NUMA node the device is attached to, pins the calling thread to that node
+// and remembers the node for all subsequent buffer allocations.
+// Returns the node, or -1 if the system (or the device) has no NUMA information.
+int setup_placement(struct ibv_context* dev_ctx);
+
+// Returns the node picked by setup_placement, or -1 if none was picked.
+int get_placement_node();
+
+// Reads the NUMA node of the device from sysfs. Returns -1 if unknown.
+int get_device_numa_node(struct ibv_context* dev_ctx);
+
+// Restricts the calling thread to the CPUs of the given node. Does nothing for node -1.
+void pin_thread_to_node(int node);
+
+// Binds a (not yet touched) memory range to the given node. Does nothing for node -1.
+void bind_memory_to_node(void* addr, size_t len, int node);
+
+// Returns a completion vector of the device whose interrupt is served by the given node.
+// Falls back to vector 0 if no such vector can be found.
+int select_comp_vector(struct ibv_context* dev_ctx, int node);
+
+// Returns the NUMA node serving the interrupt of the given completion vector, or -1 if unknown.
+int get_comp_vector_node(struct ibv_context* dev_ctx, int comp_vector);
+
+// Logs a warning if the memory at addr resides on another node than the placement node.
+void check_memory_placement(const char* what, void* addr);
+
+#endif
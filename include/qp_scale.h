@@ -0,0 +1,45 @@
+#ifndef __QP_SCALE_H__
+#define __QP_SCALE_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+#include "connection.h"
+
+// QP context cache pressure. On top of its lane, a connection brings up thousands of RC QPs
+// ("scale QPs") to the same server, sharing one CQ on each side. A sweeper thread keeps
+// QP_SCALE_WINDOW single byte reads in flight on each of the active scale QPs, all of the same byte
+// of the server's first region, so the NICs' memory translations always hit and only the QP
+// contexts churn. The number of active QPs doubles from 1 up to the maximum, one step at a time,
+// while the lane probes the victim's latency, which gives the latency (and the sweep's throughput)
+// as a function of the active QP count.
+
+#define QP_SCALE_MAX_QPS 16384
+#define QP_SCALE_WINDOW 2
+#define QP_SCALE_DEFAULT_STEP_MS 2000
+#define QP_SCALE_PROBE_INTERVAL_US 1000
+// The median latency growing at least this many times from one step to the next is a cliff.
+#define QP_SCALE_CLIFF_RATIO 2.0
+
+// Parses the -Q argument: "max_qps[:step_ms]". Exits on errors.
+void configure_qp_scale(const char* spec);
+uint32_t qp_scale_requested_qps(void);
+// Runs the steps and prints the latency and throughput per active QP count (stops early on SIGINT).
+void logic_qp_scale(ClientConnection* conn);
+
+typedef struct QpScale QpScale;
+
+// Runs after the connection's lanes are up: creates the scale QPs on the first lane's device and
+// connects them pairwise with the server's (see FanoutRequest).
+QpScale* qp_scale_connect(ClientConnection* conn, uint32_t number_of_qps);
+// Accepts NULL, for connections without scale QPs.
+void qp_scale_disconnect(QpScale* scale);
+
+typedef struct QpScaleServer QpScaleServer;
+
+// Server side: creates the scale QPs on the shared CQ and connects them with the client's.
+QpScaleServer* qp_scale_server_create(int sock, struct ibv_context* dev_ctx, struct ibv_pd* pd, uint8_t port_num, uint32_t number_of_qps);
+// Accepts NULL.
+void qp_scale_server_destroy(QpScaleServer* server);
+
+#endif
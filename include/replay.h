@@ -0,0 +1,18 @@
+#ifndef __REPLAY_H__
+#define __REPLAY_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+#include "cm.h"
+#include "connection.h"
+
+// Selects the binary trace (see trace.h, created with trace_convert) that logic_replay issues.
+// If as_fast_as_possible is set the inter-arrival times are ignored and only the send queue depth limits the rate.
+void configure_replay(const char* trace_path, int as_fast_as_possible);
+
+// Issues every record of the trace against the server's regions over the first lane of the connection,
+// keeping up to a send queue worth of operations in flight, and records the latency of each operation.
+void logic_replay(ClientConnection* conn);
+
+#endif
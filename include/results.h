@@ -0,0 +1,41 @@
+#ifndef __RESULTS_H__
+#define __RESULTS_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+// A results file describes one run well enough to compare it with another one later: the command
+// line, the host and the devices it ran on, and per role (see metrics.h) the raw counters, the raw
+// latency histogram and the throughput of every RESULTS_INTERVAL_MS interval. It is line based text,
+// one record per line, starting with the record's kind:
+//   results <version>
+//   command <argv...>
+//   started_ns <realtime> / duration_ns <ns>
+//   host name|kernel|cpus|cpu_model <value>
+//   transport <name>
+//   device <name> port <n> fw <fw_ver> driver <driver> vendor <id> part <id> hw <ver> mtu <bytes> width <n> speed <n>
+//   role <role> threads <n> ops <n> errors <n> completions <n> alarms <n>
+//   throughput <role> <interval_ms> <ops/s>...
+//   histogram <role> <count> <sum> <max> <bucket>:<count>...
+
+#define RESULTS_VERSION 1
+#define RESULTS_INTERVAL_MS 1000
+#define RESULTS_MAX_DEVICES 16
+#define RESULTS_DEFAULT_ITERATIONS 2000
+// Deltas within this many percent are never flagged (compare's -t).
+#define RESULTS_DEFAULT_TOLERANCE_PCT 2.0
+
+// Starts sampling the throughput of the run. The file is written by close_results.
+void open_results(const char* path, int argc, char** argv);
+// Describes a device in the results (once per device and port). Does nothing if no results are open.
+void results_add_device(struct ibv_context* dev_ctx, uint8_t port_num);
+// Writes the results file, if open.
+void close_results();
+
+// The compare subcommand: "compare [-t tolerance_pct] [-b iterations] base_file new_file".
+// Prints the delta of the latency (mean, p50, p99) and the throughput of every role of both runs
+// with a bootstrap 95% confidence interval, flagging the deltas whose interval lies entirely beyond
+// the tolerance. Returns 1 if any of them is a regression, 0 otherwise.
+int results_compare(int argc, char** argv);
+
+#endif
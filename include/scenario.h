@@ -0,0 +1,64 @@
+#ifndef __SCENARIO_H__
+#define __SCENARIO_H__
+
+#include <stdint.h>
+
+#include "connection.h"
+
+#define MAX_SCENARIO_PHASES 64
+#define MAX_SCENARIO_ATTACKERS 16
+#define SCENARIO_NAME_LEN 32
+#define MAX_SCENARIO_REPEAT 10000
+#define MAX_SCENARIO_PROBE_INTERVAL_US 1000000
+
+typedef struct
+{
+	char name[SCENARIO_NAME_LEN];
+	double duration_sec;
+	// Whether the RDMA read attackers / the UD flooders run.
+	int attack;
+	int flood;
+	// Total reads (or SENDs) per second, split evenly between the running attackers, 0 - as fast as possible.
+	double rate;
+} ScenarioPhase;
+
+typedef struct
+{
+	char addr[64];
+	uint16_t port;
+	// UD QPs to connect: the victim probes over UD, an attacker floods over that many UD QPs. 0 - RC.
+	uint32_t ud_qps;
+} ScenarioServer;
+
+// An experiment: a victim probing one server and attackers each sweeping a server,
+// driven through a list of phases that is run `repeat` times.
+typedef struct
+{
+	ScenarioServer victim;
+	ScenarioServer attackers[MAX_SCENARIO_ATTACKERS];
+	uint32_t number_of_attackers;
+	ScenarioPhase phases[MAX_SCENARIO_PHASES];
+	uint32_t number_of_phases;
+	uint32_t repeat;
+	uint32_t probe_interval_us;
+} Scenario;
+
+// Loads a scenario file. Exits on parse errors. The format is one directive per line:
+//   victim 192.168.0.1:1234            (append "ud" to probe with UD SENDs instead of RDMA reads)
+//   attacker 192.168.0.1:4321          (one line per attacker thread)
+//   attacker 192.168.0.1:4322 ud=256   (floods with SENDs over 256 UD QPs instead of sweeping with reads)
+//   probe_interval_us 1000             (up to a second)
+//   repeat 3                           (up to MAX_SCENARIO_REPEAT times)
+//   phase warmup 5
+//   phase baseline 10
+//   phase attack 10 attack=2000000     (attack at 2M reads/s; plain "attack" - as fast as possible)
+//   phase qpc 10 flood                 (the UD flooders run instead, "flood=<rate>" limits their SENDs)
+//   phase cooldown 5
+// Lines starting with '#' are comments.
+void load_scenario(const char* path, Scenario* scenario);
+
+// Connects the victim and the attackers to their servers, runs them as threads of this process
+// through the scenario's phases and prints per-phase statistics.
+int run_scenario(const char* path, const Endpoint* endpoint, uint32_t hw_counter_interval_ms);
+
+#endif
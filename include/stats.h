@@ -0,0 +1,32 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdint.h>
+
+// Streaming mean / variance (Welford), constant memory.
+typedef struct
+{
+	uint64_t n;
+	double mean;
+	double m2;
+} RunningStats;
+
+static inline void running_stats_add(RunningStats* s, double x)
+{
+	++s->n;
+	double delta = x - s->mean;
+	s->mean += delta / s->n;
+	s->m2 += delta * (x - s->mean);
+}
+
+void running_stats_merge(RunningStats* dst, const RunningStats* src);
+double running_stats_variance(const RunningStats* s);
+double running_stats_stddev(const RunningStats* s);
+
+// Half width of the 95% confidence interval of the mean (Student's t).
+double running_stats_ci95(const RunningStats* s);
+
+// Two-sided 95% critical value of Student's t distribution with df degrees of freedom.
+double student_t_95(uint64_t df);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef __TIMELINE_H__
+#define __TIMELINE_H__
+
+#include <stdint.h>
+
+// A single timeline shared by every time series the tool produces (latency samples, sweep times,
+// NIC counter deltas), so they can be lined up after the run.
+// Records are CSV lines: time_ns,source,name,value
+
+// Opens the timeline file. Until this is called records are logged to stdout.
+void open_timeline(const char* path);
+// Writes out the pending records and closes the timeline file.
+void close_timeline();
+
+// Returns the timestamp used for timeline records, in nanoseconds: the local CLOCK_REALTIME,
+// mapped to the common timebase once one is set.
+uint64_t timeline_now_ns();
+
+// The local CLOCK_REALTIME, in nanoseconds.
+uint64_t timeline_local_ns();
+
+// Sets the mapping of the local clock to the common timebase (see clock_sync.h):
+// common = local + offset_ns + drift * (local - anchor_ns).
+void timeline_set_clock(int64_t offset_ns, double drift, uint64_t anchor_ns);
+
+// Records a value, stamped with the current time. Safe to call from any thread, and cheap enough
+// for the measuring ones: the record is queued on a buffer of the calling thread, and written out
+// by a writer thread every few milliseconds.
+void timeline_record(const char* source, const char* name, double value);
+void timeline_record_at(uint64_t time_ns, const char* source, const char* name, double value);
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// "RDMATRC1" in little endian.
+#define TRACE_MAGIC 0x31435254414d4452ULL
+#define TRACE_VERSION 1
+
+typedef enum
+{
+	TRACE_OP_READ = 0,
+	TRACE_OP_WRITE = 1,
+} TraceOpcode;
+
+// On-disk layout of a binary trace: a header followed by number_of_records fixed size records,
+// in the byte order of the machine that wrote it.
+#pragma pack(push,1)
+typedef struct
+{
+	uint64_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t number_of_records;
+} TraceHeader;
+
+typedef struct
+{
+	// Offset within the server region (not an address, so a trace can be replayed against any server).
+	uint64_t offset;
+	// Time since the previous record was issued.
+	uint64_t inter_arrival_ns;
+	uint32_t region_index;
+	uint32_t size;
+	uint8_t opcode;
+	uint8_t reserved[7];
+} TraceRecord;
+#pragma pack(pop)
+
+typedef struct
+{
+	const TraceHeader* header;
+	const TraceRecord* records;
+	size_t mapped_size;
+} Trace;
+
+// Maps a binary trace file read-only and validates its header. Exits on errors.
+void map_trace(const char* path, Trace* trace);
+void unmap_trace(Trace* trace);
+
+#endif
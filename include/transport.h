@@ -0,0 +1,69 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+// The set of verbs the tool uses. Every verbs call goes through the selected transport,
+// so the whole tool can run either against a real RDMA device or against the in-process mock.
+typedef struct
+{
+	const char* name;
+	int (*fork_init)(void);
+	struct ibv_device** (*get_device_list)(int* num_devices);
+	void (*free_device_list)(struct ibv_device** list);
+	const char* (*get_device_name)(struct ibv_device* device);
+	struct ibv_context* (*open_device)(struct ibv_device* device);
+	int (*close_device)(struct ibv_context* context);
+	int (*query_gid)(struct ibv_context* context, uint8_t port_num, int index, union ibv_gid* gid);
+	int (*query_port)(struct ibv_context* context, uint8_t port_num, struct ibv_port_attr* port_attr);
+	int (*query_device)(struct ibv_context* context, struct ibv_device_attr* device_attr);
+	struct ibv_pd* (*alloc_pd)(struct ibv_context* context);
+	int (*dealloc_pd)(struct ibv_pd* pd);
+	struct ibv_mr* (*reg_mr)(struct ibv_pd* pd, void* addr, size_t length, int access);
+	int (*dereg_mr)(struct ibv_mr* mr);
+	struct ibv_comp_channel* (*create_comp_channel)(struct ibv_context* context);
+	int (*destroy_comp_channel)(struct ibv_comp_channel* channel);
+	struct ibv_cq* (*create_cq)(struct ibv_context* context, int cqe, void* cq_context, struct ibv_comp_channel* channel, int comp_vector);
+	int (*destroy_cq)(struct ibv_cq* cq);
+	struct ibv_qp* (*create_qp)(struct ibv_pd* pd, struct ibv_qp_init_attr* qp_init_attr);
+	int (*modify_qp)(struct ibv_qp* qp, struct ibv_qp_attr* attr, int attr_mask);
+	int (*destroy_qp)(struct ibv_qp* qp);
+	int (*post_send)(struct ibv_qp* qp, struct ibv_send_wr* wr, struct ibv_send_wr** bad_wr);
+	int (*req_notify_cq)(struct ibv_cq* cq, int solicited_only);
+	int (*poll_cq)(struct ibv_cq* cq, int num_entries, struct ibv_wc* wc);
+	int (*post_recv)(struct ibv_qp* qp, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr);
+	struct ibv_srq* (*create_srq)(struct ibv_pd* pd, struct ibv_srq_init_attr* srq_init_attr);
+	int (*destroy_srq)(struct ibv_srq* srq);
+	int (*post_srq_recv)(struct ibv_srq* srq, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr);
+	struct ibv_ah* (*create_ah)(struct ibv_pd* pd, struct ibv_ah_attr* attr);
+	int (*destroy_ah)(struct ibv_ah* ah);
+	// The extended QP and its WR builder API (ibv_wr_*). NULL if the transport doesn't support them.
+	struct ibv_qp* (*create_qp_ex)(struct ibv_context* context, struct ibv_qp_init_attr_ex* qp_init_attr_ex);
+	struct ibv_qp_ex* (*qp_to_qp_ex)(struct ibv_qp* qp);
+} TransportOps;
+
+// Parameters of the simulated NIC used by the mock transport.
+// Every WR is first translated by the NIC (serialized, hit_ns or miss_ns depending on whether
+// its (rkey, page) pair is in the translation cache) and then completes base_ns later. The QP
+// context of every WR and of every received UD message is looked up in the same cache, a miss
+// costing another miss_ns.
+typedef struct
+{
+	uint64_t base_ns;
+	uint64_t hit_ns;
+	uint64_t miss_ns;
+	uint32_t cache_entries;
+} MockNicModel;
+
+extern const TransportOps verbs_transport;
+extern const TransportOps mock_transport;
+extern const TransportOps* transport;
+
+// Selects the transport to use. The spec is either "verbs" or "mock[:base_ns:hit_ns:miss_ns:cache_entries]".
+// Must be called before any other verbs wrapper is used.
+void select_transport(const char* spec);
+void set_mock_nic_model(const MockNicModel* model);
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef __UD_H__
+#define __UD_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+#include "cm.h"
+#include "connection.h"
+
+// Probing and flooding over UD QPs with SEND / RECV, next to the RC QPs of a connection. The server
+// gives its UD QPs one SRQ, pre-posted with UD_SRQ_SIZE receives and reposted as they complete, and
+// echoes the probes that arrive at its first UD QP. Each side creates one address handle for the
+// other when connecting and reuses it for every SEND.
+//
+// A prober sends one probe at a time and times its echo, like the RC latency probe but without an
+// RDMA read. A flooder sends from many UD QPs, round robin, each to a UD QP of its own on the server,
+// so the NICs keep fetching QP contexts (QPC) rather than memory translations (MPT / MTT).
+
+#define UD_QKEY 0x11111111
+#define UD_MAX_QPS 4096
+// Every UD receive buffer starts with room for the global routing header.
+#define UD_GRH_SIZE 40
+// Bytes per probe / flood message, small enough to be sent inline.
+#define UD_MESSAGE_SIZE 32
+#define UD_SRQ_SIZE 4096
+// Receives pre-posted by the client for the echoes.
+#define UD_CLIENT_RECV_RING 64
+#define UD_SEND_QUEUE 256
+// A probe whose echo doesn't arrive within this long is counted as lost (UD is unreliable).
+#define UD_PROBE_TIMEOUT_MS 100
+#define UD_PROBE_INTERVAL_US 1000000
+#define UD_DEFAULT_FLOOD_QPS 256
+#define UD_DEFAULT_SENDS_PER_QP 4
+
+// Set in UdMessage.flags to have the server send the message back.
+#define UD_ECHO 0x1
+
+typedef struct
+{
+	uint64_t seq;
+	uint32_t flags;
+} UdMessage;
+
+// Parses the -u argument: "probe" or "flood[:qps[:sends_per_qp]]". Exits on errors.
+void configure_ud(const char* spec);
+// The number of UD QPs the configured mode connects.
+uint32_t ud_requested_qps(void);
+// Probes once a second, or floods as fast as possible, until SIGINT.
+void logic_ud(ClientConnection* conn);
+
+typedef struct UdConnection UdConnection;
+
+// Runs after the connection's lanes are up: creates the UD QPs on the first lane's device and
+// exchanges them with the server's (see FanoutRequest).
+UdConnection* ud_connect(ClientConnection* conn, uint32_t number_of_qps);
+// Accepts NULL, for connections without UD QPs.
+void ud_disconnect(UdConnection* ud);
+
+// Sends a probe to the server's first UD QP and waits for its echo. Returns the round trip time
+// in nanoseconds, or 0 if the probe or its echo was lost.
+uint64_t ud_probe(UdConnection* ud);
+// Posts up to max_sends SENDs, at most sends_per_qp on each UD QP (continuing round robin from
+// where the last call stopped), and waits for them to complete. Returns the number of SENDs.
+uint32_t ud_flood_step(UdConnection* ud, uint32_t max_sends);
+
+typedef struct UdServer UdServer;
+
+// Server side: creates the UD QPs, their SRQ and the address handle of the client, exchanges the
+// QPs with the client and starts echoing probes in a thread of its own.
+UdServer* ud_server_create(int sock, struct ibv_context* dev_ctx, struct ibv_pd* pd, uint8_t port_num, uint32_t number_of_qps);
+// Accepts NULL.
+void ud_server_destroy(UdServer* server);
+
+#endif
@@ -8,10 +8,21 @@
 #include "logging.h"
 
 extern void* const QP_CONTEXT;
+extern const uint32_t QP_MAX_SEND_WR;
+// Create the attacker lanes' QPs as extended QPs, so that they post through the WR builder API
+// (ibv_wr_*, see wr_ring.h). Only takes effect with a transport that supports it (see transport.h).
+extern int use_wr_builder;
 
 struct ibv_qp_init_attr create_qp_init_attr(struct ibv_cq* cq);
 void destroy_qp(struct ibv_qp* qp);
 struct ibv_qp* create_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* attr);
+// An extended QP (see transport.h) that can post the operations its type supports through the WR builder API.
+struct ibv_qp* create_builder_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* attr);
+// A shared receive queue of max_wr single SGE receives.
+struct ibv_srq* create_srq(struct ibv_pd* pd, uint32_t max_wr);
+void destroy_srq(struct ibv_srq* srq);
+struct ibv_ah* create_ah(struct ibv_pd* pd, uint16_t dlid, uint8_t port_num);
+void destroy_ah(struct ibv_ah* ah);
 struct ibv_comp_channel* create_comp_channel(struct ibv_context* ctx);
 void destroy_comp_channel(struct ibv_comp_channel* ch);
 struct ibv_cq* create_cq(struct ibv_context* ctx, int cqe, void* cq_context, struct ibv_comp_channel* ch, int comp_vector);
@@ -20,11 +31,22 @@ void dealloc_pd(struct ibv_pd* pd);
 void dereg_mr(struct ibv_mr* mr);
 struct ibv_mr* register_mr(struct ibv_pd* pd, void* buf, size_t buf_len, enum ibv_access_flags access);
 void* alloc_mr(unsigned int size);
+void free_mr(void* mr, unsigned int size);
 struct ibv_pd* alloc_pd(struct ibv_context* ctx);
 struct ibv_device** get_device_list();
-struct ibv_context* get_dev_context();
+// Opens the device with the given name, or the first device if the name is NULL or empty.
+struct ibv_context* get_dev_context(const char* requested_name, uint8_t port_num);
+// Posts a single signaled RDMA read / write of size bytes, tagged with wr_id.
+void do_rdma_op(enum ibv_wr_opcode opcode, uint64_t wr_id, void* remote_address, void* local_address, uint32_t rkey, uint32_t lkey, uint32_t size, struct ibv_qp* qp);
 void do_rdma_read(void* remote_address, void* local_address, uint32_t rkey, uint32_t lkey, uint32_t size, struct ibv_qp* qp);
+// Posts a chain of number_of_wrs WRs (linked through wr->next) with a single post_send call.
+void do_post_send(struct ibv_qp* qp, struct ibv_send_wr* wr, uint32_t number_of_wrs);
+// Post a chain of receives (linked through wr->next) to a QP / an SRQ.
+void do_post_recv(struct ibv_qp* qp, struct ibv_recv_wr* wr);
+void do_post_srq_recv(struct ibv_srq* srq, struct ibv_recv_wr* wr);
 void do_close_device(struct ibv_context* dev_ctx);
 void do_cq_empty(struct ibv_qp* qp, uint32_t num_events);
+// Polls the send CQ once without waiting. Returns the number of completions stored in wc (exits on failed ones).
+int do_cq_poll(struct ibv_qp* qp, struct ibv_wc* wc, int max_events);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,49 @@
+#ifndef __WR_RING_H__
+#define __WR_RING_H__
+
+#include <stdint.h>
+#include <infiniband/verbs.h>
+
+#include "connection.h"
+
+// The attacker's sweep over a server's regions, compiled once when the lane is connected. The regions
+// are a struct of arrays (base address, rkey, number of reads), walked round and round. The WRs and
+// SGEs that post the sweep are prebuilt and chained; only their id, flags, remote address and rkey are
+// patched before a batch is posted as one chain. post_send copies the WRs into the send queue, so
+// every batch reuses the array from its start and the host side touches one batch worth of WRs.
+typedef struct
+{
+	// One entry per region of the peer, in sweep order. Cache line aligned.
+	uint64_t* region_addrs;
+	uint32_t* region_rkeys;
+	uint32_t* region_reads;
+	uint32_t number_of_regions;
+	uint32_t stride;
+	// The next read of the sweep.
+	uint32_t region;
+	uint32_t reads_left;
+	uint64_t next_addr;
+	uint64_t sweeps;
+	// WRs are numbered from 1 on, in posting order (callers may reset both).
+	uint64_t posted;
+	uint64_t last_signaled;
+	struct ibv_qp* qp;
+	// Set when the QP was created for the WR builder API (see use_wr_builder).
+	struct ibv_qp_ex* qpx;
+	uint32_t lkey;
+	uint64_t local_addr;
+	// QP_MAX_SEND_WR prebuilt WRs, wrs[i].next = &wrs[i + 1]. Cache line aligned.
+	struct ibv_send_wr* wrs;
+	struct ibv_sge* sges;
+} WrRing;
+
+// Compiles the sweep over the lane's peer regions, reading one byte every geometry.prefetch_group_size bytes.
+void wr_ring_init(WrRing* ring, ClientLane* lane);
+void wr_ring_destroy(WrRing* ring);
+
+// Posts the next max_reads reads of the sweep (at most a send queue worth) as one chain, without waiting.
+// Every signal_interval-th WR (by number) is signaled, and the last one if signal_last. With
+// stop_at_sweep_end, stops after the read that completes a sweep. Returns the number of reads posted.
+uint32_t wr_ring_post(WrRing* ring, uint32_t max_reads, uint32_t signal_interval, int signal_last, int stop_at_sweep_end);
+
+#endif
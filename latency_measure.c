@@ -5,12 +5,28 @@
 
 #include "verbs_wrappers.h"
 #include "latency_measure.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "detector.h"
+#include "memutils.h"
 
 static void sigint_handler(int value);
 static volatile int keep_running = 1;
 
-void logic_latency(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* local_buf, uint32_t lkey)
+uint64_t latency_probe(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* local_buf, uint32_t lkey)
 {
+    struct timespec start_time;
+    struct timespec end_time;
+    clock_gettime(CLOCK_REALTIME, &start_time);
+    do_rdma_read((void*)peer_info->mrs[0].remote_addr, local_buf, peer_info->mrs[0].rkey, lkey, 1, qp);
+    do_cq_empty(qp, 1);
+    clock_gettime(CLOCK_REALTIME, &end_time);
+    return (end_time.tv_sec - start_time.tv_sec)*1000000000 + (end_time.tv_nsec - start_time.tv_nsec);
+}
+
+void logic_latency(ClientConnection* conn)
+{
+    ClientLane* lane = &conn->lanes[0];
     __sighandler_t prev = signal(SIGINT, sigint_handler);
     if (SIG_ERR == prev)
     {
@@ -18,20 +34,23 @@ void logic_latency(struct ibv_qp* qp, ConnectionInfoExchange* peer_info, void* l
         exit(-1);
     }
     log_msg("Performing the attack infinitely use Ctrl+C (SIGINT) to stop the attack...");
-    struct timespec start_time;
-    struct timespec end_time;
+    metrics_register_thread("latency");
+    LatencyDetector* detector = do_malloc(sizeof(*detector));
+    detector_init(detector, "latency", LATENCY_PROBE_INTERVAL_US);
     uint64_t i = 0;
     while (keep_running)
     {
-        clock_gettime(CLOCK_REALTIME, &start_time);
-        do_rdma_read(peer_info->mrs[0].remote_addr, local_buf, peer_info->mrs[0].rkey, lkey, 1, qp);
-        do_cq_empty(qp, 1);
-        clock_gettime(CLOCK_REALTIME, &end_time);
-        long diff = (end_time.tv_sec - start_time.tv_sec)*1000000000 + (end_time.tv_nsec - start_time.tv_nsec);
+        long diff = latency_probe(lane->qp, lane->peer_info, lane->buf, lane->mr->lkey);
+        uint64_t now = timeline_now_ns();
+        histogram_record(&thread_metrics->latency_ns, diff);
+        timeline_record_at(now, "latency", "probe_us", diff / 1000.0);
+        detector_add(detector, now, diff);
+        __atomic_store_n(&thread_metrics->alarms, detector_alarms(detector), __ATOMIC_RELAXED);
         log_msg("%10llu) %u", i, diff/1000);
-        usleep(1000000); // Sleeping to ensure the cache is flushed.
+        usleep(LATENCY_PROBE_INTERVAL_US); // Sleeping to ensure the cache is flushed.
         ++i;
     }
+    free(detector);
     prev = signal(SIGINT, prev);
     if (SIG_ERR == prev)
     {
@@ -5,6 +5,7 @@ The program is based on the libibverbs
 
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stddef.h>
 #include <infiniband/verbs.h>
 #include <errno.h>
@@ -18,32 +19,75 @@ The program is based on the libibverbs
 #include "logging.h"
 #include "cm.h"
 #include "latency_measure.h"
+#include "numa_placement.h"
+#include "transport.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "hw_counters.h"
+#include "connection.h"
+#include "scenario.h"
+#include "replay.h"
+#include "autotune.h"
+#include "detector.h"
+#include "clock_sync.h"
+#include "ud.h"
+#include "qp_scale.h"
+#include "results.h"
+
+typedef void(*LogicFunction)(ClientConnection*);
+
+// The server side of one local endpoint: its device and the regions registered on it.
+typedef struct
+{
+	Endpoint endpoint;
+	struct ibv_context* dev_ctx;
+	struct ibv_pd* pd;
+	struct ibv_comp_channel* ch;
+	struct ibv_cq* cq_with_ch;
+	struct ibv_cq* cq_no_ch;
+	void** bufs;
+	struct ibv_mr** mrs;
+} ServerEndpoint;
 
-typedef void(*LogicFunction)(struct ibv_qp*, ConnectionInfoExchange*, void*, uint32_t);
-
-const unsigned int CQE_SIZE = 2048*8;
-const unsigned int CLIENT_BUF_SIZE = 1;
-
-#define SERVER_BUFFER_SIZE (PAGE_SIZE * PREFETCH_GROUP_SIZE)
+// NIC counters are sampled every this many milliseconds, 0 disables sampling.
+static uint32_t hw_counter_interval_ms = 0;
 
 
 void release_memlock_limits();
-int do_server(uint16_t port_no);
-int do_client(char* server_addr, uint16_t port_no, LogicFunction logic);
-void setup_qp(uint32_t qp_num, uint16_t port_lid, struct ibv_qp* qp);
+int do_server(uint16_t port_no, const Endpoint* endpoints, uint32_t number_of_endpoints, int per_port_regions);
+int do_client(char* server_addr, uint16_t port_no, const Endpoint* endpoints, uint32_t number_of_endpoints, uint32_t number_of_ud_qps, uint32_t number_of_scale_qps, int attacker_lanes, LogicFunction logic);
 void print_help(char* prog_name);
 
 int main(int argc, char** argv)
 {
 	const int MODE_EXHAUSTER = 1;
 	const int MODE_LATENCY = 2;
-	release_memlock_limits();
+	const int MODE_SCENARIO = 3;
+	const int MODE_REPLAY = 4;
+	const int MODE_AUTOTUNE = 5;
+	const int MODE_UD = 6;
+	const int MODE_QP_SCALE = 7;
 	uint16_t port = 12345;
 	int mode = 0;
 	char* server_addr = NULL;
+	char* dev_spec = NULL;
+	int per_port_regions = 0;
+	uint16_t metrics_port = 0;
+	char* metrics_unix_path = NULL;
+	char* scenario_path = NULL;
+	char* trace_path = NULL;
+	char* results_path = NULL;
+	int replay_as_fast_as_possible = 0;
+	uint32_t number_of_ud_qps = 0;
+	uint32_t number_of_scale_qps = 0;
 	LogicFunction logic = NULL;
+	if (argc > 1 && 0 == strcmp(argv[1], "compare"))
+	{
+		return results_compare(argc - 1, argv + 1);
+	}
 	int c;
-	while ((c = getopt(argc,argv,"p:a:hle")) != -1) 
+	while ((c = getopt(argc,argv,"p:a:d:i:t:g:m:M:C:o:s:r:T:D:S:u:Q:R:FPBhle")) != -1) 
 	{
 		switch(c)
 		{
@@ -57,6 +101,39 @@ int main(int argc, char** argv)
 			case 'p':
 				port = strtol(optarg, NULL, 10);
 				break;
+			case 'd':
+				dev_spec = optarg;
+				break;
+			case 'i':
+				ib_port_number = strtol(optarg, NULL, 10);
+				break;
+			case 't':
+				select_transport(optarg);
+				break;
+			case 'g':
+				load_geometry(optarg);
+				break;
+			case 'm':
+				metrics_port = strtol(optarg, NULL, 10);
+				break;
+			case 'M':
+				metrics_unix_path = optarg;
+				break;
+			case 'C':
+				hw_counter_interval_ms = strtol(optarg, NULL, 10);
+				break;
+			case 'o':
+				open_timeline(optarg);
+				break;
+			case 'D':
+				configure_detectors(optarg);
+				break;
+			case 'S':
+				configure_clock_sync(optarg);
+				break;
+			case 'R':
+				results_path = optarg;
+				break;
 			case 'l':
 				if (mode != 0)
 				{
@@ -75,6 +152,66 @@ int main(int argc, char** argv)
 				mode = MODE_EXHAUSTER;
 				logic = logic_attacker;
 				break;
+			case 's':
+				if (mode != 0)
+				{
+					print_help(argv[0]);
+					exit(-1);
+				}
+				mode = MODE_SCENARIO;
+				scenario_path = optarg;
+				break;
+			case 'r':
+				if (mode != 0)
+				{
+					print_help(argv[0]);
+					exit(-1);
+				}
+				mode = MODE_REPLAY;
+				trace_path = optarg;
+				logic = logic_replay;
+				break;
+			case 'T':
+				if (mode != 0)
+				{
+					print_help(argv[0]);
+					exit(-1);
+				}
+				mode = MODE_AUTOTUNE;
+				configure_autotune(optarg);
+				logic = logic_autotune;
+				break;
+			case 'u':
+				if (mode != 0)
+				{
+					print_help(argv[0]);
+					exit(-1);
+				}
+				mode = MODE_UD;
+				configure_ud(optarg);
+				number_of_ud_qps = ud_requested_qps();
+				logic = logic_ud;
+				break;
+			case 'Q':
+				if (mode != 0)
+				{
+					print_help(argv[0]);
+					exit(-1);
+				}
+				mode = MODE_QP_SCALE;
+				configure_qp_scale(optarg);
+				number_of_scale_qps = qp_scale_requested_qps();
+				logic = logic_qp_scale;
+				break;
+			case 'F':
+				replay_as_fast_as_possible = 1;
+				break;
+			case 'P':
+				per_port_regions = 1;
+				break;
+			case 'B':
+				use_wr_builder = 1;
+				break;
 			default:
 				print_help(argv[0]);
 				exit(-1);
@@ -88,174 +225,301 @@ int main(int argc, char** argv)
 	}	
 	if (mode == 0)
 	{
-		log_msg("No mode set, use [-l] or [-e]");
+		log_msg("No mode set, use [-l], [-e], [-u], [-Q], [-r], [-T] or [-s]");
 		print_help(argv[0]);
 		exit(-1);
 	}
-	if (server_addr == NULL)
+	Endpoint endpoints[MAX_ENDPOINTS];
+	uint32_t number_of_endpoints = parse_endpoints(dev_spec, ib_port_number, endpoints, MAX_ENDPOINTS);
+	if (number_of_endpoints > 1 && NULL != server_addr && mode != MODE_EXHAUSTER && mode != MODE_AUTOTUNE)
+	{
+		log_msg("Only the cache exhauster (-e) and the auto-tuner (-T) can fan out over several devices / ports");
+		exit(-1);
+	}
+	if (mode == MODE_AUTOTUNE && NULL != server_addr)
+	{
+		if (number_of_endpoints > AUTOTUNE_MAX_QPS)
+		{
+			log_msg("The auto-tuner drives at most %d QPs, one per device / port, but %u were given", AUTOTUNE_MAX_QPS, number_of_endpoints);
+			exit(-1);
+		}
+		// The tuner tries up to AUTOTUNE_MAX_QPS QPs, spread round robin over the given devices / ports.
+		for (uint32_t i = number_of_endpoints ; i < AUTOTUNE_MAX_QPS ; ++i)
+		{
+			endpoints[i] = endpoints[i % number_of_endpoints];
+		}
+		number_of_endpoints = AUTOTUNE_MAX_QPS;
+	}
+	if (number_of_endpoints > 1 && mode == MODE_SCENARIO)
+	{
+		log_msg("Scenarios run on a single device / port");
+		exit(-1);
+	}
+	if (NULL != results_path && NULL == server_addr && mode != MODE_SCENARIO)
+	{
+		log_msg("Only clients and scenarios write results (-R)");
+		exit(-1);
+	}
+	if (use_wr_builder && NULL == transport->create_qp_ex)
+	{
+		log_msg("The %s transport has no WR builder API, posting with post_send", transport->name);
+		use_wr_builder = 0;
+	}
+	// The mock transport doesn't pin memory, so it can run without the privileges needed here.
+	if (transport == &verbs_transport)
+	{
+		release_memlock_limits();
+	}
+	if (0 != metrics_port || NULL != metrics_unix_path)
+	{
+		start_metrics_server(metrics_port, metrics_unix_path);
+	}
+	if (mode == MODE_REPLAY)
+	{
+		configure_replay(trace_path, replay_as_fast_as_possible);
+	}
+	if (NULL != results_path)
+	{
+		open_results(results_path, argc, argv);
+	}
+	int ans;
+	if (mode == MODE_SCENARIO)
+	{
+		log_msg("Running scenario: %s", scenario_path);
+		ans = run_scenario(scenario_path, &endpoints[0], hw_counter_interval_ms);
+	}
+	else if (server_addr == NULL)
 	{
 		log_msg("I'm a server! Listening on port: %hu", port);
-		return do_server(port);
+		ans = do_server(port, endpoints, number_of_endpoints, per_port_regions);
+	}
+	else
+	{
+		log_msg("I'm a client. Connectiong to: %s:%hu", server_addr, port);
+		ans = do_client(server_addr, port, endpoints, number_of_endpoints, number_of_ud_qps, number_of_scale_qps, mode == MODE_EXHAUSTER || mode == MODE_AUTOTUNE, logic);
 	}
-	log_msg("I'm a client. Connectiong to: %s:%hu", server_addr, port);
-	return do_client(server_addr, port, logic);
+	close_results();
+	close_timeline();
+	return ans;
 }
 
 void print_help(char* prog_name)
 {
-	log_msg("Usage: %s [-a server_addr] [-p port] [-l | -e] [-h]", prog_name);
+	log_msg("Usage: %s [-a server_addr] [-p port] [-d device[:port][,device[:port]...]] [-i ib_port] [-P] [-B] [-t transport] [-g geometry_file] [-m metrics_port] [-M metrics_socket] [-C interval_ms] [-o timeline_file] [-D detector_settings] [-S rounds[:rdma]] [-R results_file] [-l | -e | -u probe|flood[:qps[:sends_per_qp]] | -Q max_qps[:step_ms] | -r trace_file [-F] | -T trial_ms | -s scenario_file] [-h]", prog_name);
+	log_msg("       %s compare [-t tolerance_pct] [-b iterations] base_results new_results", prog_name);
 	log_msg("\t -h - print this help and exit");
 	log_msg("\t -a - set to client mode and specify the server's IP address, otherwise - server mode.");
 	log_msg("\t -p - specify the port number to connect to (default: 12345)");
+	log_msg("\t -d - name of the RDMA device to use (default: first device), optionally with a port. A comma separated list opens");
+	log_msg("\t      every listed device / port: the exhauster drives a QP on each of them, the server spreads the client's QPs over them");
+	log_msg("\t -i - port number of the RDMA device to use, for devices listed without one (default: 1)");
+	log_msg("\t -P - server with several devices / ports: register a separate copy of the regions per port (displaced by port_stride)");
+	log_msg("\t -B - client: post the attacker's reads through the WR builder API (ibv_wr_*) of extended QPs, where supported");
+	log_msg("\t -t - transport: verbs (default) or mock[:base_ns:hit_ns:miss_ns:cache_entries] (simulated NIC, no device needed)");
+	log_msg("\t -g - load the region geometry (bit ranges, region size, count, base address, sparse indices) from a file");
+	log_msg("\t -m - serve Prometheus metrics over HTTP on 127.0.0.1:<metrics_port>");
+	log_msg("\t -M - serve a JSON metrics dump on the given Unix socket path");
+	log_msg("\t -C - sample the NIC counters every interval_ms milliseconds and record their deltas on the timeline");
+	log_msg("\t -o - write the timeline (latency samples, sweep times, counter deltas) to a CSV file (default: stdout)");
+	log_msg("\t -D - latency degradation detector settings: comma separated key=value of warmup, clip, ewma_alpha,");
+	log_msg("\t      ewma_limit, cusum_k, cusum_h, window, quantile, quantile_ratio (see include/detector.h)");
+	log_msg("\t -S - client: synchronize the timeline's clock with the server's, with bursts of `rounds` ping-pongs over TCP");
+	log_msg("\t      (and with :rdma, RDMA reads of a timestamp word the server updates) when connecting and every second after");
+	log_msg("\t -R - client: write the run's results (command line, host, devices, counters, latency histograms, throughput");
+	log_msg("\t      per second) to a file, for `compare` to test two runs' latency and throughput deltas for significance");
 	log_msg("\t -l - latency measurement mode");
 	log_msg("\t -e - cache exhauster mode");
+	log_msg("\t -u - UD mode: probe (SEND a probe once a second and time the server's echo) or flood over qps UD QPs");
+	log_msg("\t      (default: %u), sending sends_per_qp SENDs from each in turn (default: %u)", UD_DEFAULT_FLOOD_QPS, UD_DEFAULT_SENDS_PER_QP);
+	log_msg("\t -Q - QP scale mode: connect max_qps more RC QPs, sweep reads over 1, 2, 4... up to max_qps of them for step_ms");
+	log_msg("\t      milliseconds each (default: %u) and report the latency per active QP count, and where it breaks", QP_SCALE_DEFAULT_STEP_MS);
+	log_msg("\t -r - replay a binary access trace (see trace_convert) against the server's regions");
+	log_msg("\t -F - replay the trace as fast as possible instead of with its recorded inter-arrival times");
+	log_msg("\t -T - auto-tune the attacker (QP count, post batch, signal interval, window, poll batch) with trials of trial_ms milliseconds");
+	log_msg("\t -s - run the victim and attackers of a scenario file as threads of this process (servers are started as usual)");
 }
 
-int do_client(char* server_addr, uint16_t port, LogicFunction logic)
+int do_client(char* server_addr, uint16_t port, const Endpoint* endpoints, uint32_t number_of_endpoints, uint32_t number_of_ud_qps, uint32_t number_of_scale_qps, int attacker_lanes, LogicFunction logic)
 {
-	int ans = 0;
-	int client_sock = do_connect_client(port, server_addr);
-	ConnectionInfoExchange* peer_info = receive_info_from_peer(client_sock);
-	struct ibv_context* dev_ctx = get_dev_context();
-	struct ibv_cq* cq = create_cq(dev_ctx, CQE_SIZE, NULL, NULL, 0);
-	struct ibv_qp_init_attr qp_attrs = create_qp_init_attr(cq);
+	ClientConnection* conn = client_connect(server_addr, port, endpoints, number_of_endpoints, number_of_ud_qps, number_of_scale_qps, attacker_lanes);
+	for (uint32_t i = 0 ; i < conn->number_of_lanes ; ++i)
+	{
+		results_add_device(conn->lanes[i].dev_ctx, conn->lanes[i].endpoint.port);
+	}
+	if (0 != hw_counter_interval_ms)
+	{
+		for (uint32_t i = 0 ; i < conn->number_of_lanes ; ++i)
+		{
+			start_hw_counter_sampler(conn->lanes[i].dev_ctx, conn->lanes[i].endpoint.port, hw_counter_interval_ms);
+		}
+	}
 
-	void* buf = alloc_mr(CLIENT_BUF_SIZE);
-	struct ibv_pd* pd = alloc_pd(dev_ctx);
-	struct ibv_qp* qp = create_qp(pd, &qp_attrs);
-	struct ibv_mr* mr = register_mr(pd, buf, CLIENT_BUF_SIZE, IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
-	send_info_to_peer(client_sock, qp, dev_ctx, &mr, 1);
-	setup_qp(peer_info->header.qp_num, peer_info->header.port_lid, qp);
+	do_sync(conn->sock);
+	clock_sync_track(conn->clock_sync);
+	logic(conn);
+	clock_sync_stop(conn->clock_sync);
+	do_sync(conn->sock);
 
-	do_sync(client_sock);
-	logic(qp, peer_info, buf, mr->lkey);
-	do_sync(client_sock);
+	client_disconnect(conn);
+	return 0;
+}
 
-	dereg_mr(mr);
-	destroy_qp(qp);
-	dealloc_pd(pd);
+// Places every region of the geometry, displaced by the given number of bytes.
+static void** allocate_regions(uint64_t displacement)
+{
+	const uint32_t number_of_mrs = geometry_number_of_regions(&geometry);
+	void** bufs = do_malloc(number_of_mrs * sizeof(*bufs));
+	int mr_idx = 0;
+	for (uint32_t set_idx = 0 ; set_idx < geometry.number_of_sets ; ++set_idx)
+	{
+		const RegionSet* set = &geometry.sets[set_idx];
+		for (uint32_t i = 0 ; i < region_set_size(set) ; ++i)
+		{
+			void* addr = (void*)(geometry_region_address(set, i) + displacement);
+			bufs[mr_idx] = allocate_at_addr(addr, geometry.region_size);
+			if (NULL == bufs[mr_idx])
+			{
+				log_msg("Failed to place MR id %d at %p! leaving...", mr_idx, addr);
+				exit(-1);
+			}
+			++mr_idx;
+		}
+	}
+	return bufs;
+}
 
-	free(peer_info);
-	free(buf);
-	destroy_cq(cq);
-	do_close_device(dev_ctx);
-	return 0;
+static void free_regions(void** bufs)
+{
+	const uint32_t number_of_mrs = geometry_number_of_regions(&geometry);
+	for (uint32_t i = 0 ; i < number_of_mrs ; ++i)
+	{
+		free_at_addr(bufs[i], geometry.region_size);
+	}
+	free(bufs);
 }
 
-int do_server(uint16_t port_no)
+int do_server(uint16_t port_no, const Endpoint* endpoints, uint32_t number_of_endpoints, int per_port_regions)
 {	
-	int retval = ibv_fork_init();
+	int retval = transport->fork_init();
 	if (0 != retval)
 	{
 		log_msg("Failed! ibv_fork_init returned %d", retval);
 		exit(-1);
 	}
 
-	struct ibv_context* dev_ctx = get_dev_context();
-	struct ibv_pd* pd = alloc_pd(dev_ctx);
-	struct ibv_mr* mrs[SERVER_NUMBER_OF_MRS];
-
-	int mr_idx = 0;
-	const uint64_t BASE_OFFSET_LOWER = ((uint64_t)1)<<(UPPER_INDEX_LAST_BIT + 9);
-	const uint64_t BASE_OFFSET_UPPER = ((uint64_t)1)<<(UPPER_INDEX_LAST_BIT + 10);
-	for (uint64_t i = 0 ; i < 1<<(LOWER_INDEX_LAST_BIT + 1) ; i += 1<<(LOWER_INDEX_FIRST_BIT))
-	{
-		log_msg("Registering MR id: %d", mr_idx);
-		void* buf = allocate_at_addr((void*)(BASE_OFFSET_LOWER + i), SERVER_BUFFER_SIZE);
-		mrs[mr_idx] = register_mr(pd, buf, SERVER_BUFFER_SIZE, IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
-		++mr_idx;
+	const uint32_t number_of_mrs = geometry_number_of_regions(&geometry);
+	ServerEndpoint* eps = do_malloc(number_of_endpoints * sizeof(*eps));
+	int node = -1;
+	for (uint32_t k = 0 ; k < number_of_endpoints ; ++k)
+	{
+		ServerEndpoint* ep = &eps[k];
+		ep->endpoint = endpoints[k];
+		ep->dev_ctx = get_dev_context(ep->endpoint.dev_name, ep->endpoint.port);
+		if (0 == k)
+		{
+			node = setup_placement(ep->dev_ctx);
+		}
+		if (0 != hw_counter_interval_ms)
+		{
+			start_hw_counter_sampler(ep->dev_ctx, ep->endpoint.port, hw_counter_interval_ms);
+		}
+		ep->pd = alloc_pd(ep->dev_ctx);
+		ep->ch = create_comp_channel(ep->dev_ctx);
+		int comp_vector = select_comp_vector(ep->dev_ctx, node);
+		ep->cq_with_ch = create_cq(ep->dev_ctx, CQE_SIZE, NULL, ep->ch, comp_vector);
+		ep->cq_no_ch = create_cq(ep->dev_ctx, CQE_SIZE, NULL, NULL, comp_vector);
 	}
 
-	for (uint64_t i = 0 ; i < ((uint64_t)1)<<(UPPER_INDEX_LAST_BIT + 1) ; i += 1<<(UPPER_INDEX_FIRST_BIT))
+	// Either every endpoint exposes the same memory, or each gets its own copy of the layout.
+	void** shared_bufs = per_port_regions ? NULL : allocate_regions(0);
+	for (uint32_t k = 0 ; k < number_of_endpoints ; ++k)
 	{
-		log_msg("Registering MR id: %d", mr_idx);
-		void* buf = allocate_at_addr((void*)(BASE_OFFSET_UPPER + i), SERVER_BUFFER_SIZE);
-		mrs[mr_idx] = register_mr(pd, buf, SERVER_BUFFER_SIZE, IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
-		++mr_idx;
+		ServerEndpoint* ep = &eps[k];
+		ep->bufs = per_port_regions ? allocate_regions(k * geometry.port_stride) : shared_bufs;
+		ep->mrs = do_malloc(number_of_mrs * sizeof(*ep->mrs));
+		for (uint32_t mr_idx = 0 ; mr_idx < number_of_mrs ; ++mr_idx)
+		{
+			log_msg("Registering MR id: %u on %s:%hhu", mr_idx, ep->endpoint.dev_name, ep->endpoint.port);
+			ep->mrs[mr_idx] = register_mr(ep->pd, ep->bufs[mr_idx], geometry.region_size, IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ);
+		}
 	}
 
-	struct ibv_comp_channel* ch = create_comp_channel(dev_ctx);
-	struct ibv_cq* cq_with_ch = create_cq(dev_ctx, CQE_SIZE, NULL, ch, 0);
-	struct ibv_cq* cq_no_ch = create_cq(dev_ctx, CQE_SIZE, NULL, NULL, 0);
-
-	struct ibv_qp_init_attr qp_attrs = create_qp_init_attr(cq_with_ch);
-	struct ibv_qp* qp = create_qp(pd, &qp_attrs);
-
 	int server_sock = do_connect_server(port_no);
-	send_info_to_peer(server_sock, qp, dev_ctx, mrs, SERVER_NUMBER_OF_MRS);
-	ConnectionInfoExchange* peer_info = receive_info_from_peer(server_sock);
-	setup_qp(peer_info->header.qp_num, peer_info->header.port_lid, qp);
+	// The client's QPs are spread round robin over the server's endpoints.
+	FanoutRequest request = receive_fanout_request(server_sock);
+	uint32_t number_of_qps = request.number_of_qps;
+	struct ibv_qp** qps = do_malloc(number_of_qps * sizeof(*qps));
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		ServerEndpoint* ep = &eps[i % number_of_endpoints];
+		struct ibv_qp_init_attr qp_attrs = create_qp_init_attr(ep->cq_with_ch);
+		qps[i] = create_qp(ep->pd, &qp_attrs);
+		send_info_to_peer(server_sock, qps[i], ep->dev_ctx, ep->endpoint.port, ep->mrs, number_of_mrs);
+	}
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		ConnectionInfoExchange* peer_info = receive_info_from_peer(server_sock);
+		setup_qp(peer_info->header.qp_num, peer_info->header.port_lid, eps[i % number_of_endpoints].endpoint.port, qps[i]);
+		free(peer_info);
+	}
+	// The UD QPs are on the first endpoint, which the client's first lane is connected to, if the client asked for any.
+	UdServer* ud_server = NULL;
+	if (0 != request.number_of_ud_qps)
+	{
+		ud_server = ud_server_create(server_sock, eps[0].dev_ctx, eps[0].pd, eps[0].endpoint.port, request.number_of_ud_qps);
+	}
+	// And the scale QPs, which read the first endpoint's regions.
+	QpScaleServer* qp_scale_server = NULL;
+	if (0 != request.number_of_scale_qps)
+	{
+		qp_scale_server = qp_scale_server_create(server_sock, eps[0].dev_ctx, eps[0].pd, eps[0].endpoint.port, request.number_of_scale_qps);
+	}
+	// So is the timestamp word. The client synchronizes its clock right after exchanging it, so every
+	// other exchange has to come before it (see client_connect).
+	ClockWord* clock_word = NULL;
+	if (request.clock_sync_flags & CLOCK_SYNC_RDMA)
+	{
+		clock_word = clock_word_create(server_sock, eps[0].dev_ctx, eps[0].pd, eps[0].cq_no_ch, eps[0].endpoint.port);
+	}
 
-	do_sync(server_sock);
+	// Both waits answer the client's clock synchronization requests, if any.
+	serve_clock_sync(server_sock, clock_word);
 	log_msg("Waiting for client to finish his attack now...");
-	do_sync(server_sock);
+	serve_clock_sync(server_sock, clock_word);
 	close(server_sock);
-	destroy_qp(qp); 
-	destroy_cq(cq_no_ch);
-	destroy_cq(cq_with_ch);
-	destroy_comp_channel(ch);
-
-	for (unsigned int i = 0 ; i < SERVER_NUMBER_OF_MRS ; ++i)
+	qp_scale_server_destroy(qp_scale_server);
+	ud_server_destroy(ud_server);
+	clock_word_destroy(clock_word);
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
 	{
-		void* addr = mrs[i]->addr;
-		dereg_mr(mrs[i]);
-		free_at_addr(addr, SERVER_BUFFER_SIZE);
-	}
-
-	dealloc_pd(pd);
-	free(peer_info);
-	do_close_device(dev_ctx);
-}
-
-void setup_qp(uint32_t qp_num, uint16_t port_lid, struct ibv_qp* qp)
-{
-	struct ibv_qp_attr attr;
-
-	//RESET -> INIT 
-	attr.qp_state = IBV_QPS_INIT;
-	attr.pkey_index = 0;
-	attr.port_num = 1;
-	attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE |  IBV_ACCESS_REMOTE_READ;
-	if (0 != ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_ACCESS_FLAGS))
-	{
-		log_msg("Failed to change states: RESET -> INIT");
-		exit(-1);
+		destroy_qp(qps[i]);
 	}
+	free(qps);
 
-	log_msg("RESET -> INIT QP Set Successfully");
-	attr.qp_state = IBV_QPS_RTR;
-	attr.path_mtu = IBV_MTU_512;
-	attr.ah_attr.dlid = port_lid;
-	attr.ah_attr.is_global = 0;
-	attr.ah_attr.sl = 0;
-	attr.ah_attr.port_num = 1;
-	attr.dest_qp_num = qp_num;
-	attr.rq_psn = 1;
-	attr.max_dest_rd_atomic = 1;
-	attr.min_rnr_timer = 12;
-
-	if (0 != ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PATH_MTU | IBV_QP_AV | IBV_QP_DEST_QPN | IBV_QP_RQ_PSN | IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER))
+	for (uint32_t k = 0 ; k < number_of_endpoints ; ++k)
 	{
-		log_msg("Failed to change states: INIT -> RTR");
-		exit(-1);
+		ServerEndpoint* ep = &eps[k];
+		destroy_cq(ep->cq_no_ch);
+		destroy_cq(ep->cq_with_ch);
+		destroy_comp_channel(ep->ch);
+		for (uint32_t i = 0 ; i < number_of_mrs ; ++i)
+		{
+			dereg_mr(ep->mrs[i]);
+		}
+		free(ep->mrs);
+		if (per_port_regions)
+		{
+			free_regions(ep->bufs);
+		}
+		dealloc_pd(ep->pd);
+		do_close_device(ep->dev_ctx);
 	}
-
-	log_msg("INIT -> RTR QP Set Successfully");
-
-	attr.qp_state = IBV_QPS_RTS;
-	attr.timeout = 14;
-	attr.retry_cnt = 7;
-	attr.rnr_retry = 7;
-	attr.sq_psn = 1;
-	attr.max_rd_atomic = 1;
-
-	if (0 != ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT | IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN | IBV_QP_MAX_QP_RD_ATOMIC))
+	if (!per_port_regions)
 	{
-		log_msg("Failed to change state: RTR -> RTS");
-		exit(-1);
+		free_regions(shared_bufs);
 	}
-
-	log_msg("RNR -> RTR QP Set Successfully");
+	free(eps);
+	return 0;
 }
 
 void release_memlock_limits()
@@ -1,6 +1,7 @@
 #include <memutils.h>
 #include <stdlib.h>
 #include <logging.h>
+#include <numa_placement.h>
 
 void* allocate_at_addr(void* addr, uint32_t size_in_bytes)
 {
@@ -21,6 +22,7 @@ void* allocate_at_addr(void* addr, uint32_t size_in_bytes)
         }
         return NULL;
     }
+    bind_memory_to_node(allocated_addr, size_in_bytes, get_placement_node());
     return allocated_addr;
 }
 
@@ -42,4 +44,15 @@ void* do_malloc(uint64_t bytes)
         exit(-1);
     }
     return buf;
+}
+
+void* do_malloc_aligned(uint64_t bytes)
+{
+    void* buf = NULL;
+    if (0 != posix_memalign(&buf, CACHE_LINE_SIZE, bytes))
+    {
+        log_msg("Failed to allocate %llu aligned bytes", bytes);
+        exit(-1);
+    }
+    return buf;
 }
\ No newline at end of file
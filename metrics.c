@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "metrics.h"
+#include "logging.h"
+
+static ThreadMetrics scratch_metrics;
+__thread ThreadMetrics* thread_metrics = &scratch_metrics;
+
+static ThreadMetrics* registered[METRICS_MAX_THREADS];
+static uint32_t number_of_registered = 0;
+
+// Rates are computed by the server thread once a second.
+static uint64_t last_ops[METRICS_MAX_THREADS];
+static double ops_per_second[METRICS_MAX_THREADS];
+
+static int http_sock = -1;
+static int unix_sock = -1;
+
+typedef struct
+{
+	char* data;
+	size_t len;
+	size_t capacity;
+} TextBuffer;
+
+static void buf_printf(TextBuffer* buf, const char* format, ...)
+{
+	while (1)
+	{
+		va_list args;
+		va_start(args, format);
+		int needed = vsnprintf(buf->data + buf->len, buf->capacity - buf->len, format, args);
+		va_end(args);
+		if (needed < 0)
+		{
+			return;
+		}
+		if (buf->len + needed < buf->capacity)
+		{
+			buf->len += needed;
+			return;
+		}
+		buf->capacity = (buf->capacity + needed) * 2;
+		buf->data = realloc(buf->data, buf->capacity);
+		if (NULL == buf->data)
+		{
+			log_msg("[Metrics] Failed to realloc! leaving...");
+			exit(-1);
+		}
+	}
+}
+
+void metrics_register_thread(const char* role)
+{
+	uint32_t id = __atomic_fetch_add(&number_of_registered, 1, __ATOMIC_RELAXED);
+	if (id >= METRICS_MAX_THREADS)
+	{
+		log_msg("[Metrics] Too many threads registered (max %d)", METRICS_MAX_THREADS);
+		exit(-1);
+	}
+	ThreadMetrics* m = aligned_alloc(64, sizeof(*m));
+	if (NULL == m)
+	{
+		log_msg("[Metrics] Failed to allocate thread metrics! leaving...");
+		exit(-1);
+	}
+	memset(m, 0, sizeof(*m));
+	snprintf(m->role, sizeof(m->role), "%s", role);
+	thread_metrics = m;
+	__atomic_store_n(&registered[id], m, __ATOMIC_RELEASE);
+}
+
+uint32_t metrics_snapshot(ThreadMetrics* out)
+{
+	uint32_t n = __atomic_load_n(&number_of_registered, __ATOMIC_RELAXED);
+	uint32_t copied = 0;
+	for (uint32_t i = 0 ; i < n && i < METRICS_MAX_THREADS ; ++i)
+	{
+		ThreadMetrics* m = __atomic_load_n(&registered[i], __ATOMIC_ACQUIRE);
+		if (NULL == m)
+		{
+			// Still registering, so are all the threads after it.
+			break;
+		}
+		memcpy(out[copied].role, m->role, sizeof(m->role));
+		out[copied].ops = __atomic_load_n(&m->ops, __ATOMIC_RELAXED);
+		out[copied].errors = __atomic_load_n(&m->errors, __ATOMIC_RELAXED);
+		out[copied].cq_polls = __atomic_load_n(&m->cq_polls, __ATOMIC_RELAXED);
+		out[copied].cq_empty_polls = __atomic_load_n(&m->cq_empty_polls, __ATOMIC_RELAXED);
+		out[copied].completions = __atomic_load_n(&m->completions, __ATOMIC_RELAXED);
+		out[copied].alarms = __atomic_load_n(&m->alarms, __ATOMIC_RELAXED);
+		histogram_snapshot(&m->latency_ns, &out[copied].latency_ns);
+		++copied;
+	}
+	return copied;
+}
+
+static void update_rates(double elapsed_sec)
+{
+	uint32_t n = __atomic_load_n(&number_of_registered, __ATOMIC_RELAXED);
+	for (uint32_t i = 0 ; i < n && i < METRICS_MAX_THREADS ; ++i)
+	{
+		ThreadMetrics* m = __atomic_load_n(&registered[i], __ATOMIC_ACQUIRE);
+		if (NULL == m)
+		{
+			continue;
+		}
+		uint64_t ops = __atomic_load_n(&m->ops, __ATOMIC_RELAXED);
+		ops_per_second[i] = (ops - last_ops[i]) / elapsed_sec;
+		last_ops[i] = ops;
+	}
+}
+
+static void format_prometheus(TextBuffer* buf, ThreadMetrics* snap, uint32_t n)
+{
+	static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+	const struct
+	{
+		const char* name;
+		const char* help;
+		size_t offset;
+	} counters[] = {
+		{"rdma_ops_total", "Work requests posted.", offsetof(ThreadMetrics, ops)},
+		{"rdma_errors_total", "Failed posts and completions.", offsetof(ThreadMetrics, errors)},
+		{"rdma_cq_polls_total", "Calls to poll_cq.", offsetof(ThreadMetrics, cq_polls)},
+		{"rdma_cq_empty_polls_total", "Calls to poll_cq that returned no completion.", offsetof(ThreadMetrics, cq_empty_polls)},
+		{"rdma_completions_total", "Completions polled.", offsetof(ThreadMetrics, completions)}
+	};
+
+	for (uint32_t c = 0 ; c < sizeof(counters) / sizeof(counters[0]) ; ++c)
+	{
+		buf_printf(buf, "# HELP %s %s\n# TYPE %s counter\n", counters[c].name, counters[c].help, counters[c].name);
+		for (uint32_t i = 0 ; i < n ; ++i)
+		{
+			uint64_t value = *(uint64_t*)((char*)&snap[i] + counters[c].offset);
+			buf_printf(buf, "%s{thread=\"%u\",role=\"%s\"} %" PRIu64 "\n", counters[c].name, i, snap[i].role, value);
+		}
+	}
+
+	buf_printf(buf, "# HELP rdma_ops_per_second Work requests posted per second, over the last second.\n# TYPE rdma_ops_per_second gauge\n");
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		buf_printf(buf, "rdma_ops_per_second{thread=\"%u\",role=\"%s\"} %.1f\n", i, snap[i].role, ops_per_second[i]);
+	}
+
+	buf_printf(buf, "# HELP rdma_latency_alarms Latency degradation detectors currently raising an alarm.\n# TYPE rdma_latency_alarms gauge\n");
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		buf_printf(buf, "rdma_latency_alarms{thread=\"%u\",role=\"%s\"} %" PRIu64 "\n", i, snap[i].role, snap[i].alarms);
+	}
+
+	buf_printf(buf, "# HELP rdma_iteration_latency_seconds Latency of one measured iteration.\n# TYPE rdma_iteration_latency_seconds summary\n");
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		for (uint32_t q = 0 ; q < sizeof(quantiles) / sizeof(quantiles[0]) ; ++q)
+		{
+			buf_printf(buf, "rdma_iteration_latency_seconds{thread=\"%u\",role=\"%s\",quantile=\"%g\"} %.9f\n", i, snap[i].role, quantiles[q], histogram_percentile(&snap[i].latency_ns, quantiles[q]) / 1e9);
+		}
+		buf_printf(buf, "rdma_iteration_latency_seconds_sum{thread=\"%u\",role=\"%s\"} %.9f\n", i, snap[i].role, snap[i].latency_ns.sum / 1e9);
+		buf_printf(buf, "rdma_iteration_latency_seconds_count{thread=\"%u\",role=\"%s\"} %" PRIu64 "\n", i, snap[i].role, snap[i].latency_ns.count);
+	}
+}
+
+static void format_json(TextBuffer* buf, ThreadMetrics* snap, uint32_t n)
+{
+	buf_printf(buf, "{\"threads\":[");
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		const Histogram* h = &snap[i].latency_ns;
+		buf_printf(buf, "%s{\"thread\":%u,\"role\":\"%s\",\"ops\":%" PRIu64 ",\"ops_per_second\":%.1f,\"errors\":%" PRIu64 ","
+			"\"cq_polls\":%" PRIu64 ",\"cq_empty_polls\":%" PRIu64 ",\"completions\":%" PRIu64 ",\"alarms\":%" PRIu64 ","
+			"\"latency_ns\":{\"count\":%" PRIu64 ",\"mean\":%.1f,\"p50\":%" PRIu64 ",\"p90\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "}}",
+			(0 == i) ? "" : ",", i, snap[i].role, snap[i].ops, ops_per_second[i], snap[i].errors,
+			snap[i].cq_polls, snap[i].cq_empty_polls, snap[i].completions, snap[i].alarms,
+			h->count, histogram_mean(h), histogram_percentile(h, 0.5), histogram_percentile(h, 0.9),
+			histogram_percentile(h, 0.99), histogram_percentile(h, 0.999), h->max);
+	}
+	buf_printf(buf, "]}\n");
+}
+
+static void write_all(int sock, const char* data, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t sent = send(sock, data, len, MSG_NOSIGNAL);
+		if (sent <= 0)
+		{
+			return;
+		}
+		data += sent;
+		len -= sent;
+	}
+}
+
+static void serve_http(int client)
+{
+	// Consume the request headers, we answer every request with the metrics.
+	char request[4096];
+	size_t got = 0;
+	struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	while (got < sizeof(request) - 1)
+	{
+		ssize_t ans = recv(client, request + got, sizeof(request) - 1 - got, 0);
+		if (ans <= 0)
+		{
+			break;
+		}
+		got += ans;
+		request[got] = '\0';
+		if (NULL != strstr(request, "\r\n\r\n"))
+		{
+			break;
+		}
+	}
+
+	static ThreadMetrics snap[METRICS_MAX_THREADS];
+	uint32_t n = metrics_snapshot(snap);
+	TextBuffer body = {0};
+	format_prometheus(&body, snap, n);
+	TextBuffer response = {0};
+	buf_printf(&response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", body.len);
+	write_all(client, response.data, response.len);
+	write_all(client, body.data, body.len);
+	free(response.data);
+	free(body.data);
+}
+
+static void serve_json(int client)
+{
+	static ThreadMetrics snap[METRICS_MAX_THREADS];
+	uint32_t n = metrics_snapshot(snap);
+	TextBuffer body = {0};
+	format_json(&body, snap, n);
+	write_all(client, body.data, body.len);
+	free(body.data);
+}
+
+static double now_sec()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void* metrics_server_thread(void* arg)
+{
+	struct pollfd fds[2];
+	fds[0].fd = http_sock;
+	fds[0].events = POLLIN;
+	fds[1].fd = unix_sock;
+	fds[1].events = POLLIN;
+	double last_update = now_sec();
+	while (1)
+	{
+		int ans = poll(fds, 2, 1000);
+		if (ans < 0 && EINTR != errno)
+		{
+			log_msg("[Metrics] poll failed! errno = %s", strerror(errno));
+			return NULL;
+		}
+		double now = now_sec();
+		if (now - last_update >= 1.0)
+		{
+			update_rates(now - last_update);
+			last_update = now;
+		}
+		for (int i = 0 ; i < 2 && ans > 0 ; ++i)
+		{
+			if (!(fds[i].revents & POLLIN))
+			{
+				continue;
+			}
+			int client = accept(fds[i].fd, NULL, NULL);
+			if (client < 0)
+			{
+				continue;
+			}
+			if (fds[i].fd == http_sock)
+			{
+				serve_http(client);
+			}
+			else
+			{
+				serve_json(client);
+			}
+			close(client);
+		}
+	}
+	return NULL;
+}
+
+static int listen_http(uint16_t port)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		log_msg("[Metrics] Failed to create socket, errno = %s", strerror(errno));
+		exit(-1);
+	}
+	int one = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(sock, 8))
+	{
+		log_msg("[Metrics] Failed to listen on 127.0.0.1:%hu, errno = %s", port, strerror(errno));
+		exit(-1);
+	}
+	log_msg("[Metrics] Serving Prometheus metrics on http://127.0.0.1:%hu/metrics", port);
+	return sock;
+}
+
+static int listen_unix(const char* path)
+{
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0)
+	{
+		log_msg("[Metrics] Failed to create socket, errno = %s", strerror(errno));
+		exit(-1);
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		log_msg("[Metrics] Unix socket path too long: %s", path);
+		exit(-1);
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if (0 != bind(sock, (struct sockaddr*)&addr, sizeof(addr)) || 0 != listen(sock, 8))
+	{
+		log_msg("[Metrics] Failed to listen on %s, errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	log_msg("[Metrics] Serving JSON metrics on unix socket %s", path);
+	return sock;
+}
+
+void start_metrics_server(uint16_t http_port, const char* unix_path)
+{
+	if (0 != http_port)
+	{
+		http_sock = listen_http(http_port);
+	}
+	if (NULL != unix_path)
+	{
+		unix_sock = listen_unix(unix_path);
+	}
+	pthread_t thread;
+	int ans = pthread_create(&thread, NULL, metrics_server_thread, NULL);
+	if (0 != ans)
+	{
+		log_msg("[Metrics] Failed to create server thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+	pthread_detach(thread);
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sched.h>
+#include <numa.h>
+#include <numaif.h>
+
+#include "numa_placement.h"
+#include "logging.h"
+#include "transport.h"
+
+static int placement_node = -1;
+
+// Reads a single integer from a sysfs / procfs file. Returns -1 if the file can't be read.
+static int read_int_from_file(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (NULL == f)
+	{
+		return -1;
+	}
+	int value = -1;
+	if (1 != fscanf(f, "%d", &value))
+	{
+		value = -1;
+	}
+	fclose(f);
+	return value;
+}
+
+// Fills the PCI address (e.g. 0000:3b:00.0) of the device. Returns 0 on success.
+static int get_device_pci_address(struct ibv_context* dev_ctx, char* out, size_t out_len)
+{
+	char path[PATH_MAX];
+	char link[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/device", dev_ctx->device->ibdev_path);
+	ssize_t len = readlink(path, link, sizeof(link) - 1);
+	if (len < 0)
+	{
+		return -1;
+	}
+	link[len] = '\0';
+	char* base = strrchr(link, '/');
+	snprintf(out, out_len, "%s", (NULL == base) ? link : base + 1);
+	return 0;
+}
+
+int get_device_numa_node(struct ibv_context* dev_ctx)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/device/numa_node", dev_ctx->device->ibdev_path);
+	return read_int_from_file(path);
+}
+
+int setup_placement(struct ibv_context* dev_ctx)
+{
+	if (numa_available() < 0)
+	{
+		log_msg("[NUMA] No NUMA support on this system, skipping placement");
+		return -1;
+	}
+	int node = get_device_numa_node(dev_ctx);
+	if (node < 0)
+	{
+		log_msg("[NUMA] Device %s reports no NUMA node, skipping placement", transport->get_device_name(dev_ctx->device));
+		return -1;
+	}
+	log_msg("[NUMA] Device %s is attached to node %d", transport->get_device_name(dev_ctx->device), node);
+	placement_node = node;
+	pin_thread_to_node(node);
+	return node;
+}
+
+int get_placement_node()
+{
+	return placement_node;
+}
+
+void pin_thread_to_node(int node)
+{
+	if (node < 0)
+	{
+		return;
+	}
+	if (0 != numa_run_on_node(node))
+	{
+		log_msg("[NUMA] Failed to pin thread to node %d! errno = %s", node, strerror(errno));
+		exit(-1);
+	}
+	int cpu_node = numa_node_of_cpu(sched_getcpu());
+	if (cpu_node != node)
+	{
+		log_msg("[NUMA] WARNING: thread runs on node %d but the device is on node %d", cpu_node, node);
+	}
+}
+
+void bind_memory_to_node(void* addr, size_t len, int node)
+{
+	if (node < 0)
+	{
+		return;
+	}
+	struct bitmask* mask = numa_allocate_nodemask();
+	numa_bitmask_setbit(mask, node);
+	if (0 != mbind(addr, len, MPOL_BIND, mask->maskp, mask->size + 1, 0))
+	{
+		log_msg("[NUMA] Failed to bind %p (%zu bytes) to node %d! errno = %s", addr, len, node, strerror(errno));
+		exit(-1);
+	}
+	numa_bitmask_free(mask);
+}
+
+int get_comp_vector_node(struct ibv_context* dev_ctx, int comp_vector)
+{
+	char pci_addr[64];
+	if (0 != get_device_pci_address(dev_ctx, pci_addr, sizeof(pci_addr)))
+	{
+		return -1;
+	}
+
+	// Completion vectors show up in /proc/interrupts as e.g. "mlx5_comp3@pci:0000:3b:00.0" (mlx5)
+	// or "mlx4-comp-3@pci:0000:3b:00.0" (mlx4).
+	char name_mlx5[128];
+	char name_mlx4[128];
+	snprintf(name_mlx5, sizeof(name_mlx5), "comp%d@pci:%s", comp_vector, pci_addr);
+	snprintf(name_mlx4, sizeof(name_mlx4), "comp-%d@pci:%s", comp_vector, pci_addr);
+
+	FILE* f = fopen("/proc/interrupts", "r");
+	if (NULL == f)
+	{
+		return -1;
+	}
+	int irq = -1;
+	char line[4096];
+	while (NULL != fgets(line, sizeof(line), f))
+	{
+		if (NULL == strstr(line, name_mlx5) && NULL == strstr(line, name_mlx4))
+		{
+			continue;
+		}
+		if (1 != sscanf(line, " %d:", &irq))
+		{
+			irq = -1;
+		}
+		break;
+	}
+	fclose(f);
+	if (irq < 0)
+	{
+		return -1;
+	}
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "/proc/irq/%d/smp_affinity_list", irq);
+	int first_cpu = read_int_from_file(path);
+	if (first_cpu < 0 || numa_available() < 0)
+	{
+		return -1;
+	}
+	return numa_node_of_cpu(first_cpu);
+}
+
+int select_comp_vector(struct ibv_context* dev_ctx, int node)
+{
+	if (node < 0)
+	{
+		return 0;
+	}
+	for (int i = 0 ; i < dev_ctx->num_comp_vectors ; ++i)
+	{
+		if (get_comp_vector_node(dev_ctx, i) == node)
+		{
+			log_msg("[NUMA] Using completion vector %d (node %d)", i, node);
+			return i;
+		}
+	}
+	log_msg("[NUMA] WARNING: no completion vector of %d is served by node %d, using vector 0 (node %d)", dev_ctx->num_comp_vectors, node, get_comp_vector_node(dev_ctx, 0));
+	return 0;
+}
+
+void check_memory_placement(const char* what, void* addr)
+{
+	if (placement_node < 0)
+	{
+		return;
+	}
+	int node = -1;
+	if (0 != get_mempolicy(&node, NULL, 0, addr, MPOL_F_NODE | MPOL_F_ADDR))
+	{
+		log_msg("[NUMA] Failed to query node of %s at %p! errno = %s", what, addr, strerror(errno));
+		return;
+	}
+	if (node != placement_node)
+	{
+		log_msg("[NUMA] WARNING: %s at %p resides on node %d but the device is on node %d", what, addr, node, placement_node);
+	}
+}
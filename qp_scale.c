@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "qp_scale.h"
+#include "latency_measure.h"
+#include "verbs_wrappers.h"
+#include "numa_placement.h"
+#include "transport.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "stats.h"
+#include "memutils.h"
+#include "logging.h"
+
+// Completions taken per poll by the sweeper.
+#define QP_SCALE_POLL_BATCH 64
+#define QP_SCALE_MAX_STEPS 64
+
+static uint32_t max_qps = 0;
+static uint32_t step_ms = QP_SCALE_DEFAULT_STEP_MS;
+static volatile int keep_running = 1;
+
+struct QpScale
+{
+	ClientLane* lane;
+	struct ibv_cq* cq;
+	struct ibv_qp** qps;
+	uint32_t number_of_qps;
+	QpBatch* peer_info;
+	// Sweeper state, shared with the thread running the steps.
+	pthread_t sweeper;
+	int running;
+	uint32_t active;
+	uint64_t reads;
+};
+
+struct QpScaleServer
+{
+	struct ibv_cq* cq;
+	struct ibv_qp** qps;
+	uint32_t number_of_qps;
+};
+
+// The results of one step.
+typedef struct
+{
+	uint32_t active;
+	RunningStats latency;
+	Histogram latency_ns;
+	double reads_per_sec;
+} QpScaleStep;
+
+void configure_qp_scale(const char* spec)
+{
+	char* end = NULL;
+	max_qps = strtoul(spec, &end, 10);
+	if (':' == *end)
+	{
+		step_ms = strtoul(end + 1, &end, 10);
+	}
+	if ('\0' != *end || 0 == max_qps || max_qps > QP_SCALE_MAX_QPS || 0 == step_ms)
+	{
+		log_msg("Bad QP scale %s: expected max_qps[:step_ms] with 1-%u QPs", spec, QP_SCALE_MAX_QPS);
+		exit(-1);
+	}
+	log_msg("QP scale: up to %u QPs, %u ms per step", max_qps, step_ms);
+}
+
+uint32_t qp_scale_requested_qps(void)
+{
+	return max_qps;
+}
+
+// Both sides create the same QPs: at most QP_SCALE_WINDOW reads are ever in flight on one, so their
+// queues are as small as they get, to fit thousands of them.
+static struct ibv_qp** create_scale_qps(struct ibv_pd* pd, struct ibv_cq* cq, uint32_t number_of_qps)
+{
+	struct ibv_qp** qps = do_malloc(number_of_qps * sizeof(*qps));
+	struct ibv_qp_init_attr attr = create_qp_init_attr(cq);
+	attr.cap.max_send_wr = QP_SCALE_WINDOW;
+	attr.cap.max_recv_wr = 1;
+	attr.cap.max_send_sge = 1;
+	attr.cap.max_recv_sge = 1;
+	attr.cap.max_inline_data = 0;
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		qps[i] = create_qp(pd, &attr);
+	}
+	return qps;
+}
+
+static void connect_scale_qps(struct ibv_qp** qps, uint32_t number_of_qps, const QpBatch* peer_info, uint8_t port_num)
+{
+	if (peer_info->number_of_qps != number_of_qps)
+	{
+		log_msg("Peer brought up %u scale QPs instead of %u! leaving...", peer_info->number_of_qps, number_of_qps);
+		exit(-1);
+	}
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		setup_qp(peer_info->qp_nums[i], peer_info->port_lid, port_num, qps[i]);
+	}
+	log_msg("[QP scale] %u QPs are connected", number_of_qps);
+}
+
+static void destroy_scale_qps(struct ibv_qp** qps, uint32_t number_of_qps)
+{
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		destroy_qp(qps[i]);
+	}
+	free(qps);
+}
+
+QpScale* qp_scale_connect(ClientConnection* conn, uint32_t number_of_qps)
+{
+	QpScale* scale = do_malloc(sizeof(*scale));
+	memset(scale, 0, sizeof(*scale));
+	scale->lane = &conn->lanes[0];
+	scale->number_of_qps = number_of_qps;
+	scale->peer_info = receive_qp_batch_from_peer(conn->sock);
+	ClientLane* lane = scale->lane;
+	scale->cq = create_cq(lane->dev_ctx, number_of_qps * QP_SCALE_WINDOW + 1, NULL, NULL, select_comp_vector(lane->dev_ctx, get_placement_node()));
+	scale->qps = create_scale_qps(lane->pd, scale->cq, number_of_qps);
+	send_qp_batch_to_peer(conn->sock, scale->qps, number_of_qps, lane->dev_ctx, lane->endpoint.port, 0);
+	connect_scale_qps(scale->qps, number_of_qps, scale->peer_info, lane->endpoint.port);
+	return scale;
+}
+
+void qp_scale_disconnect(QpScale* scale)
+{
+	if (NULL == scale)
+	{
+		return;
+	}
+	destroy_scale_qps(scale->qps, scale->number_of_qps);
+	destroy_cq(scale->cq);
+	free(scale->peer_info);
+	free(scale);
+}
+
+QpScaleServer* qp_scale_server_create(int sock, struct ibv_context* dev_ctx, struct ibv_pd* pd, uint8_t port_num, uint32_t number_of_qps)
+{
+	if (number_of_qps > QP_SCALE_MAX_QPS)
+	{
+		log_msg("Peer asked for %u scale QPs, at most %u are supported! leaving...", number_of_qps, QP_SCALE_MAX_QPS);
+		exit(-1);
+	}
+	QpScaleServer* server = do_malloc(sizeof(*server));
+	server->number_of_qps = number_of_qps;
+	// The server's QPs only answer reads, which complete nothing on its side.
+	server->cq = create_cq(dev_ctx, 1, NULL, NULL, 0);
+	server->qps = create_scale_qps(pd, server->cq, number_of_qps);
+	send_qp_batch_to_peer(sock, server->qps, number_of_qps, dev_ctx, port_num, 0);
+	QpBatch* peer_info = receive_qp_batch_from_peer(sock);
+	connect_scale_qps(server->qps, number_of_qps, peer_info, port_num);
+	free(peer_info);
+	return server;
+}
+
+void qp_scale_server_destroy(QpScaleServer* server)
+{
+	if (NULL == server)
+	{
+		return;
+	}
+	destroy_scale_qps(server->qps, server->number_of_qps);
+	destroy_cq(server->cq);
+	free(server);
+}
+
+static uint64_t mono_now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / 1000000000,
+		.tv_nsec = deadline % 1000000000
+	};
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) && keep_running);
+}
+
+// Reads the first byte of the server's first region: the same page from every QP.
+static void post_read(QpScale* scale, uint32_t qp_idx)
+{
+	ClientLane* lane = scale->lane;
+	struct ibv_sge sge = {
+		.addr = (uint64_t)lane->buf,
+		.length = 1,
+		.lkey = lane->mr->lkey
+	};
+	struct ibv_send_wr wr = {
+		.wr_id = qp_idx,
+		.next = NULL,
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = IBV_WR_RDMA_READ,
+		.send_flags = IBV_SEND_SIGNALED,
+		.wr.rdma.remote_addr = lane->peer_info->mrs[0].remote_addr,
+		.wr.rdma.rkey = lane->peer_info->mrs[0].rkey
+	};
+	do_post_send(scale->qps[qp_idx], &wr, 1);
+}
+
+// Keeps QP_SCALE_WINDOW reads in flight on each active QP: every completion is replaced by a read
+// on the same QP, so the QPs take turns in the order the NIC completes them. Once stopped, drains.
+static void* sweep(void* arg)
+{
+	QpScale* scale = arg;
+	pin_thread_to_node(get_placement_node());
+	metrics_register_thread("qp_scale");
+	uint32_t started = 0;
+	uint64_t in_flight = 0;
+	struct ibv_wc wc[QP_SCALE_POLL_BATCH];
+	int running;
+	while ((running = __atomic_load_n(&scale->running, __ATOMIC_ACQUIRE)) || 0 != in_flight)
+	{
+		uint32_t active = running ? __atomic_load_n(&scale->active, __ATOMIC_ACQUIRE) : 0;
+		for ( ; started < active ; ++started)
+		{
+			for (uint32_t w = 0 ; w < QP_SCALE_WINDOW ; ++w)
+			{
+				post_read(scale, started);
+				++in_flight;
+			}
+		}
+		int ne = do_cq_poll(scale->qps[0], wc, QP_SCALE_POLL_BATCH);
+		for (int i = 0 ; i < ne ; ++i)
+		{
+			--in_flight;
+			if (wc[i].wr_id < active)
+			{
+				post_read(scale, wc[i].wr_id);
+				++in_flight;
+			}
+		}
+		__atomic_store_n(&scale->reads, scale->reads + ne, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void sigint_handler(int value)
+{
+	keep_running = 0;
+}
+
+// Probes the lane's latency for one step.
+static void run_step(ClientLane* lane, QpScale* scale, QpScaleStep* step)
+{
+	__atomic_store_n(&scale->active, step->active, __ATOMIC_RELEASE);
+	timeline_record("qp_scale", "active_qps", step->active);
+	uint64_t start = mono_now_ns();
+	uint64_t reads_before = __atomic_load_n(&scale->reads, __ATOMIC_RELAXED);
+	uint64_t end = start + (uint64_t)step_ms * 1000000;
+	uint64_t next = start;
+	uint64_t now = start;
+	while (keep_running && now < end)
+	{
+		uint64_t ns = latency_probe(lane->qp, lane->peer_info, lane->buf, lane->mr->lkey);
+		histogram_record(&thread_metrics->latency_ns, ns);
+		histogram_record(&step->latency_ns, ns);
+		running_stats_add(&step->latency, ns);
+		timeline_record_at(timeline_now_ns(), "qp_scale", "probe_us", ns / 1000.0);
+		next += (uint64_t)QP_SCALE_PROBE_INTERVAL_US * 1000;
+		now = mono_now_ns();
+		if (next < now)
+		{
+			next = now;
+		}
+		sleep_until_ns(next);
+		now = mono_now_ns();
+	}
+	step->reads_per_sec = (__atomic_load_n(&scale->reads, __ATOMIC_RELAXED) - reads_before) * 1e9 / (now - start);
+	log_msg("[QP scale] %6u active QPs: latency = %9.3f us +- %7.3f (95%% CI), p50 = %9.3f us, p99 = %9.3f us, sweep = %12.0f reads/s",
+		step->active, step->latency.mean / 1000, running_stats_ci95(&step->latency) / 1000,
+		histogram_percentile(&step->latency_ns, 0.5) / 1000.0, histogram_percentile(&step->latency_ns, 0.99) / 1000.0, step->reads_per_sec);
+}
+
+// How many times the median latency grew from the previous step. 0 if the previous step has no
+// median to compare to, e.g. when none of its reads completed before SIGINT.
+static double median_rise(const QpScaleStep* steps, uint32_t i)
+{
+	uint64_t baseline = histogram_percentile(&steps[i - 1].latency_ns, 0.5);
+	if (0 == baseline)
+	{
+		return 0;
+	}
+	return (double)histogram_percentile(&steps[i].latency_ns, 0.5) / baseline;
+}
+
+// Where the curve breaks: the steepest rise of the median latency between two steps, a cliff if the
+// median grew at least QP_SCALE_CLIFF_RATIO times there.
+static void report_cliff(const QpScaleStep* steps, uint32_t number_of_steps)
+{
+	if (number_of_steps < 2)
+	{
+		return;
+	}
+	uint32_t steepest = 1;
+	for (uint32_t i = 2 ; i < number_of_steps ; ++i)
+	{
+		if (median_rise(steps, i) > median_rise(steps, steepest))
+		{
+			steepest = i;
+		}
+	}
+	const QpScaleStep* before = &steps[steepest - 1];
+	const QpScaleStep* after = &steps[steepest];
+	log_msg("[QP scale] %s: %u -> %u active QPs, median latency %.3f -> %.3f us (x%.2f), sweep throughput x%.2f",
+		(median_rise(steps, steepest) >= QP_SCALE_CLIFF_RATIO) ? "Cliff" : "No cliff, steepest rise",
+		before->active, after->active, histogram_percentile(&before->latency_ns, 0.5) / 1000.0,
+		histogram_percentile(&after->latency_ns, 0.5) / 1000.0, median_rise(steps, steepest),
+		(0 != before->reads_per_sec) ? after->reads_per_sec / before->reads_per_sec : 0);
+}
+
+void logic_qp_scale(ClientConnection* conn)
+{
+	__sighandler_t prev = signal(SIGINT, sigint_handler);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+	QpScale* scale = conn->qp_scale;
+	metrics_register_thread("latency");
+
+	// 1, 2, 4... active QPs, and all of them last.
+	QpScaleStep* steps = do_malloc(QP_SCALE_MAX_STEPS * sizeof(*steps));
+	uint32_t number_of_steps = 0;
+	for (uint32_t active = 1 ; ; active *= 2)
+	{
+		memset(&steps[number_of_steps], 0, sizeof(steps[number_of_steps]));
+		histogram_reset(&steps[number_of_steps].latency_ns);
+		steps[number_of_steps++].active = (active < scale->number_of_qps) ? active : scale->number_of_qps;
+		if (active >= scale->number_of_qps)
+		{
+			break;
+		}
+	}
+	log_msg("[QP scale] %u steps of %u ms, up to %u active QPs, use Ctrl+C (SIGINT) to stop early...", number_of_steps, step_ms, scale->number_of_qps);
+
+	scale->running = 1;
+	scale->active = 0;
+	int ans = pthread_create(&scale->sweeper, NULL, sweep, scale);
+	if (0 != ans)
+	{
+		log_msg("Failed to create the sweeper thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+	uint32_t done = 0;
+	for ( ; done < number_of_steps && keep_running ; ++done)
+	{
+		run_step(&conn->lanes[0], scale, &steps[done]);
+	}
+	__atomic_store_n(&scale->running, 0, __ATOMIC_RELEASE);
+	pthread_join(scale->sweeper, NULL);
+
+	report_cliff(steps, done);
+	free(steps);
+	prev = signal(SIGINT, prev);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+}
@@ -0,0 +1,196 @@
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "replay.h"
+#include "trace.h"
+#include "verbs_wrappers.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "stats.h"
+#include "memutils.h"
+
+#define REPLAY_POLL_BATCH 32
+// Waits longer than this are slept through (minus this much), shorter ones are spun on the CQ.
+#define REPLAY_SPIN_NS 50000
+
+static const char* replay_trace_path = NULL;
+static int replay_as_fast_as_possible = 0;
+static volatile int keep_running = 1;
+
+static void sigint_handler(int value)
+{
+	keep_running = 0;
+}
+
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void configure_replay(const char* trace_path, int as_fast_as_possible)
+{
+	replay_trace_path = trace_path;
+	replay_as_fast_as_possible = as_fast_as_possible;
+}
+
+// Checks a record against the server's regions, just before it is issued, so the trace is only
+// read once, as it streams through the replay.
+static void validate_record(const TraceRecord* record, uint64_t i, ConnectionInfoExchange* peer_info)
+{
+	if (record->region_index >= peer_info->header.number_of_mrs)
+	{
+		log_msg("[Replay] Record %" PRIu64 " targets region %u but the server has %u regions", i, record->region_index, peer_info->header.number_of_mrs);
+		exit(-1);
+	}
+	uint64_t region_size = peer_info->mrs[record->region_index].size_in_bytes;
+	if (record->offset > region_size || record->size > region_size - record->offset)
+	{
+		log_msg("[Replay] Record %" PRIu64 " (offset %" PRIu64 ", size %u) overflows region %u of %u bytes", i, record->offset, record->size, record->region_index, peer_info->mrs[record->region_index].size_in_bytes);
+		exit(-1);
+	}
+	if (TRACE_OP_READ != record->opcode && TRACE_OP_WRITE != record->opcode)
+	{
+		log_msg("[Replay] Record %" PRIu64 " has an unknown opcode %u", i, record->opcode);
+		exit(-1);
+	}
+}
+
+// Reaps whatever completed and records the latency of each operation. Returns the number of completions.
+static int reap_completions(struct ibv_qp* qp, const uint64_t* issue_ns)
+{
+	struct ibv_wc wc[REPLAY_POLL_BATCH];
+	int ne = do_cq_poll(qp, wc, REPLAY_POLL_BATCH);
+	if (0 == ne)
+	{
+		return 0;
+	}
+	uint64_t now = monotonic_ns();
+	for (int i = 0 ; i < ne ; ++i)
+	{
+		histogram_record(&thread_metrics->latency_ns, now - issue_ns[wc[i].wr_id % QP_MAX_SEND_WR]);
+	}
+	return ne;
+}
+
+void logic_replay(ClientConnection* conn)
+{
+	struct ibv_qp* qp = conn->lanes[0].qp;
+	ConnectionInfoExchange* peer_info = conn->lanes[0].peer_info;
+	Trace trace;
+	map_trace(replay_trace_path, &trace);
+	uint64_t number_of_records = trace.header->number_of_records;
+	log_msg("[Replay] %" PRIu64 " records from %s, %s", number_of_records, replay_trace_path, replay_as_fast_as_possible ? "as fast as possible" : "with the recorded timing");
+
+	// The connection's buffer holds a single byte, the trace may need up to a whole region.
+	uint32_t buf_size = 1;
+	for (uint32_t r = 0 ; r < peer_info->header.number_of_mrs ; ++r)
+	{
+		if (peer_info->mrs[r].size_in_bytes > buf_size)
+		{
+			buf_size = peer_info->mrs[r].size_in_bytes;
+		}
+	}
+	void* buf = alloc_mr(buf_size);
+	struct ibv_mr* mr = register_mr(qp->pd, buf, buf_size, IBV_ACCESS_LOCAL_WRITE);
+
+	__sighandler_t prev = signal(SIGINT, sigint_handler);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+	metrics_register_thread("replay");
+
+	// Issue time of every in flight operation, indexed by wr_id (the record number) modulo the send queue depth.
+	uint64_t* issue_ns = do_malloc(QP_MAX_SEND_WR * sizeof(uint64_t));
+	uint32_t outstanding = 0;
+	RunningStats lateness;
+	memset(&lateness, 0, sizeof(lateness));
+	uint64_t max_lateness_ns = 0;
+
+	uint64_t start = monotonic_ns();
+	uint64_t due = start;
+	uint64_t last_report = start;
+	uint64_t ops_since_report = 0;
+	uint64_t i = 0;
+	for ( ; i < number_of_records && keep_running ; ++i)
+	{
+		const TraceRecord* record = &trace.records[i];
+		validate_record(record, i, peer_info);
+		uint64_t now = monotonic_ns();
+		if (!replay_as_fast_as_possible)
+		{
+			due += record->inter_arrival_ns;
+			if (0 == outstanding && due > now + 2 * REPLAY_SPIN_NS)
+			{
+				struct timespec ts = { .tv_sec = 0, .tv_nsec = due - now - REPLAY_SPIN_NS };
+				ts.tv_sec = ts.tv_nsec / 1000000000;
+				ts.tv_nsec %= 1000000000;
+				nanosleep(&ts, NULL);
+				now = monotonic_ns();
+			}
+			while (now < due)
+			{
+				outstanding -= reap_completions(qp, issue_ns);
+				now = monotonic_ns();
+			}
+		}
+		while (outstanding == QP_MAX_SEND_WR)
+		{
+			outstanding -= reap_completions(qp, issue_ns);
+			now = monotonic_ns();
+		}
+		if (!replay_as_fast_as_possible)
+		{
+			running_stats_add(&lateness, now - due);
+			if (now - due > max_lateness_ns)
+			{
+				max_lateness_ns = now - due;
+			}
+		}
+
+		issue_ns[i % QP_MAX_SEND_WR] = now;
+		MrEntry* remote = &peer_info->mrs[record->region_index];
+		do_rdma_op(TRACE_OP_WRITE == record->opcode ? IBV_WR_RDMA_WRITE : IBV_WR_RDMA_READ, i,
+				(void*)(remote->remote_addr + record->offset), buf, remote->rkey, mr->lkey, record->size, qp);
+		++outstanding;
+		++ops_since_report;
+
+		if (now - last_report >= 1000000000)
+		{
+			timeline_record("replay", "ops_per_sec", ops_since_report * 1e9 / (now - last_report));
+			last_report = now;
+			ops_since_report = 0;
+		}
+	}
+	while (outstanding > 0)
+	{
+		outstanding -= reap_completions(qp, issue_ns);
+	}
+	uint64_t elapsed = monotonic_ns() - start;
+
+	Histogram latency;
+	histogram_snapshot(&thread_metrics->latency_ns, &latency);
+	log_msg("[Replay] Issued %" PRIu64 " of %" PRIu64 " records in %.3f seconds (%.0f ops/s)", i, number_of_records, elapsed / 1e9, i * 1e9 / elapsed);
+	log_msg("[Replay] Latency: mean %.2f us, p50 %.2f us, p99 %.2f us, max %.2f us", histogram_mean(&latency) / 1000, histogram_percentile(&latency, 0.5) / 1000.0, histogram_percentile(&latency, 0.99) / 1000.0, latency.max / 1000.0);
+	if (!replay_as_fast_as_possible)
+	{
+		log_msg("[Replay] Issue lateness: mean %.2f us, max %.2f us", lateness.mean / 1000, max_lateness_ns / 1000.0);
+	}
+
+	prev = signal(SIGINT, prev);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+	free(issue_ns);
+	dereg_mr(mr);
+	free_mr(buf, buf_size);
+	unmap_trace(&trace);
+}
@@ -0,0 +1,821 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/utsname.h>
+
+#include "results.h"
+#include "metrics.h"
+#include "histogram.h"
+#include "transport.h"
+#include "memutils.h"
+#include "logging.h"
+
+#define RESULTS_DEVICE_LEN 512
+
+// The cumulative ops of every registered thread at one point in time.
+typedef struct
+{
+	uint64_t time_ns;
+	uint64_t ops[METRICS_MAX_THREADS];
+} OpsSample;
+
+// The threads of one role, merged.
+typedef struct
+{
+	char role[METRICS_ROLE_LEN];
+	uint32_t threads;
+	uint64_t ops;
+	uint64_t errors;
+	uint64_t completions;
+	uint64_t alarms;
+	Histogram latency_ns;
+	uint8_t members[METRICS_MAX_THREADS];
+} RoleResults;
+
+static const char* results_path = NULL;
+static char* command = NULL;
+static uint64_t started_ns = 0;
+static char devices[RESULTS_MAX_DEVICES][RESULTS_DEVICE_LEN];
+static uint32_t number_of_devices = 0;
+
+static OpsSample* samples = NULL;
+static uint32_t number_of_samples = 0;
+static uint32_t samples_capacity = 0;
+static ThreadMetrics snap[METRICS_MAX_THREADS];
+static RoleResults roles[METRICS_MAX_THREADS];
+
+static pthread_t sampler;
+static pthread_mutex_t sampler_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sampler_wakeup;
+static int sampling = 0;
+
+static uint64_t mono_now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void take_sample()
+{
+	if (number_of_samples == samples_capacity)
+	{
+		samples_capacity = (0 == samples_capacity) ? 64 : samples_capacity * 2;
+		samples = realloc(samples, samples_capacity * sizeof(*samples));
+		if (NULL == samples)
+		{
+			log_msg("[Results] Failed to realloc! leaving...");
+			exit(-1);
+		}
+	}
+	OpsSample* sample = &samples[number_of_samples++];
+	memset(sample, 0, sizeof(*sample));
+	uint32_t n = metrics_snapshot(snap);
+	sample->time_ns = mono_now_ns();
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		sample->ops[i] = snap[i].ops;
+	}
+}
+
+static void* sample_throughput(void* arg)
+{
+	pthread_mutex_lock(&sampler_lock);
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while (sampling)
+	{
+		deadline.tv_nsec += (RESULTS_INTERVAL_MS % 1000) * 1000000;
+		deadline.tv_sec += RESULTS_INTERVAL_MS / 1000 + deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+		while (sampling && ETIMEDOUT != pthread_cond_timedwait(&sampler_wakeup, &sampler_lock, &deadline));
+		take_sample();
+	}
+	pthread_mutex_unlock(&sampler_lock);
+	return NULL;
+}
+
+void open_results(const char* path, int argc, char** argv)
+{
+	results_path = path;
+	size_t len = 1;
+	for (int i = 0 ; i < argc ; ++i)
+	{
+		len += strlen(argv[i]) + 1;
+	}
+	command = do_malloc(len);
+	command[0] = '\0';
+	for (int i = 0 ; i < argc ; ++i)
+	{
+		strcat(command, argv[i]);
+		if (i + 1 < argc)
+		{
+			strcat(command, " ");
+		}
+	}
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	started_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sampler_wakeup, &attr);
+	pthread_condattr_destroy(&attr);
+	sampling = 1;
+	take_sample();
+	int ans = pthread_create(&sampler, NULL, sample_throughput, NULL);
+	if (0 != ans)
+	{
+		log_msg("[Results] Failed to create the sampler thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+	log_msg("[Results] Writing the results to %s at the end of the run", path);
+}
+
+// The kernel driver bound to the device, from sysfs ("none" for devices without one, e.g. the mock's).
+static void get_driver(const char* dev_name, char* driver, size_t len)
+{
+	char path[PATH_MAX];
+	char target[PATH_MAX];
+	snprintf(path, sizeof(path), "/sys/class/infiniband/%s/device/driver", dev_name);
+	ssize_t n = readlink(path, target, sizeof(target) - 1);
+	if (n <= 0)
+	{
+		snprintf(driver, len, "none");
+		return;
+	}
+	target[n] = '\0';
+	char* base = strrchr(target, '/');
+	snprintf(driver, len, "%s", (NULL == base) ? target : base + 1);
+}
+
+void results_add_device(struct ibv_context* dev_ctx, uint8_t port_num)
+{
+	if (NULL == results_path)
+	{
+		return;
+	}
+	const char* dev_name = transport->get_device_name(dev_ctx->device);
+	char prefix[RESULTS_DEVICE_LEN];
+	snprintf(prefix, sizeof(prefix), "%s port %hhu ", dev_name, port_num);
+	for (uint32_t i = 0 ; i < number_of_devices ; ++i)
+	{
+		if (0 == strncmp(devices[i], prefix, strlen(prefix)))
+		{
+			return;
+		}
+	}
+	if (RESULTS_MAX_DEVICES == number_of_devices)
+	{
+		log_msg("[Results] More than %d devices, not describing %s", RESULTS_MAX_DEVICES, dev_name);
+		return;
+	}
+	struct ibv_device_attr device_attr;
+	if (0 != transport->query_device(dev_ctx, &device_attr))
+	{
+		log_msg("[Results] ibv_query_device failed for %s! leaving...", dev_name);
+		exit(-1);
+	}
+	struct ibv_port_attr port_attr;
+	if (0 != transport->query_port(dev_ctx, port_num, &port_attr))
+	{
+		log_msg("[Results] ibv_query_port failed for %s port %hhu! leaving...", dev_name, port_num);
+		exit(-1);
+	}
+	char driver[NAME_MAX];
+	get_driver(dev_name, driver, sizeof(driver));
+	snprintf(devices[number_of_devices++], RESULTS_DEVICE_LEN, "%sfw %s driver %s vendor 0x%x part %u hw %u mtu %u width %hhu speed %hhu",
+		prefix, ('\0' == device_attr.fw_ver[0]) ? "unknown" : device_attr.fw_ver, driver, device_attr.vendor_id, device_attr.vendor_part_id,
+		device_attr.hw_ver, (0 == port_attr.active_mtu) ? 0 : 128 << port_attr.active_mtu, port_attr.active_width, port_attr.active_speed);
+}
+
+static void write_host(FILE* f)
+{
+	char hostname[HOST_NAME_MAX + 1];
+	if (0 != gethostname(hostname, sizeof(hostname)))
+	{
+		snprintf(hostname, sizeof(hostname), "unknown");
+	}
+	fprintf(f, "host name %s\n", hostname);
+	struct utsname uts;
+	if (0 == uname(&uts))
+	{
+		fprintf(f, "host kernel %s %s %s %s\n", uts.sysname, uts.release, uts.version, uts.machine);
+	}
+	fprintf(f, "host cpus %ld\n", sysconf(_SC_NPROCESSORS_ONLN));
+	FILE* cpuinfo = fopen("/proc/cpuinfo", "r");
+	char line[1024];
+	while (NULL != cpuinfo && NULL != fgets(line, sizeof(line), cpuinfo))
+	{
+		char* value = strchr(line, ':');
+		if (0 == strncmp(line, "model name", strlen("model name")) && NULL != value)
+		{
+			fprintf(f, "host cpu_model %s", value + 2);
+			break;
+		}
+	}
+	if (NULL != cpuinfo)
+	{
+		fclose(cpuinfo);
+	}
+}
+
+// Merges the threads of each role. Returns the number of roles.
+static uint32_t merge_roles(uint32_t number_of_threads)
+{
+	uint32_t number_of_roles = 0;
+	memset(roles, 0, sizeof(roles));
+	for (uint32_t i = 0 ; i < number_of_threads ; ++i)
+	{
+		uint32_t r = 0;
+		while (r < number_of_roles && 0 != strcmp(roles[r].role, snap[i].role))
+		{
+			++r;
+		}
+		if (r == number_of_roles)
+		{
+			memcpy(roles[r].role, snap[i].role, sizeof(roles[r].role));
+			++number_of_roles;
+		}
+		RoleResults* role = &roles[r];
+		++role->threads;
+		role->ops += snap[i].ops;
+		role->errors += snap[i].errors;
+		role->completions += snap[i].completions;
+		role->alarms += snap[i].alarms;
+		histogram_merge(&role->latency_ns, &snap[i].latency_ns);
+		role->members[i] = 1;
+	}
+	return number_of_roles;
+}
+
+// The role's throughput per interval, from its first busy interval to its last one. A last interval
+// shorter than half of RESULTS_INTERVAL_MS (the run ended during it) is left out.
+static void write_throughput(FILE* f, const RoleResults* role)
+{
+	double* rates = do_malloc(number_of_samples * sizeof(*rates));
+	uint32_t number_of_rates = 0;
+	uint32_t first_busy = number_of_samples;
+	uint32_t last_busy = 0;
+	for (uint32_t k = 1 ; k < number_of_samples ; ++k)
+	{
+		uint64_t elapsed_ns = samples[k].time_ns - samples[k - 1].time_ns;
+		if (elapsed_ns < (uint64_t)RESULTS_INTERVAL_MS * 500000)
+		{
+			continue;
+		}
+		uint64_t ops = 0;
+		for (uint32_t i = 0 ; i < METRICS_MAX_THREADS ; ++i)
+		{
+			if (role->members[i])
+			{
+				ops += samples[k].ops[i] - samples[k - 1].ops[i];
+			}
+		}
+		if (0 != ops)
+		{
+			first_busy = (first_busy < number_of_rates) ? first_busy : number_of_rates;
+			last_busy = number_of_rates;
+		}
+		rates[number_of_rates++] = ops * 1e9 / elapsed_ns;
+	}
+	fprintf(f, "throughput %s %u", role->role, RESULTS_INTERVAL_MS);
+	for (uint32_t k = first_busy ; k <= last_busy && k < number_of_rates ; ++k)
+	{
+		fprintf(f, " %.1f", rates[k]);
+	}
+	fprintf(f, "\n");
+	free(rates);
+}
+
+void close_results()
+{
+	if (NULL == results_path)
+	{
+		return;
+	}
+	pthread_mutex_lock(&sampler_lock);
+	sampling = 0;
+	pthread_cond_signal(&sampler_wakeup);
+	pthread_mutex_unlock(&sampler_lock);
+	pthread_join(sampler, NULL);
+	take_sample();
+
+	FILE* f = fopen(results_path, "w");
+	if (NULL == f)
+	{
+		log_msg("[Results] Failed to open %s! errno = %s", results_path, strerror(errno));
+		exit(-1);
+	}
+	fprintf(f, "results %d\n", RESULTS_VERSION);
+	fprintf(f, "command %s\n", command);
+	fprintf(f, "started_ns %" PRIu64 "\n", started_ns);
+	fprintf(f, "duration_ns %" PRIu64 "\n", samples[number_of_samples - 1].time_ns - samples[0].time_ns);
+	write_host(f);
+	fprintf(f, "transport %s\n", transport->name);
+	for (uint32_t i = 0 ; i < number_of_devices ; ++i)
+	{
+		fprintf(f, "device %s\n", devices[i]);
+	}
+	uint32_t number_of_roles = merge_roles(metrics_snapshot(snap));
+	for (uint32_t r = 0 ; r < number_of_roles ; ++r)
+	{
+		RoleResults* role = &roles[r];
+		fprintf(f, "role %s threads %u ops %" PRIu64 " errors %" PRIu64 " completions %" PRIu64 " alarms %" PRIu64 "\n",
+			role->role, role->threads, role->ops, role->errors, role->completions, role->alarms);
+		write_throughput(f, role);
+		fprintf(f, "histogram %s %" PRIu64 " %" PRIu64 " %" PRIu64, role->role, role->latency_ns.count, role->latency_ns.sum, role->latency_ns.max);
+		for (uint32_t b = 0 ; b < HISTOGRAM_BUCKETS ; ++b)
+		{
+			if (0 != role->latency_ns.buckets[b])
+			{
+				fprintf(f, " %u:%" PRIu64, b, role->latency_ns.buckets[b]);
+			}
+		}
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	log_msg("[Results] Wrote %u roles to %s", number_of_roles, results_path);
+	free(samples);
+	samples = NULL;
+	number_of_samples = samples_capacity = 0;
+	free(command);
+	results_path = NULL;
+}
+
+// One role of a results file being compared.
+typedef struct
+{
+	char role[METRICS_ROLE_LEN];
+	int has_histogram;
+	Histogram latency_ns;
+	double* rates;
+	uint32_t number_of_rates;
+} RunRole;
+
+typedef struct
+{
+	const char* path;
+	// The command, host, transport and device records, to show how the runs differ.
+	char** context;
+	uint32_t number_of_context;
+	RunRole roles[METRICS_MAX_THREADS];
+	uint32_t number_of_roles;
+} Run;
+
+static RunRole* find_role(Run* run, const char* name, int create)
+{
+	for (uint32_t r = 0 ; r < run->number_of_roles ; ++r)
+	{
+		if (0 == strcmp(run->roles[r].role, name))
+		{
+			return &run->roles[r];
+		}
+	}
+	if (!create)
+	{
+		return NULL;
+	}
+	if (METRICS_MAX_THREADS == run->number_of_roles)
+	{
+		log_msg("[Compare] %s has more than %d roles! leaving...", run->path, METRICS_MAX_THREADS);
+		exit(-1);
+	}
+	RunRole* role = &run->roles[run->number_of_roles++];
+	snprintf(role->role, sizeof(role->role), "%s", name);
+	return role;
+}
+
+static void parse_histogram(Run* run, char* fields, unsigned long line_number)
+{
+	char name[METRICS_ROLE_LEN];
+	int consumed = 0;
+	uint64_t count, sum, max;
+	if (4 != sscanf(fields, "%31s %" SCNu64 " %" SCNu64 " %" SCNu64 "%n", name, &count, &sum, &max, &consumed))
+	{
+		log_msg("[Compare] %s:%lu: bad histogram! leaving...", run->path, line_number);
+		exit(-1);
+	}
+	RunRole* role = find_role(run, name, 1);
+	if (role->has_histogram)
+	{
+		log_msg("[Compare] %s:%lu: duplicate histogram of %s! leaving...", run->path, line_number, name);
+		exit(-1);
+	}
+	role->has_histogram = 1;
+	Histogram* h = &role->latency_ns;
+	h->count = count;
+	h->sum = sum;
+	h->max = max;
+	char* p = fields + consumed;
+	while (1)
+	{
+		char* end = NULL;
+		unsigned long bucket = strtoul(p, &end, 10);
+		if (end == p)
+		{
+			break;
+		}
+		if (':' != *end || bucket >= HISTOGRAM_BUCKETS)
+		{
+			log_msg("[Compare] %s:%lu: bad histogram bucket! leaving...", run->path, line_number);
+			exit(-1);
+		}
+		p = end + 1;
+		h->buckets[bucket] = strtoull(p, &end, 10);
+		p = end;
+	}
+}
+
+static void parse_throughput(Run* run, char* fields, unsigned long line_number)
+{
+	char name[METRICS_ROLE_LEN];
+	int consumed = 0;
+	unsigned interval_ms;
+	if (2 != sscanf(fields, "%31s %u%n", name, &interval_ms, &consumed))
+	{
+		log_msg("[Compare] %s:%lu: bad throughput! leaving...", run->path, line_number);
+		exit(-1);
+	}
+	RunRole* role = find_role(run, name, 1);
+	if (NULL != role->rates)
+	{
+		log_msg("[Compare] %s:%lu: duplicate throughput of %s! leaving...", run->path, line_number, name);
+		exit(-1);
+	}
+	// Every rate takes at least two characters.
+	role->rates = do_malloc((strlen(fields) / 2 + 1) * sizeof(*role->rates));
+	char* p = fields + consumed;
+	while (1)
+	{
+		char* end = NULL;
+		double rate = strtod(p, &end);
+		if (end == p)
+		{
+			break;
+		}
+		role->rates[role->number_of_rates++] = rate;
+		p = end;
+	}
+}
+
+static Run* load_run(const char* path)
+{
+	FILE* f = fopen(path, "r");
+	if (NULL == f)
+	{
+		log_msg("[Compare] Failed to open %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	Run* run = do_malloc(sizeof(*run));
+	memset(run, 0, sizeof(*run));
+	run->path = path;
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t len;
+	unsigned long line_number = 0;
+	while ((len = getline(&line, &capacity, f)) > 0)
+	{
+		++line_number;
+		if ('\n' == line[len - 1])
+		{
+			line[--len] = '\0';
+		}
+		char* fields = strchr(line, ' ');
+		fields = (NULL == fields) ? line + len : fields + 1;
+		int version;
+		if (1 == line_number && (1 != sscanf(line, "results %d", &version) || RESULTS_VERSION != version))
+		{
+			log_msg("[Compare] %s is not a version %d results file! leaving...", path, RESULTS_VERSION);
+			exit(-1);
+		}
+		if (0 == strncmp(line, "histogram ", strlen("histogram ")))
+		{
+			parse_histogram(run, fields, line_number);
+		}
+		else if (0 == strncmp(line, "throughput ", strlen("throughput ")))
+		{
+			parse_throughput(run, fields, line_number);
+		}
+		else if (0 == strncmp(line, "command ", strlen("command ")) || 0 == strncmp(line, "host ", strlen("host ")) ||
+			0 == strncmp(line, "transport ", strlen("transport ")) || 0 == strncmp(line, "device ", strlen("device ")))
+		{
+			run->context = realloc(run->context, (run->number_of_context + 1) * sizeof(*run->context));
+			if (NULL == run->context)
+			{
+				log_msg("[Compare] Failed to realloc! leaving...");
+				exit(-1);
+			}
+			run->context[run->number_of_context++] = strdup(line);
+		}
+		// Any other record (role counters, timestamps, later versions' additions) isn't compared.
+	}
+	free(line);
+	fclose(f);
+	if (0 == line_number)
+	{
+		log_msg("[Compare] %s is empty! leaving...", path);
+		exit(-1);
+	}
+	return run;
+}
+
+static void free_run(Run* run)
+{
+	for (uint32_t i = 0 ; i < run->number_of_context ; ++i)
+	{
+		free(run->context[i]);
+	}
+	free(run->context);
+	for (uint32_t r = 0 ; r < run->number_of_roles ; ++r)
+	{
+		free(run->roles[r].rates);
+	}
+	free(run);
+}
+
+// Prints the context records of one run that the other run doesn't have.
+static void print_context_differences(const Run* run, const Run* other, const char* label)
+{
+	for (uint32_t i = 0 ; i < run->number_of_context ; ++i)
+	{
+		uint32_t j = 0;
+		while (j < other->number_of_context && 0 != strcmp(run->context[i], other->context[j]))
+		{
+			++j;
+		}
+		if (j == other->number_of_context)
+		{
+			log_msg("[Compare] %-4s: %s", label, run->context[i]);
+		}
+	}
+}
+
+// The bootstrap draws from its own generator, seeded the same way for every comparison, so
+// comparing the same files twice prints the same intervals.
+static unsigned short rng[3];
+
+static uint64_t poisson(double lambda)
+{
+	if (lambda < 30)
+	{
+		double limit = exp(-lambda);
+		double p = erand48(rng);
+		uint64_t k = 0;
+		while (p > limit)
+		{
+			p *= erand48(rng);
+			++k;
+		}
+		return k;
+	}
+	// Normal approximation (Box-Muller), good enough for large counts.
+	double z = sqrt(-2 * log(1 - erand48(rng))) * cos(2 * M_PI * erand48(rng));
+	double k = round(lambda + sqrt(lambda) * z);
+	return (k < 0) ? 0 : (uint64_t)k;
+}
+
+// Resamples a histogram as if its values were drawn again: with many values, the count of each
+// bucket of a resample (with replacement) is close to Poisson distributed around its original count
+// (the Poisson bootstrap), which is much cheaper than drawing the values one by one.
+static void resample_histogram(const Histogram* h, Histogram* out)
+{
+	memset(out, 0, sizeof(*out));
+	out->max = h->max;
+	for (uint32_t b = 0 ; b < HISTOGRAM_BUCKETS ; ++b)
+	{
+		if (0 != h->buckets[b])
+		{
+			out->buckets[b] = poisson(h->buckets[b]);
+			out->count += out->buckets[b];
+		}
+	}
+}
+
+// The mean of a histogram as far as its buckets tell (each value at the middle of its bucket).
+static double bucket_mean(const Histogram* h)
+{
+	double sum = 0;
+	uint64_t count = 0;
+	for (uint32_t b = 0 ; b < HISTOGRAM_BUCKETS ; ++b)
+	{
+		sum += h->buckets[b] * (histogram_bucket_low(b) + histogram_bucket_high(b)) / 2.0;
+		count += h->buckets[b];
+	}
+	return (0 == count) ? 0 : sum / count;
+}
+
+// A statistic of a latency histogram: the mean if fraction is negative, a percentile otherwise.
+// A resample's mean is scaled by the recorded mean over the original's bucket mean, so it varies
+// around the recorded mean rather than around the bucket mean.
+static double latency_statistic(const Histogram* original, const Histogram* h, double fraction)
+{
+	if (fraction < 0)
+	{
+		return bucket_mean(h) * histogram_mean(original) / bucket_mean(original);
+	}
+	return histogram_percentile(h, fraction);
+}
+
+static double mean(const double* values, uint32_t n)
+{
+	double sum = 0;
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		sum += values[i];
+	}
+	return sum / n;
+}
+
+static double resampled_mean(const double* values, uint32_t n)
+{
+	double sum = 0;
+	for (uint32_t i = 0 ; i < n ; ++i)
+	{
+		sum += values[(uint32_t)(erand48(rng) * n)];
+	}
+	return sum / n;
+}
+
+static int compare_doubles(const void* a, const void* b)
+{
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+// Prints one delta with the percentile interval of its bootstrap replicates (relative deltas, in
+// percent, sorted in place). Returns 1 if the whole interval is a regression beyond the tolerance.
+static int report_delta(const char* role, const char* metric, const char* unit, double base, double new, double* deltas, uint32_t iterations, int higher_is_worse, double tolerance)
+{
+	qsort(deltas, iterations, sizeof(*deltas), compare_doubles);
+	double low = deltas[(uint32_t)(0.025 * (iterations - 1))];
+	double high = deltas[(uint32_t)ceil(0.975 * (iterations - 1))];
+	double worst = higher_is_worse ? low : -high;
+	double best = higher_is_worse ? -high : low;
+	const char* verdict = "";
+	if (worst > tolerance)
+	{
+		verdict = "  REGRESSION";
+	}
+	else if (best > tolerance)
+	{
+		verdict = "  improvement";
+	}
+	log_msg("[Compare] %-12s %-14s %14.3f -> %14.3f %-5s %+8.2f%% (95%% CI %+8.2f%% .. %+8.2f%%)%s",
+		role, metric, base, new, unit, (new / base - 1) * 100, low, high, verdict);
+	return (worst > tolerance);
+}
+
+static int compare_latency(const RunRole* base, const RunRole* new, uint32_t iterations, double tolerance)
+{
+	static const struct
+	{
+		const char* name;
+		double fraction;
+	} statistics[] = {{"latency mean", -1}, {"latency p50", 0.5}, {"latency p99", 0.99}};
+	if (0 == base->latency_ns.count || 0 == new->latency_ns.count)
+	{
+		return 0;
+	}
+	Histogram* resampled = do_malloc(2 * sizeof(*resampled));
+	double* deltas = do_malloc(iterations * sizeof(*deltas));
+	int regressions = 0;
+	for (uint32_t s = 0 ; s < sizeof(statistics) / sizeof(statistics[0]) ; ++s)
+	{
+		double base_value = latency_statistic(&base->latency_ns, &base->latency_ns, statistics[s].fraction);
+		double new_value = latency_statistic(&new->latency_ns, &new->latency_ns, statistics[s].fraction);
+		if (0 == base_value)
+		{
+			continue;
+		}
+		uint32_t valid = 0;
+		for (uint32_t i = 0 ; i < iterations ; ++i)
+		{
+			resample_histogram(&base->latency_ns, &resampled[0]);
+			resample_histogram(&new->latency_ns, &resampled[1]);
+			// Histograms of a handful of values may come out empty.
+			if (0 == resampled[0].count || 0 == resampled[1].count)
+			{
+				continue;
+			}
+			double b = latency_statistic(&base->latency_ns, &resampled[0], statistics[s].fraction);
+			double n = latency_statistic(&new->latency_ns, &resampled[1], statistics[s].fraction);
+			if (0 != b)
+			{
+				deltas[valid++] = (n / b - 1) * 100;
+			}
+		}
+		if (0 != valid)
+		{
+			regressions += report_delta(base->role, statistics[s].name, "us", base_value / 1000, new_value / 1000, deltas, valid, 1, tolerance);
+		}
+	}
+	free(deltas);
+	free(resampled);
+	return regressions;
+}
+
+static int compare_throughput(const RunRole* base, const RunRole* new, uint32_t iterations, double tolerance)
+{
+	if (base->number_of_rates < 2 || new->number_of_rates < 2)
+	{
+		log_msg("[Compare] %-12s %-14s fewer than 2 intervals of %u ms in a run, not compared", base->role, "throughput", RESULTS_INTERVAL_MS);
+		return 0;
+	}
+	double base_value = mean(base->rates, base->number_of_rates);
+	double new_value = mean(new->rates, new->number_of_rates);
+	if (0 == base_value)
+	{
+		return 0;
+	}
+	double* deltas = do_malloc(iterations * sizeof(*deltas));
+	uint32_t valid = 0;
+	for (uint32_t i = 0 ; i < iterations ; ++i)
+	{
+		double b = resampled_mean(base->rates, base->number_of_rates);
+		double n = resampled_mean(new->rates, new->number_of_rates);
+		if (0 != b)
+		{
+			deltas[valid++] = (n / b - 1) * 100;
+		}
+	}
+	int regressions = (0 == valid) ? 0 : report_delta(base->role, "throughput", "ops/s", base_value, new_value, deltas, valid, 0, tolerance);
+	free(deltas);
+	return regressions;
+}
+
+int results_compare(int argc, char** argv)
+{
+	double tolerance = RESULTS_DEFAULT_TOLERANCE_PCT;
+	uint32_t iterations = RESULTS_DEFAULT_ITERATIONS;
+	int c;
+	while ((c = getopt(argc, argv, "t:b:")) != -1)
+	{
+		switch (c)
+		{
+			case 't':
+				tolerance = strtod(optarg, NULL);
+				break;
+			case 'b':
+				iterations = strtoul(optarg, NULL, 10);
+				break;
+			default:
+				log_msg("Usage: compare [-t tolerance_pct] [-b iterations] base_results new_results");
+				exit(-1);
+		}
+	}
+	if (optind + 2 != argc || 0 == iterations || tolerance < 0)
+	{
+		log_msg("Usage: compare [-t tolerance_pct] [-b iterations] base_results new_results");
+		exit(-1);
+	}
+	Run* base = load_run(argv[optind]);
+	Run* new = load_run(argv[optind + 1]);
+	log_msg("[Compare] %s (base) vs %s (new): %u bootstrap iterations, %.1f%% tolerance", base->path, new->path, iterations, tolerance);
+	print_context_differences(base, new, "base");
+	print_context_differences(new, base, "new");
+
+	rng[0] = 0x5eed;
+	rng[1] = 0xb007;
+	rng[2] = 0x57a9;
+	int regressions = 0;
+	for (uint32_t r = 0 ; r < base->number_of_roles ; ++r)
+	{
+		const RunRole* new_role = find_role(new, base->roles[r].role, 0);
+		if (NULL == new_role)
+		{
+			log_msg("[Compare] %-12s only in the base run", base->roles[r].role);
+			continue;
+		}
+		regressions += compare_latency(&base->roles[r], new_role, iterations, tolerance);
+		regressions += compare_throughput(&base->roles[r], new_role, iterations, tolerance);
+	}
+	for (uint32_t r = 0 ; r < new->number_of_roles ; ++r)
+	{
+		if (NULL == find_role(base, new->roles[r].role, 0))
+		{
+			log_msg("[Compare] %-12s only in the new run", new->roles[r].role);
+		}
+	}
+	if (0 == regressions)
+	{
+		log_msg("[Compare] No significant regressions");
+	}
+	else
+	{
+		log_msg("[Compare] %d significant regressions", regressions);
+	}
+	free_run(base);
+	free_run(new);
+	return (0 == regressions) ? 0 : 1;
+}
@@ -0,0 +1,554 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "scenario.h"
+#include "connection.h"
+#include "clock_sync.h"
+#include "cache_exhauster.h"
+#include "ud.h"
+#include "latency_measure.h"
+#include "numa_placement.h"
+#include "hw_counters.h"
+#include "results.h"
+#include "histogram.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "stats.h"
+#include "detector.h"
+#include "memutils.h"
+#include "logging.h"
+
+// Rate limited attackers post this many reads at a time.
+#define RATE_LIMITED_BATCH 64
+
+#define SLOT_NOT_STARTED (-1)
+#define SLOT_DONE (-2)
+
+// Statistics of one run of one phase.
+typedef struct
+{
+	Histogram latency_ns;
+	RunningStats latency;
+	uint64_t attack_reads;
+	double duration_sec;
+	// Timeline time the phase started at.
+	uint64_t start_ns;
+	// Degradation onsets flagged by each detector during the phase, and the delay from the
+	// phase start to the first of them.
+	uint32_t onsets[NUMBER_OF_DETECTORS];
+	double first_onset_ms[NUMBER_OF_DETECTORS];
+} SlotStats;
+
+typedef struct
+{
+	const Scenario* scenario;
+	// Index of the running phase: repetition * number_of_phases + phase.
+	int slot;
+	SlotStats* slots;
+} RunnerState;
+
+typedef struct
+{
+	RunnerState* state;
+	ClientConnection* conn;
+	uint64_t* reads_per_slot;
+} AttackerThread;
+
+typedef struct
+{
+	RunnerState* state;
+	ClientConnection* conn;
+} VictimThread;
+
+static uint64_t mono_now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t deadline)
+{
+	struct timespec ts = {
+		.tv_sec = deadline / 1000000000,
+		.tv_nsec = deadline % 1000000000
+	};
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL));
+}
+
+static int current_slot(RunnerState* state)
+{
+	return __atomic_load_n(&state->slot, __ATOMIC_ACQUIRE);
+}
+
+static void scenario_error(const char* path, int line_no, const char* msg, const char* token)
+{
+	log_msg("Bad scenario file %s, line %d: %s (%s)", path, line_no, msg, (NULL == token) ? "" : token);
+	exit(-1);
+}
+
+static void parse_server(const char* path, int line_no, const char* value, ScenarioServer* server)
+{
+	if (2 != sscanf(value, "%63[^:]:%hu", server->addr, &server->port))
+	{
+		scenario_error(path, line_no, "expected address:port", value);
+	}
+	server->ud_qps = 0;
+}
+
+// Parses the optional "ud[=qps]" after a server.
+static void parse_ud(const char* path, int line_no, const char* value, uint32_t default_qps, ScenarioServer* server)
+{
+	if (0 == strcmp(value, "ud"))
+	{
+		server->ud_qps = default_qps;
+		return;
+	}
+	char* end = NULL;
+	if (0 != strncmp(value, "ud=", 3) || 0 == (server->ud_qps = strtoul(value + 3, &end, 10)) || '\0' != *end || server->ud_qps > UD_MAX_QPS)
+	{
+		scenario_error(path, line_no, "expected ud or ud=<number of UD QPs>", value);
+	}
+}
+
+// Parses a count of 1 to max.
+static uint32_t parse_count(const char* path, int line_no, const char* value, uint32_t max, const char* msg)
+{
+	char* end = NULL;
+	unsigned long count = strtoul(value, &end, 10);
+	if ('-' == value[0] || end == value || '\0' != *end || 0 == count || count > max)
+	{
+		scenario_error(path, line_no, msg, value);
+	}
+	return count;
+}
+
+static int phase_is_active(const ScenarioPhase* phase)
+{
+	return phase->attack || phase->flood;
+}
+
+// The number of attackers that run in the phase.
+static uint32_t active_attackers(const Scenario* scenario, const ScenarioPhase* phase)
+{
+	uint32_t count = 0;
+	for (uint32_t i = 0 ; i < scenario->number_of_attackers ; ++i)
+	{
+		count += (0 != scenario->attackers[i].ud_qps) ? phase->flood : phase->attack;
+	}
+	return count;
+}
+
+void load_scenario(const char* path, Scenario* scenario)
+{
+	FILE* f = fopen(path, "r");
+	if (NULL == f)
+	{
+		log_msg("Failed to open scenario file %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	memset(scenario, 0, sizeof(*scenario));
+	scenario->repeat = 1;
+	scenario->probe_interval_us = 1000;
+	int has_victim = 0;
+
+	char line[1024];
+	int line_no = 0;
+	while (NULL != fgets(line, sizeof(line), f))
+	{
+		++line_no;
+		line[strcspn(line, "#\r\n")] = '\0';
+		char directive[32];
+		char arg1[128];
+		char arg2[128];
+		char arg3[128];
+		int args = sscanf(line, "%31s %127s %127s %127s", directive, arg1, arg2, arg3);
+		if (args <= 0)
+		{
+			continue;
+		}
+		if (0 == strcmp(directive, "victim") && (2 == args || 3 == args))
+		{
+			parse_server(path, line_no, arg1, &scenario->victim);
+			if (3 == args)
+			{
+				parse_ud(path, line_no, arg2, 1, &scenario->victim);
+			}
+			has_victim = 1;
+		}
+		else if (0 == strcmp(directive, "attacker") && (2 == args || 3 == args))
+		{
+			if (MAX_SCENARIO_ATTACKERS == scenario->number_of_attackers)
+			{
+				scenario_error(path, line_no, "too many attackers", NULL);
+			}
+			ScenarioServer* attacker = &scenario->attackers[scenario->number_of_attackers++];
+			parse_server(path, line_no, arg1, attacker);
+			if (3 == args)
+			{
+				parse_ud(path, line_no, arg2, UD_DEFAULT_FLOOD_QPS, attacker);
+			}
+		}
+		else if (0 == strcmp(directive, "repeat") && 2 == args)
+		{
+			scenario->repeat = parse_count(path, line_no, arg1, MAX_SCENARIO_REPEAT, "bad repeat count");
+		}
+		else if (0 == strcmp(directive, "probe_interval_us") && 2 == args)
+		{
+			scenario->probe_interval_us = parse_count(path, line_no, arg1, MAX_SCENARIO_PROBE_INTERVAL_US, "bad probe interval");
+		}
+		else if (0 == strcmp(directive, "phase") && args >= 3)
+		{
+			if (MAX_SCENARIO_PHASES == scenario->number_of_phases)
+			{
+				scenario_error(path, line_no, "too many phases", NULL);
+			}
+			ScenarioPhase* phase = &scenario->phases[scenario->number_of_phases++];
+			snprintf(phase->name, sizeof(phase->name), "%s", arg1);
+			phase->duration_sec = strtod(arg2, NULL);
+			if (phase->duration_sec <= 0)
+			{
+				scenario_error(path, line_no, "bad phase duration", arg2);
+			}
+			if (4 == args)
+			{
+				if (0 == strcmp(arg3, "attack"))
+				{
+					phase->attack = 1;
+				}
+				else if (0 == strncmp(arg3, "attack=", 7))
+				{
+					phase->attack = 1;
+					phase->rate = strtod(arg3 + 7, NULL);
+				}
+				else if (0 == strcmp(arg3, "flood"))
+				{
+					phase->flood = 1;
+				}
+				else if (0 == strncmp(arg3, "flood=", 6))
+				{
+					phase->flood = 1;
+					phase->rate = strtod(arg3 + 6, NULL);
+				}
+				else
+				{
+					scenario_error(path, line_no, "expected attack[=<reads per second>] or flood[=<SENDs per second>]", arg3);
+				}
+			}
+		}
+		else
+		{
+			scenario_error(path, line_no, "unknown or malformed directive", directive);
+		}
+	}
+	fclose(f);
+
+	if (!has_victim)
+	{
+		scenario_error(path, line_no, "no victim", NULL);
+	}
+	if (0 == scenario->number_of_phases || 0 == scenario->repeat)
+	{
+		scenario_error(path, line_no, "no phases to run", NULL);
+	}
+	for (uint32_t i = 0 ; i < scenario->number_of_phases ; ++i)
+	{
+		const ScenarioPhase* phase = &scenario->phases[i];
+		if (phase_is_active(phase) && 0 == active_attackers(scenario, phase))
+		{
+			scenario_error(path, line_no, phase->attack ? "attack phase without RDMA attackers" : "flood phase without UD attackers", phase->name);
+		}
+	}
+}
+
+static void record_detections(RunnerState* state, int slot, const LatencyDetector* detector)
+{
+	const ScenarioPhase* phase = &state->scenario->phases[slot % state->scenario->number_of_phases];
+	SlotStats* stats = &state->slots[slot];
+	for (uint32_t k = 0 ; k < NUMBER_OF_DETECTORS ; ++k)
+	{
+		const DetectorState* detection = &detector->states[k];
+		if (!detection->changed || !detection->degraded)
+		{
+			continue;
+		}
+		double since_start_ms = ((int64_t)detection->detected_ns - (int64_t)stats->start_ns) / 1e6;
+		if (0 == stats->onsets[k])
+		{
+			stats->first_onset_ms[k] = since_start_ms;
+		}
+		++stats->onsets[k];
+		log_msg("[Scenario] %s flagged degradation %.3f ms into phase %s (%s)", detector_kind_name(k), since_start_ms, phase->name,
+			phase_is_active(phase) ? "attack" : "false alarm");
+	}
+}
+
+static void* run_victim(void* arg)
+{
+	VictimThread* victim = arg;
+	RunnerState* state = victim->state;
+	ClientLane* lane = &victim->conn->lanes[0];
+	pin_thread_to_node(get_placement_node());
+	metrics_register_thread("victim");
+	LatencyDetector* detector = do_malloc(sizeof(*detector));
+	detector_init(detector, "victim", state->scenario->probe_interval_us);
+
+	uint64_t interval_ns = (uint64_t)state->scenario->probe_interval_us * 1000;
+	uint64_t next = mono_now_ns();
+	int slot;
+	while (SLOT_DONE != (slot = current_slot(state)))
+	{
+		if (SLOT_NOT_STARTED == slot)
+		{
+			sleep_until_ns(mono_now_ns() + 10000);
+			next = mono_now_ns();
+			continue;
+		}
+		uint64_t ns = (NULL != victim->conn->ud) ? ud_probe(victim->conn->ud) : latency_probe(lane->qp, lane->peer_info, lane->buf, lane->mr->lkey);
+		uint64_t now_ns = timeline_now_ns();
+		if (0 == ns)
+		{
+			// A UD probe or its echo was lost.
+			timeline_record_at(now_ns, "victim", "lost", 1);
+		}
+		else
+		{
+			histogram_record(&thread_metrics->latency_ns, ns);
+			timeline_record_at(now_ns, "victim", "probe_us", ns / 1000.0);
+			detector_add(detector, now_ns, ns);
+			__atomic_store_n(&thread_metrics->alarms, detector_alarms(detector), __ATOMIC_RELAXED);
+			record_detections(state, slot, detector);
+			// Samples that straddle a phase switch belong to neither phase.
+			if (current_slot(state) == slot)
+			{
+				SlotStats* stats = &state->slots[slot];
+				histogram_record(&stats->latency_ns, ns);
+				running_stats_add(&stats->latency, ns);
+			}
+		}
+		next += interval_ns;
+		uint64_t now = mono_now_ns();
+		if (next < now)
+		{
+			next = now;
+		}
+		sleep_until_ns(next);
+	}
+	free(detector);
+	return NULL;
+}
+
+static void* run_attacker(void* arg)
+{
+	AttackerThread* attacker = arg;
+	RunnerState* state = attacker->state;
+	ClientLane* lane = &attacker->conn->lanes[0];
+	UdConnection* ud = attacker->conn->ud;
+	pin_thread_to_node(get_placement_node());
+	metrics_register_thread((NULL != ud) ? "ud_flood" : "attacker");
+
+	WrRing ring;
+	wr_ring_init(&ring, lane);
+	int last_slot = SLOT_NOT_STARTED;
+	uint64_t phase_start = 0;
+	uint64_t issued = 0;
+	int slot;
+	while (SLOT_DONE != (slot = current_slot(state)))
+	{
+		const ScenarioPhase* phase = (slot >= 0) ? &state->scenario->phases[slot % state->scenario->number_of_phases] : NULL;
+		if (NULL == phase || !((NULL != ud) ? phase->flood : phase->attack))
+		{
+			sleep_until_ns(mono_now_ns() + 10000);
+			continue;
+		}
+		if (slot != last_slot)
+		{
+			last_slot = slot;
+			phase_start = mono_now_ns();
+			issued = 0;
+		}
+
+		uint32_t batch = QP_MAX_SEND_WR;
+		double rate = phase->rate / active_attackers(state->scenario, phase);
+		if (rate > 0)
+		{
+			uint64_t now = mono_now_ns();
+			uint64_t allowed = (uint64_t)(rate * (now - phase_start) / 1e9) + 1;
+			if (issued >= allowed)
+			{
+				// Sleep until the next read is due, but keep an eye on the phase.
+				uint64_t due = phase_start + (uint64_t)((issued + 1) * 1e9 / rate);
+				sleep_until_ns((due > now + 1000000) ? now + 1000000 : due);
+				continue;
+			}
+			batch = (allowed - issued < RATE_LIMITED_BATCH) ? allowed - issued : RATE_LIMITED_BATCH;
+		}
+		uint32_t reads = (NULL != ud) ? ud_flood_step(ud, batch) : attacker_step(&ring, batch);
+		issued += reads;
+		attacker->reads_per_slot[slot] += reads;
+	}
+	wr_ring_destroy(&ring);
+	return NULL;
+}
+
+static void start_thread(pthread_t* thread, void* (*func)(void*), void* arg)
+{
+	int ans = pthread_create(thread, NULL, func, arg);
+	if (0 != ans)
+	{
+		log_msg("Failed to create thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+}
+
+static void report_phase(const Scenario* scenario, SlotStats* slots, uint32_t phase_idx)
+{
+	const ScenarioPhase* phase = &scenario->phases[phase_idx];
+	const char* unit = phase->flood ? "SENDs" : "reads";
+	Histogram pooled_hist;
+	histogram_reset(&pooled_hist);
+	RunningStats pooled = {0};
+	RunningStats rep_means = {0};
+	RunningStats rep_rates = {0};
+	for (uint32_t rep = 0 ; rep < scenario->repeat ; ++rep)
+	{
+		SlotStats* stats = &slots[rep * scenario->number_of_phases + phase_idx];
+		double rate = (stats->duration_sec > 0) ? stats->attack_reads / stats->duration_sec : 0;
+		log_msg("[Scenario] %-12s rep %3u: samples = %6" PRIu64 ", latency = %9.3f us +- %7.3f (95%% CI), p50 = %9.3f us, p99 = %9.3f us, attack = %12.0f %s/s",
+			phase->name, rep, stats->latency.n, stats->latency.mean / 1000, running_stats_ci95(&stats->latency) / 1000,
+			histogram_percentile(&stats->latency_ns, 0.5) / 1000.0, histogram_percentile(&stats->latency_ns, 0.99) / 1000.0, rate, unit);
+		histogram_merge(&pooled_hist, &stats->latency_ns);
+		running_stats_merge(&pooled, &stats->latency);
+		if (stats->latency.n > 0)
+		{
+			running_stats_add(&rep_means, stats->latency.mean);
+		}
+		running_stats_add(&rep_rates, rate);
+	}
+	log_msg("[Scenario] %-12s all    : samples = %6" PRIu64 ", latency = %9.3f us +- %7.3f (95%% CI over samples), +- %7.3f (95%% CI over %u repetitions), p50 = %9.3f us, p99 = %9.3f us, attack = %12.0f +- %.0f %s/s",
+		phase->name, pooled.n, pooled.mean / 1000, running_stats_ci95(&pooled) / 1000, running_stats_ci95(&rep_means) / 1000, scenario->repeat,
+		histogram_percentile(&pooled_hist, 0.5) / 1000.0, histogram_percentile(&pooled_hist, 0.99) / 1000.0, rep_rates.mean, running_stats_ci95(&rep_rates), unit);
+
+	for (uint32_t k = 0 ; k < NUMBER_OF_DETECTORS ; ++k)
+	{
+		RunningStats delays = {0};
+		uint32_t onsets = 0;
+		for (uint32_t rep = 0 ; rep < scenario->repeat ; ++rep)
+		{
+			SlotStats* stats = &slots[rep * scenario->number_of_phases + phase_idx];
+			onsets += stats->onsets[k];
+			if (stats->onsets[k] > 0)
+			{
+				running_stats_add(&delays, stats->first_onset_ms[k]);
+			}
+		}
+		if (phase_is_active(phase))
+		{
+			log_msg("[Scenario] %-12s %-8s: detected in %" PRIu64 " of %u repetitions, %.3f ms +- %.3f (95%% CI) after the phase started",
+				phase->name, detector_kind_name(k), delays.n, scenario->repeat, delays.mean, running_stats_ci95(&delays));
+		}
+		else if (onsets > 0)
+		{
+			log_msg("[Scenario] %-12s %-8s: %u false alarms", phase->name, detector_kind_name(k), onsets);
+		}
+	}
+}
+
+int run_scenario(const char* path, const Endpoint* endpoint, uint32_t hw_counter_interval_ms)
+{
+	Scenario scenario;
+	load_scenario(path, &scenario);
+	uint32_t number_of_slots = scenario.repeat * scenario.number_of_phases;
+	log_msg("[Scenario] %u attackers, %u phases x %u repetitions", scenario.number_of_attackers, scenario.number_of_phases, scenario.repeat);
+
+	RunnerState state = {
+		.scenario = &scenario,
+		.slot = SLOT_NOT_STARTED,
+		.slots = do_malloc(number_of_slots * sizeof(SlotStats))
+	};
+	memset(state.slots, 0, number_of_slots * sizeof(SlotStats));
+
+	VictimThread victim = {
+		.state = &state,
+		.conn = client_connect(scenario.victim.addr, scenario.victim.port, endpoint, 1, scenario.victim.ud_qps, 0, 0)
+	};
+	results_add_device(victim.conn->lanes[0].dev_ctx, endpoint->port);
+	if (0 != hw_counter_interval_ms)
+	{
+		start_hw_counter_sampler(victim.conn->lanes[0].dev_ctx, endpoint->port, hw_counter_interval_ms);
+	}
+	AttackerThread attackers[MAX_SCENARIO_ATTACKERS];
+	for (uint32_t i = 0 ; i < scenario.number_of_attackers ; ++i)
+	{
+		attackers[i].state = &state;
+		attackers[i].conn = client_connect(scenario.attackers[i].addr, scenario.attackers[i].port, endpoint, 1, scenario.attackers[i].ud_qps, 0, 0 == scenario.attackers[i].ud_qps);
+		attackers[i].reads_per_slot = do_malloc(number_of_slots * sizeof(uint64_t));
+		memset(attackers[i].reads_per_slot, 0, number_of_slots * sizeof(uint64_t));
+	}
+
+	do_sync(victim.conn->sock);
+	for (uint32_t i = 0 ; i < scenario.number_of_attackers ; ++i)
+	{
+		do_sync(attackers[i].conn->sock);
+	}
+	// With -S the victim's server provides the timebase.
+	clock_sync_track(victim.conn->clock_sync);
+
+	pthread_t victim_tid;
+	pthread_t attacker_tids[MAX_SCENARIO_ATTACKERS];
+	start_thread(&victim_tid, run_victim, &victim);
+	for (uint32_t i = 0 ; i < scenario.number_of_attackers ; ++i)
+	{
+		start_thread(&attacker_tids[i], run_attacker, &attackers[i]);
+	}
+
+	// This thread is the phase clock: phases switch at absolute deadlines so errors don't accumulate.
+	uint64_t phase_start = mono_now_ns();
+	for (uint32_t slot = 0 ; slot < number_of_slots ; ++slot)
+	{
+		const ScenarioPhase* phase = &scenario.phases[slot % scenario.number_of_phases];
+		uint64_t phase_end = phase_start + (uint64_t)(phase->duration_sec * 1e9);
+		state.slots[slot].start_ns = timeline_now_ns();
+		__atomic_store_n(&state.slot, slot, __ATOMIC_RELEASE);
+		uint64_t switched = mono_now_ns();
+		timeline_record("runner", "phase", slot);
+		log_msg("[Scenario] rep %u phase %s (%s, %.1f s, switched %.1f us late)", slot / scenario.number_of_phases, phase->name,
+			phase->attack ? "attack" : (phase->flood ? "flood" : "idle"), phase->duration_sec, (switched - phase_start) / 1000.0);
+		sleep_until_ns(phase_end);
+		state.slots[slot].duration_sec = (mono_now_ns() - switched) / 1e9;
+		phase_start = phase_end;
+	}
+	__atomic_store_n(&state.slot, SLOT_DONE, __ATOMIC_RELEASE);
+
+	pthread_join(victim_tid, NULL);
+	for (uint32_t i = 0 ; i < scenario.number_of_attackers ; ++i)
+	{
+		pthread_join(attacker_tids[i], NULL);
+		for (uint32_t slot = 0 ; slot < number_of_slots ; ++slot)
+		{
+			state.slots[slot].attack_reads += attackers[i].reads_per_slot[slot];
+		}
+	}
+
+	for (uint32_t i = 0 ; i < scenario.number_of_phases ; ++i)
+	{
+		report_phase(&scenario, state.slots, i);
+	}
+
+	clock_sync_stop(victim.conn->clock_sync);
+	do_sync(victim.conn->sock);
+	client_disconnect(victim.conn);
+	for (uint32_t i = 0 ; i < scenario.number_of_attackers ; ++i)
+	{
+		do_sync(attackers[i].conn->sock);
+		client_disconnect(attackers[i].conn);
+		free(attackers[i].reads_per_slot);
+	}
+	free(state.slots);
+	return 0;
+}
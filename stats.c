@@ -0,0 +1,57 @@
+#include <math.h>
+
+#include "stats.h"
+
+void running_stats_merge(RunningStats* dst, const RunningStats* src)
+{
+	if (0 == src->n)
+	{
+		return;
+	}
+	uint64_t n = dst->n + src->n;
+	double delta = src->mean - dst->mean;
+	dst->m2 += src->m2 + delta * delta * dst->n * src->n / n;
+	dst->mean += delta * src->n / n;
+	dst->n = n;
+}
+
+double running_stats_variance(const RunningStats* s)
+{
+	return (s->n < 2) ? 0 : s->m2 / (s->n - 1);
+}
+
+double running_stats_stddev(const RunningStats* s)
+{
+	return sqrt(running_stats_variance(s));
+}
+
+double running_stats_ci95(const RunningStats* s)
+{
+	if (s->n < 2)
+	{
+		return 0;
+	}
+	return student_t_95(s->n - 1) * running_stats_stddev(s) / sqrt(s->n);
+}
+
+double student_t_95(uint64_t df)
+{
+	static const double table[] = {
+		0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+		2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+		2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+	};
+	if (df < sizeof(table) / sizeof(table[0]))
+	{
+		return table[df];
+	}
+	if (df < 60)
+	{
+		return 2.000;
+	}
+	if (df < 120)
+	{
+		return 1.980;
+	}
+	return 1.960;
+}
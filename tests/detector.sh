@@ -0,0 +1,66 @@
+#!/bin/sh
+# Checks that the -D detector settings are parsed and that the bad ones are rejected, then runs a
+# scenario over the mock with an idle phase, an attack phase that raises the victim's latency by
+# orders of magnitude and another idle phase, and checks that every detector flags the degradation
+# during the attack and the recovery after it.
+# Usage: detector.sh <main> <base port>
+
+main=$1
+port=$(($2 + $$ % 1000))
+. "$(dirname "$0")/lib.sh"
+
+# detector <settings>: runs a mock client with the given settings against a closed port, so it gets
+# past the parsing and fails to connect.
+detector()
+{
+	"$main" -t mock -D "$1" -a 127.0.0.1 -p 1 -l
+}
+
+expect_output "Failed to connect" detector "warmup=64,window=16,clip=5,ewma_alpha=0.1,quantile=0.9,quantile_ratio=2"
+expect_output "Failed to connect" detector "window=32"
+
+expect_error "Detector warmup must be a non-negative integer, not -1" detector "warmup=-1"
+expect_error "Detector window must be a non-negative integer, not 2.5" detector "window=2.5"
+expect_error "Detector window must be 2-" detector "warmup=10,window=20"
+expect_error "Detector window must be 2-" detector "window=1"
+expect_error "Detector settings out of range" detector "ewma_alpha=2"
+expect_error "Unknown detector setting warm" detector "warm=10"
+expect_error "Bad detector setting warmup, expected key=value" detector "warmup"
+
+"$main" -t mock -l -p "$port" > "$dir/victim" 2>&1 &
+victim=$!
+"$main" -t mock -l -p $((port + 1)) > "$dir/attacker" 2>&1 &
+attacker=$!
+printf '%s\n' "victim 127.0.0.1:$port" "attacker 127.0.0.1:$((port + 1))" "probe_interval_us 1000" \
+	"phase idle 1" "phase attack 1 attack" "phase cool 1" > "$dir/scenario"
+# Each miss of the simulated NIC's 16 entry cache costs 5 us, which the attacker makes the norm and
+# which queues most of the victim's reads for milliseconds. The host descheduling the victim makes
+# the odd idle sample slow too, so the detectors are set to need a run of slow samples: a sample
+# counts for at most 20 standard deviations, the EWMA alarms at about 10 of them and CUSUM at 80
+# with a slack of 5, and the quantile detector watches the median of the window.
+tries=0
+until "$main" -t mock:1000:100:5000:16 -D clip=20,ewma_limit=43,cusum_k=5,cusum_h=80,quantile=0.5 -s "$dir/scenario" > "$dir/out" 2>&1
+do
+	grep -q "Failed to connect" "$dir/out" || { cat "$dir/out"; kill "$victim" "$attacker"; fail "scenario failed"; }
+	tries=$((tries + 1))
+	[ "$tries" -lt 20 ] || { kill "$victim" "$attacker"; fail "scenario never connected"; }
+	sleep 0.25
+done
+wait "$victim" "$attacker"
+
+# Degradations are only flagged once the attack started, recoveries once it stopped.
+sed -n '/phase attack (attack/,/phase cool (idle/p' "$dir/out" > "$dir/attack"
+sed -n '/phase cool (idle/,$p' "$dir/out" > "$dir/cool"
+grep -q "^\[Detector\] victim baseline over 256 samples" "$dir/out" || { cat "$dir/out"; fail "no baseline"; }
+for kind in ewma cusum quantile
+do
+	grep -qE "^\[Detector\] victim/$kind: degradation at [0-9]+, detected at [0-9]+ \([0-9.]+ ms later\)" "$dir/attack" ||
+		{ cat "$dir/out"; fail "$kind didn't flag the attack"; }
+	grep -qE "^\[Detector\] victim/$kind: recovery at [0-9]+, detected at [0-9]+ \([0-9.]+ ms later\)" "$dir/cool" ||
+		{ cat "$dir/out"; fail "$kind didn't flag the recovery"; }
+	# The detection delay is reported per phase, and must be well within the phase.
+	delay=$(sed -n "s/^\[Scenario\] attack *$kind *: detected in 1 of 1 repetitions, \([0-9.]*\) ms.*/\1/p" "$dir/out")
+	[ -n "$delay" ] || { cat "$dir/out"; fail "no $kind detection delay"; }
+	awk -v delay="$delay" 'BEGIN { exit !(delay < 500) }' || fail "$kind took $delay ms to flag the attack"
+done
+exit 0
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Parses a valid geometry file and checks that the malformed ones are rejected.
+# Usage: geometry.sh <main>
+
+main=$1
+. "$(dirname "$0")/lib.sh"
+
+# geometry <set line>: writes a geometry file with a single region set and runs a mock client with it.
+geometry()
+{
+	cat > "$dir/geometry" <<GEOMETRY
+# comment
+page_size = 4096
+prefetch_group_size = 8
+set $1
+GEOMETRY
+	"$main" -t mock -g "$dir/geometry" -a 127.0.0.1 -p 1 -l
+}
+
+expect_output "[Geometry] set 0: bits 15-24, base = 0x0, count = 1024, registered = 1024" \
+	geometry "first_bit=15 last_bit=24 base=0"
+expect_output "count = 16, registered = 4" geometry "first_bit=15 last_bit=18 base=0 indices=0,2-3,15"
+
+expect_error "bit out of range (64)" geometry "first_bit=15 last_bit=64 base=0"
+expect_error "bad bit range" geometry "first_bit=24 last_bit=15 base=0"
+expect_error "runs past the end of the address space" geometry "first_bit=15 last_bit=24 base=0xffffffffffff0000"
+expect_error "index out of range (4294967295)" geometry "first_bit=15 last_bit=24 base=0 indices=0-4294967295"
+expect_error "index out of range (1024)" geometry "first_bit=15 last_bit=24 base=0 indices=1024"
+expect_error "count doesn't fit in the bit range" geometry "first_bit=15 last_bit=24 base=0 count=2048"
+expect_error "unknown set attribute" geometry "first_bit=15 last_bit=24 base=0 stride=1"
+expect_error "a set needs first_bit, last_bit and base" geometry "first_bit=15 last_bit=24"
+exit 0
@@ -0,0 +1,34 @@
+# Helpers shared by the test scripts, sourced with ". lib.sh". Every test runs in its own scratch
+# directory, removed on exit.
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+fail()
+{
+	echo "FAIL: $*"
+	exit 1
+}
+
+# expect_error <text> <command...>: the command must fail and print <text>.
+expect_error()
+{
+	text=$1
+	shift
+	if "$@" > "$dir/out" 2>&1
+	then
+		cat "$dir/out"
+		fail "'$*' succeeded, expected '$text'"
+	fi
+	grep -qF -- "$text" "$dir/out" || { cat "$dir/out"; fail "'$*' didn't print '$text'"; }
+}
+
+# expect_output <text> <command...>: the command must print <text>, whatever its exit status (the
+# parsers run before main connects, so a run against a closed port still shows what was parsed).
+expect_output()
+{
+	text=$1
+	shift
+	"$@" > "$dir/out" 2>&1
+	grep -qF -- "$text" "$dir/out" || { cat "$dir/out"; fail "'$*' didn't print '$text'"; }
+}
@@ -0,0 +1,86 @@
+#!/bin/sh
+# Runs a mock server and a client with the given arguments (e.g. -l or -e) against it, stops the
+# client with SIGINT once it printed a line matching each <progress> pattern (which it only does once
+# its ops completed), or after 30 seconds, unless it finishes by itself, and checks that both exit
+# cleanly and that the progress was made.
+# Usage: mock_pair.sh <main> <base port> <progress>... -- <client arguments...>
+
+main=$1
+# The listening port lingers in TIME_WAIT for a while after a run and the server doesn't set
+# SO_REUSEADDR, so back to back runs pick different ports.
+port=$(($2 + $$ % 1000))
+shift 2
+. "$(dirname "$0")/lib.sh"
+: > "$dir/progress"
+while [ "$#" -gt 0 ] && [ "--" != "$1" ]
+do
+	printf '%s\n' "$1" >> "$dir/progress"
+	shift
+done
+[ "$#" -gt 0 ] && shift
+
+# has_progress: whether the client printed a line matching each progress pattern.
+has_progress()
+{
+	while read -r progress
+	do
+		grep -qE -- "$progress" "$dir/client" || return 1
+	done < "$dir/progress"
+}
+
+# wait_for <pid> <seconds>: waits for the process to exit, killing it and failing after <seconds>.
+wait_for()
+{
+	tries=0
+	while kill -0 "$1" 2> /dev/null
+	do
+		tries=$((tries + 1))
+		[ "$tries" -lt $(($2 * 4)) ] || { kill -9 "$1"; cat "$dir/server" "$dir/client"; fail "$1 didn't exit"; }
+		sleep 0.25
+	done
+	wait "$1"
+}
+
+# The server's mode doesn't matter, it serves whatever the client asks for.
+"$main" -t mock:0:0:0:1 -l -p "$port" > "$dir/server" 2>&1 &
+server=$!
+
+# The server may still be setting up its listening socket, retry until the client gets through. The
+# client only handles SIGINT once it runs, so wait for it to say so (line buffered) before stopping it.
+tries=0
+while :
+do
+	stdbuf -oL "$main" -t mock:0:0:0:1 -a 127.0.0.1 -p "$port" "$@" > "$dir/client" 2>&1 &
+	client=$!
+	while kill -0 "$client" 2> /dev/null && ! grep -q "Ctrl+C" "$dir/client"
+	do
+		sleep 0.1
+	done
+	grep -q "Failed to connect" "$dir/client" || break
+	wait "$client"
+	tries=$((tries + 1))
+	[ "$tries" -lt 20 ] || { kill "$server"; fail "client never connected"; }
+	sleep 0.25
+done
+# Busy polling clients of parallel tests share the CPUs, so give the client time rather than a fixed run.
+tries=0
+while [ "$tries" -lt 120 ] && kill -0 "$client" 2> /dev/null && ! has_progress
+do
+	tries=$((tries + 1))
+	sleep 0.25
+done
+kill -INT "$client" 2> /dev/null
+wait_for "$client" 30
+rc=$?
+[ "$rc" -eq 0 ] || { cat "$dir/client"; kill "$server"; fail "client exited with $rc"; }
+
+# The server exits once the client disconnects.
+wait_for "$server" 10
+rc=$?
+[ "$rc" -eq 0 ] || { cat "$dir/server"; fail "server exited with $rc"; }
+
+while read -r progress
+do
+	grep -qE -- "$progress" "$dir/client" || { cat "$dir/client"; fail "no progress matching '$progress'"; }
+done < "$dir/progress"
+exit 0
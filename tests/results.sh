@@ -0,0 +1,51 @@
+#!/bin/sh
+# Compares results files: a run against itself, against a slower run and against malformed files.
+# Usage: results.sh <main>
+
+main=$1
+. "$(dirname "$0")/lib.sh"
+
+# results <file> <throughput> <histogram buckets>: writes a results file of a latency run.
+results()
+{
+	cat > "$1" <<RESULTS
+results 1
+command main -t mock:0:0:0:1 -a 127.0.0.1 -l -R $1
+started_ns 1700000000000000000
+duration_ns 5000000000
+host name test
+transport mock
+device mock0 port 1 fw mock driver none vendor 0x0 part 0 hw 0 mtu 4096 width 0 speed 0
+role latency threads 1 ops 5000 errors 0 completions 5000 alarms 0
+throughput latency 1000 $2
+histogram latency 5000 50000000 20000 $3
+RESULTS
+}
+
+results "$dir/base" "1000.0 1010.0 990.0 1000.0 1005.0" "84:1000 85:2000 86:1500 87:500"
+results "$dir/same" "1000.0 1010.0 990.0 1000.0 1005.0" "84:1000 85:2000 86:1500 87:500"
+results "$dir/slow" "500.0 505.0 495.0 500.0 502.0" "100:1000 101:2000 102:1500 103:500"
+
+expect_output "No significant regressions" "$main" compare "$dir/base" "$dir/same"
+"$main" compare -b 200 "$dir/base" "$dir/slow" > "$dir/out" 2>&1
+rc=$?
+[ "$rc" -eq 1 ] || { cat "$dir/out"; fail "compare of a slower run exited with $rc"; }
+grep -q "REGRESSION" "$dir/out" || { cat "$dir/out"; fail "compare of a slower run didn't flag it"; }
+expect_output "No significant regressions" "$main" compare "$dir/slow" "$dir/base"
+
+cp "$dir/base" "$dir/dup"
+echo "histogram latency 1 1000 1000 84:1" >> "$dir/dup"
+expect_error "duplicate histogram of latency" "$main" compare "$dir/base" "$dir/dup"
+cp "$dir/base" "$dir/dup"
+echo "throughput latency 1000 1.0" >> "$dir/dup"
+expect_error "duplicate throughput of latency" "$main" compare "$dir/base" "$dir/dup"
+cp "$dir/base" "$dir/bad"
+echo "histogram other 1 1000 1000 100000:1" >> "$dir/bad"
+expect_error "bad histogram bucket" "$main" compare "$dir/base" "$dir/bad"
+
+sed 's/^results 1$/results 2/' "$dir/base" > "$dir/v2"
+expect_error "is not a version 1 results file" "$main" compare "$dir/base" "$dir/v2"
+: > "$dir/empty"
+expect_error "is empty" "$main" compare "$dir/base" "$dir/empty"
+expect_error "Usage: compare" "$main" compare "$dir/base"
+exit 0
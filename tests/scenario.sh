@@ -0,0 +1,35 @@
+#!/bin/sh
+# Parses a valid scenario and checks that the malformed ones are rejected.
+# Usage: scenario.sh <main>
+
+main=$1
+. "$(dirname "$0")/lib.sh"
+
+# scenario <lines...>: writes a scenario, one argument per line, and runs it over the mock transport.
+scenario()
+{
+	printf '%s\n' "$@" > "$dir/scenario"
+	"$main" -t mock -s "$dir/scenario"
+}
+
+expect_output "[Scenario] 2 attackers, 3 phases x 2 repetitions" \
+	scenario "# comment" "victim 127.0.0.1:1" "attacker 127.0.0.1:2" "attacker 127.0.0.1:3 ud=2" \
+	"repeat 2" "probe_interval_us 1000" "phase baseline 0.5" "phase hit 0.5 attack=100" "phase flood 0.5 flood"
+
+expect_error "no victim" scenario "attacker 127.0.0.1:2" "phase baseline 1"
+expect_error "no phases to run" scenario "victim 127.0.0.1:1"
+expect_error "unknown or malformed directive (victims)" scenario "victims 127.0.0.1:1" "phase baseline 1"
+expect_error "expected address:port" scenario "victim 127.0.0.1" "phase baseline 1"
+expect_error "bad repeat count (-1)" scenario "victim 127.0.0.1:1" "repeat -1" "phase baseline 1"
+expect_error "bad repeat count (0)" scenario "victim 127.0.0.1:1" "repeat 0" "phase baseline 1"
+expect_error "bad repeat count (3x)" scenario "victim 127.0.0.1:1" "repeat 3x" "phase baseline 1"
+expect_error "bad probe interval (2000000)" scenario "victim 127.0.0.1:1" "probe_interval_us 2000000" \
+	"phase baseline 1"
+expect_error "bad probe interval (-1)" scenario "victim 127.0.0.1:1" "probe_interval_us -1" "phase baseline 1"
+expect_error "bad phase duration" scenario "victim 127.0.0.1:1" "phase baseline 0"
+expect_error "expected ud or ud=<number of UD QPs>" scenario "victim 127.0.0.1:1" "attacker 127.0.0.1:2 rc" \
+	"phase baseline 1"
+expect_error "attack phase without RDMA attackers" scenario "victim 127.0.0.1:1" "phase hit 1 attack"
+expect_error "flood phase without UD attackers" scenario "victim 127.0.0.1:1" "attacker 127.0.0.1:2" \
+	"phase flood 1 flood"
+exit 0
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Converts a valid CSV trace and checks that the malformed ones are rejected.
+# Usage: trace_convert.sh <trace_convert>
+
+trace_convert=$1
+. "$(dirname "$0")/lib.sh"
+
+# convert <lines...>: writes a CSV, one argument per line, and converts it.
+convert()
+{
+	printf '%s\n' "$@" > "$dir/trace.csv"
+	"$trace_convert" "$dir/trace.csv" "$dir/trace"
+}
+
+expect_output "Wrote 2 records spanning 0.000 seconds" \
+	convert "region_index,offset,size,opcode,inter_arrival_ns" "0,0,64,read,1000" "1,4096,64,write,2000"
+[ -s "$dir/trace" ] || fail "no trace written"
+# Lines longer than any fixed buffer, and a '-' outside the numbers.
+long=$(printf '%0300d' 4096)
+expect_output "Wrote 2 records" convert "region-index,offset,size,op-code,inter-arrival-ns" "0,$long,64,read,1000" \
+	"# a comment - with a dash" "1,  0 ,64 , write , 2000"
+
+expect_error "trace.csv:2: fields can't be negative" convert "0,0,64,read,1000" "0,-64,64,read,1000"
+expect_error "trace.csv:1: fields can't be negative" convert "0,0,64,read, -5"
+expect_error "trace.csv:1: expected region_index,offset,size,opcode,inter_arrival_ns" convert "0,0,64,read,1000,7"
+expect_error "trace.csv:1: expected region_index,offset,size,opcode,inter_arrival_ns" convert "4294967296,0,64,read,1000"
+expect_error "trace.csv:1: expected region_index,offset,size,opcode,inter_arrival_ns" convert "0,0x10,64,read,1000"
+expect_error "trace.csv:1: expected region_index,offset,size,opcode,inter_arrival_ns" convert "0,0,64,read"
+expect_error "trace.csv:1: expected region_index,offset,size,opcode,inter_arrival_ns" convert "0,0,64,send,1000"
+expect_error "trace.csv:1: size must be positive" convert "0,0,0,read,1000"
+expect_error "Usage:" "$trace_convert" "$dir/trace.csv"
+exit 0
@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "timeline.h"
+#include "logging.h"
+#include "memutils.h"
+
+#define TIMELINE_SOURCE_LEN 16
+#define TIMELINE_NAME_LEN 128
+// Records each thread can have pending before the writer gets to them; more are dropped.
+#define TIMELINE_BUFFER_RECORDS 2048
+#define TIMELINE_FLUSH_MS 10
+
+typedef struct
+{
+	uint64_t time_ns;
+	double value;
+	char source[TIMELINE_SOURCE_LEN];
+	char name[TIMELINE_NAME_LEN];
+} TimelineRecord;
+
+// The records of one thread, waiting for the writer thread. A single producer / single consumer
+// ring: the owner only advances head and the writer only advances tail, so recording takes no lock
+// and does no I/O. Once the owner exits the buffer is released, and handed to the next thread that
+// records once the writer has emptied it.
+typedef struct TimelineBuffer
+{
+	uint64_t head;
+	uint64_t tail;
+	uint64_t dropped;
+	int released;
+	struct TimelineBuffer* next;
+	TimelineRecord records[TIMELINE_BUFFER_RECORDS];
+} TimelineBuffer;
+
+static FILE* timeline_file = NULL;
+// Guards the list of buffers and the output, i.e. registering threads against the writer.
+static pthread_mutex_t timeline_lock = PTHREAD_MUTEX_INITIALIZER;
+static TimelineBuffer* buffers = NULL;
+static __thread TimelineBuffer* thread_buffer = NULL;
+static pthread_key_t buffer_key;
+static pthread_once_t writer_once = PTHREAD_ONCE_INIT;
+static pthread_t writer;
+static int writer_running = 0;
+static uint64_t dropped_records = 0;
+
+// The local clock's mapping to the common timebase, updated while other threads stamp records.
+// Readers are on the hot path (every probe is stamped), so the mapping is published through a
+// seqlock: clock_seq is odd while an update is in progress, and readers retry if it changed under
+// them. clock_lock only serializes the writers.
+static pthread_mutex_t clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t clock_seq = 0;
+static int64_t clock_offset_ns = 0;
+static double clock_drift = 0;
+static uint64_t clock_anchor_ns = 0;
+
+void open_timeline(const char* path)
+{
+	timeline_file = fopen(path, "w");
+	if (NULL == timeline_file)
+	{
+		log_msg("Failed to open timeline file %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	fprintf(timeline_file, "time_ns,source,name,value\n");
+	log_msg("Writing timeline to %s", path);
+}
+
+static int compare_records(const void* a, const void* b)
+{
+	uint64_t ta = ((const TimelineRecord*)a)->time_ns;
+	uint64_t tb = ((const TimelineRecord*)b)->time_ns;
+	return (ta > tb) - (ta < tb);
+}
+
+// Writes out every pending record, in time order within the batch. Called with timeline_lock held.
+static void flush_buffers()
+{
+	static TimelineRecord* batch = NULL;
+	static uint32_t batch_capacity = 0;
+	uint32_t count = 0;
+	for (TimelineBuffer* buf = buffers ; NULL != buf ; buf = buf->next)
+	{
+		uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+		if (head == buf->tail)
+		{
+			continue;
+		}
+		if (count + (head - buf->tail) > batch_capacity)
+		{
+			batch_capacity = (count + (head - buf->tail)) * 2;
+			batch = realloc(batch, batch_capacity * sizeof(*batch));
+			if (NULL == batch)
+			{
+				log_msg("[Timeline] Failed to realloc! leaving...");
+				exit(-1);
+			}
+		}
+		for (uint64_t i = buf->tail ; i != head ; ++i)
+		{
+			batch[count++] = buf->records[i % TIMELINE_BUFFER_RECORDS];
+		}
+		__atomic_store_n(&buf->tail, head, __ATOMIC_RELEASE);
+	}
+	qsort(batch, count, sizeof(*batch), compare_records);
+	for (uint32_t i = 0 ; i < count ; ++i)
+	{
+		const TimelineRecord* record = &batch[i];
+		if (NULL == timeline_file)
+		{
+			log_msg("[Timeline] %" PRIu64 " %s %s %.3f", record->time_ns, record->source, record->name, record->value);
+		}
+		else
+		{
+			fprintf(timeline_file, "%" PRIu64 ",%s,%s,%.3f\n", record->time_ns, record->source, record->name, record->value);
+		}
+	}
+}
+
+static void* write_timeline(void* arg)
+{
+	(void)arg;
+	while (__atomic_load_n(&writer_running, __ATOMIC_RELAXED))
+	{
+		usleep(TIMELINE_FLUSH_MS * 1000);
+		pthread_mutex_lock(&timeline_lock);
+		flush_buffers();
+		pthread_mutex_unlock(&timeline_lock);
+	}
+	return NULL;
+}
+
+static void release_buffer(void* arg)
+{
+	TimelineBuffer* buf = arg;
+	__atomic_store_n(&buf->released, 1, __ATOMIC_RELEASE);
+}
+
+static void start_writer()
+{
+	int ans = pthread_key_create(&buffer_key, release_buffer);
+	if (0 != ans)
+	{
+		log_msg("[Timeline] Failed to create the buffer key! errno = %s", strerror(ans));
+		exit(-1);
+	}
+	writer_running = 1;
+	ans = pthread_create(&writer, NULL, write_timeline, NULL);
+	if (0 != ans)
+	{
+		log_msg("[Timeline] Failed to create writer thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+}
+
+// Gives the calling thread a buffer, on its first record.
+static TimelineBuffer* register_thread()
+{
+	pthread_once(&writer_once, start_writer);
+	pthread_mutex_lock(&timeline_lock);
+	TimelineBuffer* buf = buffers;
+	while (NULL != buf && !(__atomic_load_n(&buf->released, __ATOMIC_ACQUIRE) && buf->head == buf->tail))
+	{
+		buf = buf->next;
+	}
+	if (NULL == buf)
+	{
+		buf = do_malloc(sizeof(*buf));
+		buf->head = 0;
+		buf->tail = 0;
+		buf->dropped = 0;
+		buf->next = buffers;
+		buffers = buf;
+	}
+	buf->released = 0;
+	pthread_mutex_unlock(&timeline_lock);
+	pthread_setspecific(buffer_key, buf);
+	return buf;
+}
+
+void close_timeline()
+{
+	if (__atomic_load_n(&writer_running, __ATOMIC_RELAXED))
+	{
+		__atomic_store_n(&writer_running, 0, __ATOMIC_RELAXED);
+		pthread_join(writer, NULL);
+	}
+	pthread_mutex_lock(&timeline_lock);
+	flush_buffers();
+	for (TimelineBuffer* buf = buffers ; NULL != buf ; buf = buf->next)
+	{
+		dropped_records += __atomic_exchange_n(&buf->dropped, 0, __ATOMIC_RELAXED);
+	}
+	if (0 != dropped_records)
+	{
+		log_msg("[Timeline] Dropped %" PRIu64 " records the writer couldn't keep up with", dropped_records);
+	}
+	if (NULL != timeline_file)
+	{
+		fclose(timeline_file);
+		timeline_file = NULL;
+	}
+	pthread_mutex_unlock(&timeline_lock);
+}
+
+uint64_t timeline_local_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void timeline_set_clock(int64_t offset_ns, double drift, uint64_t anchor_ns)
+{
+	pthread_mutex_lock(&clock_lock);
+	uint32_t seq = clock_seq;
+	__atomic_store_n(&clock_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&clock_offset_ns, offset_ns, __ATOMIC_RELAXED);
+	__atomic_store(&clock_drift, &drift, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock_anchor_ns, anchor_ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&clock_seq, seq + 2, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&clock_lock);
+}
+
+uint64_t timeline_now_ns()
+{
+	uint64_t local = timeline_local_ns();
+	uint32_t seq;
+	int64_t offset_ns;
+	double drift;
+	uint64_t anchor_ns;
+	do
+	{
+		seq = __atomic_load_n(&clock_seq, __ATOMIC_ACQUIRE);
+		offset_ns = __atomic_load_n(&clock_offset_ns, __ATOMIC_RELAXED);
+		__atomic_load(&clock_drift, &drift, __ATOMIC_RELAXED);
+		anchor_ns = __atomic_load_n(&clock_anchor_ns, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&clock_seq, __ATOMIC_RELAXED));
+	return local + offset_ns + (int64_t)(drift * (double)(int64_t)(local - anchor_ns));
+}
+
+void timeline_record(const char* source, const char* name, double value)
+{
+	timeline_record_at(timeline_now_ns(), source, name, value);
+}
+
+static void copy_name(char* dst, const char* src, size_t size)
+{
+	size_t len = strnlen(src, size - 1);
+	memcpy(dst, src, len);
+	dst[len] = '\0';
+}
+
+void timeline_record_at(uint64_t time_ns, const char* source, const char* name, double value)
+{
+	TimelineBuffer* buf = thread_buffer;
+	if (NULL == buf)
+	{
+		buf = thread_buffer = register_thread();
+	}
+	uint64_t head = buf->head;
+	if (head - __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE) == TIMELINE_BUFFER_RECORDS)
+	{
+		__atomic_store_n(&buf->dropped, buf->dropped + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	TimelineRecord* record = &buf->records[head % TIMELINE_BUFFER_RECORDS];
+	record->time_ns = time_ns;
+	record->value = value;
+	copy_name(record->source, source, sizeof(record->source));
+	copy_name(record->name, name, sizeof(record->name));
+	__atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
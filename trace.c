@@ -0,0 +1,64 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "logging.h"
+
+void map_trace(const char* path, Trace* trace)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		log_msg("Failed to open trace file %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	struct stat st;
+	if (0 != fstat(fd, &st))
+	{
+		log_msg("Failed to stat trace file %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	if ((size_t)st.st_size < sizeof(TraceHeader))
+	{
+		log_msg("Trace file %s is too short to be a trace", path);
+		exit(-1);
+	}
+	void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == addr)
+	{
+		log_msg("Failed to mmap trace file %s! errno = %s", path, strerror(errno));
+		exit(-1);
+	}
+	// Records are consumed strictly in order, let the kernel read ahead aggressively.
+	madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+	const TraceHeader* header = addr;
+	if (TRACE_MAGIC != header->magic || TRACE_VERSION != header->version || sizeof(TraceRecord) != header->record_size)
+	{
+		log_msg("%s is not a version %u trace (use trace_convert to create one)", path, TRACE_VERSION);
+		exit(-1);
+	}
+	if (header->number_of_records > (st.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord))
+	{
+		log_msg("Trace file %s is truncated: header says %" PRIu64 " records", path, header->number_of_records);
+		exit(-1);
+	}
+	trace->header = header;
+	trace->records = (const TraceRecord*)(header + 1);
+	trace->mapped_size = st.st_size;
+}
+
+void unmap_trace(Trace* trace)
+{
+	munmap((void*)trace->header, trace->mapped_size);
+	trace->header = NULL;
+	trace->records = NULL;
+	trace->mapped_size = 0;
+}
@@ -0,0 +1,186 @@
+/*
+Converts a CSV access trace into the binary trace format replayed by "main -r" (see trace.h).
+Every line of the input is: region_index,offset,size,opcode,inter_arrival_ns
+where opcode is "read" or "write" (or R / W / 0 / 1). A header line and lines starting with '#' are skipped.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "trace.h"
+#include "logging.h"
+
+static int parse_opcode(const char* s, uint8_t* opcode)
+{
+	if (0 == strcasecmp(s, "read") || 0 == strcasecmp(s, "r") || 0 == strcmp(s, "0"))
+	{
+		*opcode = TRACE_OP_READ;
+		return 0;
+	}
+	if (0 == strcasecmp(s, "write") || 0 == strcasecmp(s, "w") || 0 == strcmp(s, "1"))
+	{
+		*opcode = TRACE_OP_WRITE;
+		return 0;
+	}
+	return -1;
+}
+
+#define CSV_FIELDS 5
+
+typedef enum
+{
+	FIELD_OK,
+	FIELD_NEGATIVE,
+	FIELD_BAD,
+} FieldStatus;
+
+// Strips the blanks (and the line end) around a field.
+static char* trim(char* s)
+{
+	s += strspn(s, " \t");
+	char* end = s + strlen(s);
+	while (end > s && NULL != strchr(" \t\r\n", end[-1]))
+	{
+		--end;
+	}
+	*end = '\0';
+	return s;
+}
+
+// Parses a decimal field of at most max. strtoull would take "-1" for 2^64 - 1, so the sign is checked first.
+static FieldStatus parse_field(const char* s, uint64_t max, uint64_t* value)
+{
+	if ('-' == s[0])
+	{
+		return FIELD_NEGATIVE;
+	}
+	if (!isdigit((unsigned char)s[0]))
+	{
+		return FIELD_BAD;
+	}
+	char* end = NULL;
+	errno = 0;
+	*value = strtoull(s, &end, 10);
+	return ('\0' != *end || ERANGE == errno || *value > max) ? FIELD_BAD : FIELD_OK;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		log_msg("Usage: %s <input.csv> <output.trace>", argv[0]);
+		log_msg("\t input lines: region_index,offset,size,opcode(read|write),inter_arrival_ns");
+		exit(-1);
+	}
+	FILE* in = fopen(argv[1], "r");
+	if (NULL == in)
+	{
+		log_msg("Failed to open %s! errno = %s", argv[1], strerror(errno));
+		exit(-1);
+	}
+	FILE* out = fopen(argv[2], "wb");
+	if (NULL == out)
+	{
+		log_msg("Failed to open %s! errno = %s", argv[2], strerror(errno));
+		exit(-1);
+	}
+
+	TraceHeader header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.record_size = sizeof(TraceRecord),
+		.number_of_records = 0
+	};
+	// Written again with the final count once all the records are in.
+	if (1 != fwrite(&header, sizeof(header), 1, out))
+	{
+		log_msg("Failed to write to %s! errno = %s", argv[2], strerror(errno));
+		exit(-1);
+	}
+
+	char* line = NULL;
+	size_t line_capacity = 0;
+	uint64_t line_no = 0;
+	uint64_t total_ns = 0;
+	while (-1 != getline(&line, &line_capacity, in))
+	{
+		++line_no;
+		char* p = trim(line);
+		if ('#' == *p || '\0' == *p)
+		{
+			continue;
+		}
+		if (0 == header.number_of_records && isalpha((unsigned char)*p))
+		{
+			// Column names.
+			continue;
+		}
+		char* fields[CSV_FIELDS + 1];
+		uint32_t number_of_fields = 0;
+		char* save = NULL;
+		for (char* field = strtok_r(p, ",", &save) ; NULL != field && number_of_fields <= CSV_FIELDS ; field = strtok_r(NULL, ",", &save))
+		{
+			fields[number_of_fields++] = trim(field);
+		}
+		TraceRecord record;
+		memset(&record, 0, sizeof(record));
+		uint64_t region_index = 0;
+		uint64_t size = 0;
+		FieldStatus status = FIELD_BAD;
+		if (CSV_FIELDS == number_of_fields)
+		{
+			FieldStatus statuses[] = {
+				parse_field(fields[0], UINT32_MAX, &region_index),
+				parse_field(fields[1], UINT64_MAX, &record.offset),
+				parse_field(fields[2], UINT32_MAX, &size),
+				parse_field(fields[4], UINT64_MAX, &record.inter_arrival_ns)
+			};
+			status = FIELD_OK;
+			for (uint32_t i = 0 ; i < sizeof(statuses) / sizeof(statuses[0]) ; ++i)
+			{
+				if (FIELD_OK != statuses[i] && FIELD_NEGATIVE != status)
+				{
+					status = statuses[i];
+				}
+			}
+		}
+		if (FIELD_NEGATIVE == status)
+		{
+			log_msg("%s:%" PRIu64 ": fields can't be negative", argv[1], line_no);
+			exit(-1);
+		}
+		if (FIELD_OK != status || 0 != parse_opcode(fields[3], &record.opcode))
+		{
+			log_msg("%s:%" PRIu64 ": expected region_index,offset,size,opcode,inter_arrival_ns", argv[1], line_no);
+			exit(-1);
+		}
+		record.region_index = region_index;
+		record.size = size;
+		if (0 == record.size)
+		{
+			log_msg("%s:%" PRIu64 ": size must be positive", argv[1], line_no);
+			exit(-1);
+		}
+		if (1 != fwrite(&record, sizeof(record), 1, out))
+		{
+			log_msg("Failed to write to %s! errno = %s", argv[2], strerror(errno));
+			exit(-1);
+		}
+		++header.number_of_records;
+		total_ns += record.inter_arrival_ns;
+	}
+	free(line);
+	fclose(in);
+
+	if (0 != fseek(out, 0, SEEK_SET) || 1 != fwrite(&header, sizeof(header), 1, out) || 0 != fclose(out))
+	{
+		log_msg("Failed to finalize %s! errno = %s", argv[2], strerror(errno));
+		exit(-1);
+	}
+	log_msg("Wrote %" PRIu64 " records spanning %.3f seconds to %s", header.number_of_records, total_ns / 1e9, argv[2]);
+	return 0;
+}
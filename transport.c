@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "transport.h"
+#include "logging.h"
+
+const TransportOps* transport = &verbs_transport;
+
+void select_transport(const char* spec)
+{
+	if (0 == strcmp(spec, verbs_transport.name))
+	{
+		transport = &verbs_transport;
+	}
+	else if (0 == strncmp(spec, mock_transport.name, strlen(mock_transport.name)))
+	{
+		const char* params = spec + strlen(mock_transport.name);
+		if (':' == *params)
+		{
+			MockNicModel model;
+			if (4 != sscanf(params, ":%" SCNu64 ":%" SCNu64 ":%" SCNu64 ":%u", &model.base_ns, &model.hit_ns, &model.miss_ns, &model.cache_entries))
+			{
+				log_msg("Bad mock transport spec: %s (expected mock:base_ns:hit_ns:miss_ns:cache_entries)", spec);
+				exit(-1);
+			}
+			set_mock_nic_model(&model);
+		}
+		else if ('\0' != *params)
+		{
+			log_msg("Unknown transport: %s", spec);
+			exit(-1);
+		}
+		transport = &mock_transport;
+	}
+	else
+	{
+		log_msg("Unknown transport: %s", spec);
+		exit(-1);
+	}
+	log_msg("Using transport: %s", transport->name);
+}
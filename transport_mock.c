@@ -0,0 +1,1072 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "transport.h"
+#include "logging.h"
+
+// In-process mock of the verbs the tool uses. RDMA operations never leave the process: every posted WR
+// is completed by a simulated NIC after a delay given by the MockNicModel, so the harness (posting,
+// polling, timing, logging) can be measured and exercised without an RDMA device. UD SENDs are the
+// exception: they are carried as datagrams between the simulated NICs of processes on the same host
+// (an abstract Unix socket per NIC, named after its LID), so UD probing works between a mock client
+// and a mock server. Like on the wire, a message nobody has a receive posted for is dropped.
+
+// Largest UD message (payload) the mock carries.
+#define MOCK_UD_MTU 4096
+// The global routing header space at the start of every UD receive buffer.
+#define MOCK_GRH_SIZE 40
+// UD messages taken off the NIC's socket per poll.
+#define MOCK_UD_DELIVER_BATCH 64
+
+static MockNicModel mock_model = {
+	.base_ns = 1500,
+	.hit_ns = 50,
+	.miss_ns = 500,
+	.cache_entries = 1024
+};
+
+// The simulated NIC. Like real hardware it is shared by every context opened on the device,
+// so threads attacking and probing through different contexts contend for it.
+typedef struct MockQp MockQp;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	uint32_t refs;
+	uint64_t busy_until_ns;
+	uint64_t* cache_tags;
+	uint32_t cache_entries;
+	uint64_t translation_misses;
+	uint64_t qp_context_misses;
+	// UD: the NIC's address, its socket (opened with the first UD QP) and its UD QPs by number.
+	uint16_t lid;
+	int sock;
+	MockQp** ud_qps;
+	uint32_t ud_qps_size;
+	uint64_t ud_dropped;
+} MockNic;
+
+typedef struct
+{
+	struct ibv_context ctx;
+	MockNic* nic;
+} MockContext;
+
+// A posted receive. Only single SGE receives are supported.
+typedef struct
+{
+	uint64_t wr_id;
+	uint64_t addr;
+	uint32_t length;
+} MockRecv;
+
+typedef struct
+{
+	MockRecv* entries;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t tail;
+} MockRecvQueue;
+
+typedef struct
+{
+	struct ibv_srq srq;
+	MockRecvQueue rq;
+} MockSrq;
+
+struct MockQp
+{
+	// An extended QP's ibv_qp_ex starts with the QP itself, so both views share the address.
+	union
+	{
+		struct ibv_qp qp;
+		struct ibv_qp_ex qpx;
+	};
+	// Extended QPs only: the operations they were created with and the WRs built since wr_start,
+	// posted as one chain by wr_complete (see the WR builder API, ibv_wr_*).
+	uint64_t send_ops_flags;
+	struct ibv_send_wr* built_wrs;
+	struct ibv_sge* built_sges;
+	uint32_t number_of_built;
+	int build_error;
+	uint32_t max_send_wr;
+	uint32_t outstanding;
+	uint32_t unsignaled;
+	int sq_sig_all;
+	uint32_t qkey;
+	// Used unless the QP has an SRQ.
+	MockRecvQueue rq;
+};
+
+typedef struct
+{
+	struct ibv_ah ah;
+	uint16_t dlid;
+} MockAh;
+
+// What a UD SEND puts on the wire in front of its payload.
+typedef struct
+{
+	uint32_t dest_qp;
+	uint32_t src_qp;
+	uint32_t qkey;
+	uint16_t slid;
+} MockUdHeader;
+
+typedef struct
+{
+	uint64_t ready_ns;
+	uint64_t wr_id;
+	MockQp* qp;
+	enum ibv_wc_opcode opcode;
+	uint32_t byte_len;
+	// Number of send queue entries released when this completion is polled.
+	uint32_t wrs_covered;
+	// Receives only.
+	uint32_t src_qp;
+	uint16_t slid;
+} MockCqe;
+
+typedef struct
+{
+	struct ibv_cq cq;
+	MockCqe* entries;
+	uint32_t capacity;
+	uint32_t head;
+	uint32_t tail;
+} MockCq;
+
+static struct ibv_device mock_device = {
+	.node_type = IBV_NODE_CA,
+	.transport_type = IBV_TRANSPORT_IB,
+	.name = "mock0",
+	.dev_name = "uverbs_mock0",
+	.dev_path = "/sys/class/infiniband_verbs/uverbs_mock0",
+	.ibdev_path = "/sys/class/infiniband/mock0"
+};
+
+static MockNic mock_nic = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.sock = -1
+};
+
+static uint32_t next_qp_num = 1;
+static uint32_t next_key = 1;
+
+static uint64_t mock_now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void* mock_calloc(size_t size)
+{
+	void* ptr = calloc(1, size);
+	if (NULL == ptr)
+	{
+		errno = ENOMEM;
+	}
+	return ptr;
+}
+
+void set_mock_nic_model(const MockNicModel* model)
+{
+	mock_model = *model;
+	if (0 == mock_model.cache_entries)
+	{
+		mock_model.cache_entries = 1;
+	}
+	log_msg("[Mock] NIC model: base = %llu ns, hit = %llu ns, miss = %llu ns, cache entries = %u", mock_model.base_ns, mock_model.hit_ns, mock_model.miss_ns, mock_model.cache_entries);
+}
+
+static int mock_fork_init(void)
+{
+	return 0;
+}
+
+static struct ibv_device** mock_get_device_list(int* num_devices)
+{
+	struct ibv_device** list = mock_calloc(2 * sizeof(*list));
+	if (NULL != list)
+	{
+		list[0] = &mock_device;
+		*num_devices = 1;
+	}
+	return list;
+}
+
+static void mock_free_device_list(struct ibv_device** list)
+{
+	free(list);
+}
+
+static const char* mock_get_device_name(struct ibv_device* device)
+{
+	return device->name;
+}
+
+static struct ibv_context* mock_open_device(struct ibv_device* device)
+{
+	MockContext* mctx = mock_calloc(sizeof(*mctx));
+	if (NULL == mctx)
+	{
+		return NULL;
+	}
+	MockNic* nic = &mock_nic;
+	pthread_mutex_lock(&nic->lock);
+	if (0 == nic->refs)
+	{
+		nic->cache_entries = mock_model.cache_entries;
+		nic->cache_tags = mock_calloc(nic->cache_entries * sizeof(*nic->cache_tags));
+		if (NULL == nic->cache_tags)
+		{
+			pthread_mutex_unlock(&nic->lock);
+			free(mctx);
+			return NULL;
+		}
+		nic->busy_until_ns = 0;
+		nic->translation_misses = 0;
+		nic->qp_context_misses = 0;
+		nic->ud_dropped = 0;
+		// Unique among the processes of the host (as long as the pids are), so NICs can address each other.
+		nic->lid = getpid() % 0xfffe + 1;
+	}
+	++nic->refs;
+	pthread_mutex_unlock(&nic->lock);
+	mctx->nic = nic;
+	mctx->ctx.device = device;
+	mctx->ctx.cmd_fd = -1;
+	mctx->ctx.async_fd = -1;
+	mctx->ctx.num_comp_vectors = 1;
+	return &mctx->ctx;
+}
+
+static int mock_close_device(struct ibv_context* context)
+{
+	MockContext* mctx = (MockContext*)context;
+	MockNic* nic = mctx->nic;
+	pthread_mutex_lock(&nic->lock);
+	if (0 == --nic->refs)
+	{
+		log_msg("[Mock] NIC cache misses: %llu QP contexts, %llu memory translations; %llu UD messages dropped",
+			nic->qp_context_misses, nic->translation_misses, nic->ud_dropped);
+		free(nic->cache_tags);
+		nic->cache_tags = NULL;
+		if (nic->sock >= 0)
+		{
+			close(nic->sock);
+			nic->sock = -1;
+		}
+		free(nic->ud_qps);
+		nic->ud_qps = NULL;
+		nic->ud_qps_size = 0;
+	}
+	pthread_mutex_unlock(&nic->lock);
+	free(mctx);
+	return 0;
+}
+
+static int mock_query_gid(struct ibv_context* context, uint8_t port_num, int index, union ibv_gid* gid)
+{
+	memset(gid, 0, sizeof(*gid));
+	return 0;
+}
+
+static int mock_query_port(struct ibv_context* context, uint8_t port_num, struct ibv_port_attr* port_attr)
+{
+	memset(port_attr, 0, sizeof(*port_attr));
+	port_attr->state = IBV_PORT_ACTIVE;
+	port_attr->max_mtu = IBV_MTU_4096;
+	port_attr->active_mtu = IBV_MTU_4096;
+	port_attr->lid = ((MockContext*)context)->nic->lid;
+	port_attr->link_layer = IBV_LINK_LAYER_INFINIBAND;
+	return 0;
+}
+
+static int mock_query_device(struct ibv_context* context, struct ibv_device_attr* device_attr)
+{
+	memset(device_attr, 0, sizeof(*device_attr));
+	snprintf(device_attr->fw_ver, sizeof(device_attr->fw_ver), "mock");
+	device_attr->phys_port_cnt = 1;
+	return 0;
+}
+
+static struct ibv_pd* mock_alloc_pd(struct ibv_context* context)
+{
+	struct ibv_pd* pd = mock_calloc(sizeof(*pd));
+	if (NULL != pd)
+	{
+		pd->context = context;
+	}
+	return pd;
+}
+
+static int mock_dealloc_pd(struct ibv_pd* pd)
+{
+	free(pd);
+	return 0;
+}
+
+static struct ibv_mr* mock_reg_mr(struct ibv_pd* pd, void* addr, size_t length, int access)
+{
+	struct ibv_mr* mr = mock_calloc(sizeof(*mr));
+	if (NULL != mr)
+	{
+		mr->context = pd->context;
+		mr->pd = pd;
+		mr->addr = addr;
+		mr->length = length;
+		mr->lkey = next_key;
+		mr->rkey = next_key;
+		++next_key;
+	}
+	return mr;
+}
+
+static int mock_dereg_mr(struct ibv_mr* mr)
+{
+	free(mr);
+	return 0;
+}
+
+static struct ibv_comp_channel* mock_create_comp_channel(struct ibv_context* context)
+{
+	struct ibv_comp_channel* ch = mock_calloc(sizeof(*ch));
+	if (NULL != ch)
+	{
+		ch->context = context;
+		ch->fd = -1;
+	}
+	return ch;
+}
+
+static int mock_destroy_comp_channel(struct ibv_comp_channel* channel)
+{
+	free(channel);
+	return 0;
+}
+
+static struct ibv_cq* mock_create_cq(struct ibv_context* context, int cqe, void* cq_context, struct ibv_comp_channel* channel, int comp_vector)
+{
+	if (cqe <= 0 || comp_vector >= context->num_comp_vectors)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	MockCq* mcq = mock_calloc(sizeof(*mcq));
+	if (NULL == mcq)
+	{
+		return NULL;
+	}
+	mcq->capacity = cqe + 1;
+	mcq->entries = mock_calloc(mcq->capacity * sizeof(*mcq->entries));
+	if (NULL == mcq->entries)
+	{
+		free(mcq);
+		return NULL;
+	}
+	mcq->cq.context = context;
+	mcq->cq.channel = channel;
+	mcq->cq.cq_context = cq_context;
+	mcq->cq.cqe = cqe;
+	return &mcq->cq;
+}
+
+static int mock_destroy_cq(struct ibv_cq* cq)
+{
+	MockCq* mcq = (MockCq*)cq;
+	free(mcq->entries);
+	free(mcq);
+	return 0;
+}
+
+// Returns the next free entry of the CQ, or NULL if it's full. Completions are added under the NIC
+// lock (a UD receive may be delivered by any thread polling the NIC) and published by cq_commit.
+static MockCqe* cq_next(MockCq* mcq)
+{
+	uint32_t next_tail = (mcq->tail + 1) % mcq->capacity;
+	if (next_tail == __atomic_load_n(&mcq->head, __ATOMIC_ACQUIRE))
+	{
+		log_msg("[Mock] CQ overrun! cqe = %d", mcq->cq.cqe);
+		return NULL;
+	}
+	return &mcq->entries[mcq->tail];
+}
+
+static void cq_commit(MockCq* mcq)
+{
+	__atomic_store_n(&mcq->tail, (mcq->tail + 1) % mcq->capacity, __ATOMIC_RELEASE);
+}
+
+static int recv_queue_init(MockRecvQueue* rq, uint32_t max_wr)
+{
+	rq->capacity = max_wr + 1;
+	rq->head = 0;
+	rq->tail = 0;
+	rq->entries = mock_calloc(rq->capacity * sizeof(*rq->entries));
+	return (NULL == rq->entries) ? -1 : 0;
+}
+
+// Called with the NIC lock held.
+static int recv_queue_post(MockRecvQueue* rq, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr)
+{
+	for ( ; NULL != wr ; wr = wr->next)
+	{
+		uint32_t next_tail = (rq->tail + 1) % rq->capacity;
+		if (next_tail == rq->head)
+		{
+			*bad_wr = wr;
+			return ENOMEM;
+		}
+		if (1 != wr->num_sge)
+		{
+			*bad_wr = wr;
+			return EINVAL;
+		}
+		MockRecv* recv = &rq->entries[rq->tail];
+		recv->wr_id = wr->wr_id;
+		recv->addr = wr->sg_list[0].addr;
+		recv->length = wr->sg_list[0].length;
+		rq->tail = next_tail;
+	}
+	return 0;
+}
+
+static MockRecv* recv_queue_pop(MockRecvQueue* rq)
+{
+	if (rq->head == rq->tail)
+	{
+		return NULL;
+	}
+	MockRecv* recv = &rq->entries[rq->head];
+	rq->head = (rq->head + 1) % rq->capacity;
+	return recv;
+}
+
+static socklen_t ud_address(uint16_t lid, struct sockaddr_un* addr)
+{
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	// An abstract socket: nothing to clean up in the file system.
+	int len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "rdma-mock-nic-%hu", lid);
+	return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+// Called with the NIC lock held.
+static int ud_register_qp(MockNic* nic, MockQp* mqp)
+{
+	if (nic->sock < 0)
+	{
+		int sock = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (sock < 0)
+		{
+			return -1;
+		}
+		struct sockaddr_un addr;
+		socklen_t len = ud_address(nic->lid, &addr);
+		if (0 != bind(sock, (struct sockaddr*)&addr, len))
+		{
+			log_msg("[Mock] Failed to bind the NIC's UD socket (LID %hu)! errno = %s", nic->lid, strerror(errno));
+			close(sock);
+			return -1;
+		}
+		nic->sock = sock;
+	}
+	uint32_t qp_num = mqp->qp.qp_num;
+	if (qp_num >= nic->ud_qps_size)
+	{
+		uint32_t size = (0 == nic->ud_qps_size) ? 64 : nic->ud_qps_size;
+		while (size <= qp_num)
+		{
+			size *= 2;
+		}
+		MockQp** ud_qps = realloc(nic->ud_qps, size * sizeof(*ud_qps));
+		if (NULL == ud_qps)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+		memset(ud_qps + nic->ud_qps_size, 0, (size - nic->ud_qps_size) * sizeof(*ud_qps));
+		nic->ud_qps = ud_qps;
+		nic->ud_qps_size = size;
+	}
+	nic->ud_qps[qp_num] = mqp;
+	return 0;
+}
+
+static struct ibv_qp* mock_create_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* qp_init_attr)
+{
+	MockQp* mqp = mock_calloc(sizeof(*mqp));
+	if (NULL == mqp)
+	{
+		return NULL;
+	}
+	if (NULL == qp_init_attr->srq && 0 != recv_queue_init(&mqp->rq, qp_init_attr->cap.max_recv_wr))
+	{
+		free(mqp);
+		return NULL;
+	}
+	mqp->qp.context = pd->context;
+	mqp->qp.qp_context = qp_init_attr->qp_context;
+	mqp->qp.pd = pd;
+	mqp->qp.send_cq = qp_init_attr->send_cq;
+	mqp->qp.recv_cq = qp_init_attr->recv_cq;
+	mqp->qp.srq = qp_init_attr->srq;
+	mqp->qp.qp_num = next_qp_num++;
+	mqp->qp.state = IBV_QPS_RESET;
+	mqp->qp.qp_type = qp_init_attr->qp_type;
+	mqp->max_send_wr = qp_init_attr->cap.max_send_wr;
+	mqp->sq_sig_all = qp_init_attr->sq_sig_all;
+	if (IBV_QPT_UD == qp_init_attr->qp_type)
+	{
+		MockNic* nic = ((MockContext*)pd->context)->nic;
+		pthread_mutex_lock(&nic->lock);
+		int ans = ud_register_qp(nic, mqp);
+		pthread_mutex_unlock(&nic->lock);
+		if (0 != ans)
+		{
+			free(mqp->rq.entries);
+			free(mqp);
+			return NULL;
+		}
+	}
+	return &mqp->qp;
+}
+
+static int mock_modify_qp(struct ibv_qp* qp, struct ibv_qp_attr* attr, int attr_mask)
+{
+	if (attr_mask & IBV_QP_STATE)
+	{
+		qp->state = attr->qp_state;
+	}
+	if (attr_mask & IBV_QP_QKEY)
+	{
+		((MockQp*)qp)->qkey = attr->qkey;
+	}
+	return 0;
+}
+
+static int mock_destroy_qp(struct ibv_qp* qp)
+{
+	MockQp* mqp = (MockQp*)qp;
+	if (IBV_QPT_UD == qp->qp_type)
+	{
+		MockNic* nic = ((MockContext*)qp->context)->nic;
+		pthread_mutex_lock(&nic->lock);
+		nic->ud_qps[qp->qp_num] = NULL;
+		pthread_mutex_unlock(&nic->lock);
+	}
+	free(mqp->built_wrs);
+	free(mqp->built_sges);
+	free(mqp->rq.entries);
+	free(mqp);
+	return 0;
+}
+
+static struct ibv_srq* mock_create_srq(struct ibv_pd* pd, struct ibv_srq_init_attr* srq_init_attr)
+{
+	MockSrq* msrq = mock_calloc(sizeof(*msrq));
+	if (NULL == msrq)
+	{
+		return NULL;
+	}
+	if (0 != recv_queue_init(&msrq->rq, srq_init_attr->attr.max_wr))
+	{
+		free(msrq);
+		return NULL;
+	}
+	msrq->srq.context = pd->context;
+	msrq->srq.srq_context = srq_init_attr->srq_context;
+	msrq->srq.pd = pd;
+	return &msrq->srq;
+}
+
+static int mock_destroy_srq(struct ibv_srq* srq)
+{
+	MockSrq* msrq = (MockSrq*)srq;
+	free(msrq->rq.entries);
+	free(msrq);
+	return 0;
+}
+
+static int mock_post_recv(struct ibv_qp* qp, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr)
+{
+	if (NULL != qp->srq)
+	{
+		*bad_wr = wr;
+		return EINVAL;
+	}
+	MockNic* nic = ((MockContext*)qp->context)->nic;
+	pthread_mutex_lock(&nic->lock);
+	int ret = recv_queue_post(&((MockQp*)qp)->rq, wr, bad_wr);
+	pthread_mutex_unlock(&nic->lock);
+	return ret;
+}
+
+static int mock_post_srq_recv(struct ibv_srq* srq, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr)
+{
+	MockNic* nic = ((MockContext*)srq->context)->nic;
+	pthread_mutex_lock(&nic->lock);
+	int ret = recv_queue_post(&((MockSrq*)srq)->rq, wr, bad_wr);
+	pthread_mutex_unlock(&nic->lock);
+	return ret;
+}
+
+static struct ibv_ah* mock_create_ah(struct ibv_pd* pd, struct ibv_ah_attr* attr)
+{
+	MockAh* mah = mock_calloc(sizeof(*mah));
+	if (NULL == mah)
+	{
+		return NULL;
+	}
+	mah->ah.context = pd->context;
+	mah->ah.pd = pd;
+	mah->dlid = attr->dlid;
+	return &mah->ah;
+}
+
+static int mock_destroy_ah(struct ibv_ah* ah)
+{
+	free(ah);
+	return 0;
+}
+
+// Looks the tag up in the NIC's cache and inserts it on a miss. Returns whether it was there.
+static int mock_cache_lookup(MockNic* nic, uint64_t tag)
+{
+	uint64_t slot = (tag * 0x9E3779B97F4A7C15ULL) % nic->cache_entries;
+	if (nic->cache_tags[slot] == tag)
+	{
+		return 1;
+	}
+	nic->cache_tags[slot] = tag;
+	return 0;
+}
+
+// Returns the translation time of the given remote page and updates the translation cache.
+static uint64_t mock_translate(MockNic* nic, uint32_t rkey, uint64_t remote_addr)
+{
+	if (mock_cache_lookup(nic, ((uint64_t)rkey << 40) ^ ((remote_addr >> 12) + 1)))
+	{
+		return mock_model.hit_ns;
+	}
+	++nic->translation_misses;
+	return mock_model.miss_ns;
+}
+
+// Returns the extra time the QP's context costs: nothing if it's cached. The top bit keeps the
+// QP context tags apart from the translation tags (rkeys are far below 2^23).
+static uint64_t mock_qp_context(MockNic* nic, uint32_t qp_num)
+{
+	if (mock_cache_lookup(nic, (1ULL << 63) | qp_num))
+	{
+		return 0;
+	}
+	++nic->qp_context_misses;
+	return mock_model.miss_ns;
+}
+
+// Puts a UD SEND on the wire. Like on a real fabric, failures to deliver are silent drops.
+static void ud_send(MockNic* nic, MockQp* mqp, struct ibv_send_wr* wr)
+{
+	char packet[sizeof(MockUdHeader) + MOCK_UD_MTU];
+	MockUdHeader* header = (MockUdHeader*)packet;
+	header->dest_qp = wr->wr.ud.remote_qpn;
+	header->src_qp = mqp->qp.qp_num;
+	header->qkey = wr->wr.ud.remote_qkey;
+	header->slid = nic->lid;
+	size_t len = sizeof(*header);
+	for (int i = 0 ; i < wr->num_sge ; ++i)
+	{
+		uint32_t length = wr->sg_list[i].length;
+		if (len + length > sizeof(packet))
+		{
+			length = sizeof(packet) - len;
+		}
+		memcpy(packet + len, (void*)wr->sg_list[i].addr, length);
+		len += length;
+	}
+	struct sockaddr_un addr;
+	socklen_t addr_len = ud_address(((MockAh*)wr->wr.ud.ah)->dlid, &addr);
+	if (sendto(nic->sock, packet, len, MSG_DONTWAIT, (struct sockaddr*)&addr, addr_len) < 0)
+	{
+		++nic->ud_dropped;
+	}
+}
+
+// Takes the UD messages that arrived at the NIC off its socket and completes a posted receive for
+// each, after the NIC has looked up the destination QP's context. Called with the NIC lock held.
+static void ud_deliver(MockNic* nic)
+{
+	char packet[sizeof(MockUdHeader) + MOCK_UD_MTU];
+	for (int i = 0 ; i < MOCK_UD_DELIVER_BATCH ; ++i)
+	{
+		ssize_t len = recv(nic->sock, packet, sizeof(packet), MSG_DONTWAIT);
+		if (len < (ssize_t)sizeof(MockUdHeader))
+		{
+			return;
+		}
+		const MockUdHeader* header = (const MockUdHeader*)packet;
+		MockQp* mqp = (header->dest_qp < nic->ud_qps_size) ? nic->ud_qps[header->dest_qp] : NULL;
+		if (NULL == mqp || IBV_QPS_RTR > mqp->qp.state || mqp->qkey != header->qkey)
+		{
+			++nic->ud_dropped;
+			continue;
+		}
+		MockRecvQueue* rq = (NULL != mqp->qp.srq) ? &((MockSrq*)mqp->qp.srq)->rq : &mqp->rq;
+		MockCq* mcq = (MockCq*)mqp->qp.recv_cq;
+		MockCqe* cqe = cq_next(mcq);
+		MockRecv* recv = (NULL != cqe) ? recv_queue_pop(rq) : NULL;
+		if (NULL == recv)
+		{
+			++nic->ud_dropped;
+			continue;
+		}
+		uint32_t payload = len - sizeof(*header);
+		if (MOCK_GRH_SIZE + payload > recv->length)
+		{
+			payload = (recv->length > MOCK_GRH_SIZE) ? recv->length - MOCK_GRH_SIZE : 0;
+		}
+		memset((void*)recv->addr, 0, (recv->length < MOCK_GRH_SIZE) ? recv->length : MOCK_GRH_SIZE);
+		memcpy((char*)recv->addr + MOCK_GRH_SIZE, packet + sizeof(*header), payload);
+
+		uint64_t now = mock_now_ns();
+		uint64_t start = (nic->busy_until_ns > now) ? nic->busy_until_ns : now;
+		nic->busy_until_ns = start + mock_model.hit_ns + mock_qp_context(nic, mqp->qp.qp_num);
+		cqe->ready_ns = nic->busy_until_ns + mock_model.base_ns;
+		cqe->wr_id = recv->wr_id;
+		cqe->qp = mqp;
+		cqe->opcode = IBV_WC_RECV;
+		cqe->byte_len = MOCK_GRH_SIZE + payload;
+		cqe->wrs_covered = 0;
+		cqe->src_qp = header->src_qp;
+		cqe->slid = header->slid;
+		cq_commit(mcq);
+	}
+}
+
+// Called with the NIC lock held.
+static int post_send_locked(MockNic* nic, struct ibv_qp* qp, struct ibv_send_wr* wr, struct ibv_send_wr** bad_wr)
+{
+	MockQp* mqp = (MockQp*)qp;
+	MockCq* mcq = (MockCq*)qp->send_cq;
+	uint64_t now = mock_now_ns();
+	for ( ; NULL != wr ; wr = wr->next)
+	{
+		if (IBV_QPS_RTS != qp->state)
+		{
+			*bad_wr = wr;
+			return EINVAL;
+		}
+		if (mqp->outstanding >= mqp->max_send_wr)
+		{
+			*bad_wr = wr;
+			return ENOMEM;
+		}
+
+		uint64_t translation_ns = mock_model.hit_ns;
+		enum ibv_wc_opcode opcode = IBV_WC_SEND;
+		if (IBV_QPT_UD == qp->qp_type && IBV_WR_SEND != wr->opcode)
+		{
+			*bad_wr = wr;
+			return EOPNOTSUPP;
+		}
+		switch (wr->opcode)
+		{
+			case IBV_WR_RDMA_READ:
+				opcode = IBV_WC_RDMA_READ;
+				translation_ns = mock_translate(nic, wr->wr.rdma.rkey, wr->wr.rdma.remote_addr);
+				break;
+			case IBV_WR_RDMA_WRITE:
+				opcode = IBV_WC_RDMA_WRITE;
+				translation_ns = mock_translate(nic, wr->wr.rdma.rkey, wr->wr.rdma.remote_addr);
+				break;
+			case IBV_WR_SEND:
+				if (IBV_QPT_UD == qp->qp_type)
+				{
+					ud_send(nic, mqp, wr);
+				}
+				break;
+			default:
+				*bad_wr = wr;
+				return EOPNOTSUPP;
+		}
+
+		translation_ns += mock_qp_context(nic, qp->qp_num);
+		uint64_t start = (nic->busy_until_ns > now) ? nic->busy_until_ns : now;
+		nic->busy_until_ns = start + translation_ns;
+		uint64_t done_ns = nic->busy_until_ns;
+		++mqp->outstanding;
+		++mqp->unsignaled;
+		if (!mqp->sq_sig_all && !(wr->send_flags & IBV_SEND_SIGNALED))
+		{
+			continue;
+		}
+
+		MockCqe* cqe = cq_next(mcq);
+		if (NULL == cqe)
+		{
+			*bad_wr = wr;
+			return ENOMEM;
+		}
+		uint32_t byte_len = 0;
+		for (int i = 0 ; i < wr->num_sge ; ++i)
+		{
+			byte_len += wr->sg_list[i].length;
+		}
+		cqe->ready_ns = done_ns + mock_model.base_ns;
+		cqe->wr_id = wr->wr_id;
+		cqe->qp = mqp;
+		cqe->opcode = opcode;
+		cqe->byte_len = byte_len;
+		cqe->wrs_covered = mqp->unsignaled;
+		mqp->unsignaled = 0;
+		cq_commit(mcq);
+	}
+	return 0;
+}
+
+static int mock_post_send(struct ibv_qp* qp, struct ibv_send_wr* wr, struct ibv_send_wr** bad_wr)
+{
+	MockNic* nic = ((MockContext*)qp->context)->nic;
+	pthread_mutex_lock(&nic->lock);
+	int ret = post_send_locked(nic, qp, wr, bad_wr);
+	pthread_mutex_unlock(&nic->lock);
+	return ret;
+}
+
+static void builder_start(struct ibv_qp_ex* qpx)
+{
+	MockQp* mqp = (MockQp*)qpx;
+	mqp->number_of_built = 0;
+	mqp->build_error = 0;
+}
+
+// Appends a WR of the given opcode, taking its id and flags from the QP as the builder API does.
+static struct ibv_send_wr* builder_add(struct ibv_qp_ex* qpx, enum ibv_wr_opcode opcode, uint64_t send_op_flag)
+{
+	MockQp* mqp = (MockQp*)qpx;
+	if (0 == (mqp->send_ops_flags & send_op_flag))
+	{
+		mqp->build_error = EOPNOTSUPP;
+		return NULL;
+	}
+	if (mqp->number_of_built == mqp->max_send_wr)
+	{
+		mqp->build_error = ENOMEM;
+		return NULL;
+	}
+	struct ibv_send_wr* wr = &mqp->built_wrs[mqp->number_of_built++];
+	memset(wr, 0, sizeof(*wr));
+	wr->wr_id = qpx->wr_id;
+	wr->send_flags = qpx->wr_flags;
+	wr->opcode = opcode;
+	return wr;
+}
+
+static void builder_rdma_read(struct ibv_qp_ex* qpx, uint32_t rkey, uint64_t remote_addr)
+{
+	struct ibv_send_wr* wr = builder_add(qpx, IBV_WR_RDMA_READ, IBV_QP_EX_WITH_RDMA_READ);
+	if (NULL != wr)
+	{
+		wr->wr.rdma.rkey = rkey;
+		wr->wr.rdma.remote_addr = remote_addr;
+	}
+}
+
+static void builder_rdma_write(struct ibv_qp_ex* qpx, uint32_t rkey, uint64_t remote_addr)
+{
+	struct ibv_send_wr* wr = builder_add(qpx, IBV_WR_RDMA_WRITE, IBV_QP_EX_WITH_RDMA_WRITE);
+	if (NULL != wr)
+	{
+		wr->wr.rdma.rkey = rkey;
+		wr->wr.rdma.remote_addr = remote_addr;
+	}
+}
+
+static void builder_send(struct ibv_qp_ex* qpx)
+{
+	builder_add(qpx, IBV_WR_SEND, IBV_QP_EX_WITH_SEND);
+}
+
+static void builder_set_sge(struct ibv_qp_ex* qpx, uint32_t lkey, uint64_t addr, uint32_t length)
+{
+	MockQp* mqp = (MockQp*)qpx;
+	if (0 != mqp->build_error || 0 == mqp->number_of_built)
+	{
+		return;
+	}
+	struct ibv_sge* sge = &mqp->built_sges[mqp->number_of_built - 1];
+	sge->lkey = lkey;
+	sge->addr = addr;
+	sge->length = length;
+	mqp->built_wrs[mqp->number_of_built - 1].sg_list = sge;
+	mqp->built_wrs[mqp->number_of_built - 1].num_sge = 1;
+}
+
+static int builder_complete(struct ibv_qp_ex* qpx)
+{
+	MockQp* mqp = (MockQp*)qpx;
+	int ret = mqp->build_error;
+	if (0 == ret && 0 != mqp->number_of_built)
+	{
+		for (uint32_t i = 0 ; i + 1 < mqp->number_of_built ; ++i)
+		{
+			mqp->built_wrs[i].next = &mqp->built_wrs[i + 1];
+		}
+		MockNic* nic = ((MockContext*)mqp->qp.context)->nic;
+		struct ibv_send_wr* bad_wr = NULL;
+		pthread_mutex_lock(&nic->lock);
+		ret = post_send_locked(nic, &mqp->qp, mqp->built_wrs, &bad_wr);
+		pthread_mutex_unlock(&nic->lock);
+	}
+	mqp->number_of_built = 0;
+	mqp->build_error = 0;
+	return ret;
+}
+
+static void builder_abort(struct ibv_qp_ex* qpx)
+{
+	builder_start(qpx);
+}
+
+// Like the hardware, refuses operations the QP type can't do, e.g. RDMA on a UD QP.
+static struct ibv_qp* mock_create_qp_ex(struct ibv_context* context, struct ibv_qp_init_attr_ex* qp_init_attr_ex)
+{
+	uint64_t supported = IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_SEND;
+	if (IBV_QPT_UD == qp_init_attr_ex->qp_type)
+	{
+		supported = IBV_QP_EX_WITH_SEND;
+	}
+	if (0 == (qp_init_attr_ex->comp_mask & IBV_QP_INIT_ATTR_PD) || context != qp_init_attr_ex->pd->context ||
+		0 == (qp_init_attr_ex->comp_mask & IBV_QP_INIT_ATTR_SEND_OPS_FLAGS) || 0 != (qp_init_attr_ex->send_ops_flags & ~supported))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	struct ibv_qp_init_attr attr = {
+		.qp_context = qp_init_attr_ex->qp_context,
+		.send_cq = qp_init_attr_ex->send_cq,
+		.recv_cq = qp_init_attr_ex->recv_cq,
+		.srq = qp_init_attr_ex->srq,
+		.cap = qp_init_attr_ex->cap,
+		.qp_type = qp_init_attr_ex->qp_type,
+		.sq_sig_all = qp_init_attr_ex->sq_sig_all
+	};
+	struct ibv_qp* qp = mock_create_qp(qp_init_attr_ex->pd, &attr);
+	if (NULL == qp)
+	{
+		return NULL;
+	}
+	MockQp* mqp = (MockQp*)qp;
+	mqp->send_ops_flags = qp_init_attr_ex->send_ops_flags;
+	mqp->built_wrs = mock_calloc(mqp->max_send_wr * sizeof(*mqp->built_wrs));
+	mqp->built_sges = mock_calloc(mqp->max_send_wr * sizeof(*mqp->built_sges));
+	if (NULL == mqp->built_wrs || NULL == mqp->built_sges)
+	{
+		mock_destroy_qp(qp);
+		errno = ENOMEM;
+		return NULL;
+	}
+	mqp->qpx.wr_start = builder_start;
+	mqp->qpx.wr_rdma_read = builder_rdma_read;
+	mqp->qpx.wr_rdma_write = builder_rdma_write;
+	mqp->qpx.wr_send = builder_send;
+	mqp->qpx.wr_set_sge = builder_set_sge;
+	mqp->qpx.wr_complete = builder_complete;
+	mqp->qpx.wr_abort = builder_abort;
+	return qp;
+}
+
+static struct ibv_qp_ex* mock_qp_to_qp_ex(struct ibv_qp* qp)
+{
+	MockQp* mqp = (MockQp*)qp;
+	return (0 != mqp->send_ops_flags) ? &mqp->qpx : NULL;
+}
+
+static int mock_req_notify_cq(struct ibv_cq* cq, int solicited_only)
+{
+	return 0;
+}
+
+static int mock_poll_cq(struct ibv_cq* cq, int num_entries, struct ibv_wc* wc)
+{
+	MockCq* mcq = (MockCq*)cq;
+	MockNic* nic = ((MockContext*)cq->context)->nic;
+	if (nic->sock >= 0)
+	{
+		pthread_mutex_lock(&nic->lock);
+		if (nic->sock >= 0)
+		{
+			ud_deliver(nic);
+		}
+		pthread_mutex_unlock(&nic->lock);
+	}
+	uint32_t tail = __atomic_load_n(&mcq->tail, __ATOMIC_ACQUIRE);
+	if (mcq->head == tail)
+	{
+		return 0;
+	}
+	uint64_t now = mock_now_ns();
+	int polled = 0;
+	while (polled < num_entries && mcq->head != tail && mcq->entries[mcq->head].ready_ns <= now)
+	{
+		MockCqe* cqe = &mcq->entries[mcq->head];
+		memset(&wc[polled], 0, sizeof(wc[polled]));
+		wc[polled].wr_id = cqe->wr_id;
+		wc[polled].status = IBV_WC_SUCCESS;
+		wc[polled].opcode = cqe->opcode;
+		wc[polled].byte_len = cqe->byte_len;
+		wc[polled].qp_num = cqe->qp->qp.qp_num;
+		wc[polled].src_qp = cqe->src_qp;
+		wc[polled].slid = cqe->slid;
+		cqe->qp->outstanding -= cqe->wrs_covered;
+		__atomic_store_n(&mcq->head, (mcq->head + 1) % mcq->capacity, __ATOMIC_RELEASE);
+		++polled;
+	}
+	return polled;
+}
+
+const TransportOps mock_transport = {
+	.name = "mock",
+	.fork_init = mock_fork_init,
+	.get_device_list = mock_get_device_list,
+	.free_device_list = mock_free_device_list,
+	.get_device_name = mock_get_device_name,
+	.open_device = mock_open_device,
+	.close_device = mock_close_device,
+	.query_gid = mock_query_gid,
+	.query_port = mock_query_port,
+	.query_device = mock_query_device,
+	.alloc_pd = mock_alloc_pd,
+	.dealloc_pd = mock_dealloc_pd,
+	.reg_mr = mock_reg_mr,
+	.dereg_mr = mock_dereg_mr,
+	.create_comp_channel = mock_create_comp_channel,
+	.destroy_comp_channel = mock_destroy_comp_channel,
+	.create_cq = mock_create_cq,
+	.destroy_cq = mock_destroy_cq,
+	.create_qp = mock_create_qp,
+	.modify_qp = mock_modify_qp,
+	.destroy_qp = mock_destroy_qp,
+	.post_send = mock_post_send,
+	.req_notify_cq = mock_req_notify_cq,
+	.poll_cq = mock_poll_cq,
+	.post_recv = mock_post_recv,
+	.create_srq = mock_create_srq,
+	.destroy_srq = mock_destroy_srq,
+	.post_srq_recv = mock_post_srq_recv,
+	.create_ah = mock_create_ah,
+	.destroy_ah = mock_destroy_ah,
+	.create_qp_ex = mock_create_qp_ex,
+	.qp_to_qp_ex = mock_qp_to_qp_ex
+};
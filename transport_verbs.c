@@ -0,0 +1,194 @@
+#include "transport.h"
+
+// ibv_post_send, ibv_poll_cq and friends are inline functions (and ibv_reg_mr is a macro),
+// so each verb gets a thin trampoline here.
+
+static int verbs_fork_init(void)
+{
+	return ibv_fork_init();
+}
+
+static struct ibv_device** verbs_get_device_list(int* num_devices)
+{
+	return ibv_get_device_list(num_devices);
+}
+
+static void verbs_free_device_list(struct ibv_device** list)
+{
+	ibv_free_device_list(list);
+}
+
+static const char* verbs_get_device_name(struct ibv_device* device)
+{
+	return ibv_get_device_name(device);
+}
+
+static struct ibv_context* verbs_open_device(struct ibv_device* device)
+{
+	return ibv_open_device(device);
+}
+
+static int verbs_close_device(struct ibv_context* context)
+{
+	return ibv_close_device(context);
+}
+
+static int verbs_query_gid(struct ibv_context* context, uint8_t port_num, int index, union ibv_gid* gid)
+{
+	return ibv_query_gid(context, port_num, index, gid);
+}
+
+static int verbs_query_port(struct ibv_context* context, uint8_t port_num, struct ibv_port_attr* port_attr)
+{
+	return ibv_query_port(context, port_num, port_attr);
+}
+
+static int verbs_query_device(struct ibv_context* context, struct ibv_device_attr* device_attr)
+{
+	return ibv_query_device(context, device_attr);
+}
+
+static struct ibv_pd* verbs_alloc_pd(struct ibv_context* context)
+{
+	return ibv_alloc_pd(context);
+}
+
+static int verbs_dealloc_pd(struct ibv_pd* pd)
+{
+	return ibv_dealloc_pd(pd);
+}
+
+static struct ibv_mr* verbs_reg_mr(struct ibv_pd* pd, void* addr, size_t length, int access)
+{
+	return ibv_reg_mr(pd, addr, length, access);
+}
+
+static int verbs_dereg_mr(struct ibv_mr* mr)
+{
+	return ibv_dereg_mr(mr);
+}
+
+static struct ibv_comp_channel* verbs_create_comp_channel(struct ibv_context* context)
+{
+	return ibv_create_comp_channel(context);
+}
+
+static int verbs_destroy_comp_channel(struct ibv_comp_channel* channel)
+{
+	return ibv_destroy_comp_channel(channel);
+}
+
+static struct ibv_cq* verbs_create_cq(struct ibv_context* context, int cqe, void* cq_context, struct ibv_comp_channel* channel, int comp_vector)
+{
+	return ibv_create_cq(context, cqe, cq_context, channel, comp_vector);
+}
+
+static int verbs_destroy_cq(struct ibv_cq* cq)
+{
+	return ibv_destroy_cq(cq);
+}
+
+static struct ibv_qp* verbs_create_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* qp_init_attr)
+{
+	return ibv_create_qp(pd, qp_init_attr);
+}
+
+static int verbs_modify_qp(struct ibv_qp* qp, struct ibv_qp_attr* attr, int attr_mask)
+{
+	return ibv_modify_qp(qp, attr, attr_mask);
+}
+
+static int verbs_destroy_qp(struct ibv_qp* qp)
+{
+	return ibv_destroy_qp(qp);
+}
+
+static int verbs_post_send(struct ibv_qp* qp, struct ibv_send_wr* wr, struct ibv_send_wr** bad_wr)
+{
+	return ibv_post_send(qp, wr, bad_wr);
+}
+
+static int verbs_req_notify_cq(struct ibv_cq* cq, int solicited_only)
+{
+	return ibv_req_notify_cq(cq, solicited_only);
+}
+
+static int verbs_poll_cq(struct ibv_cq* cq, int num_entries, struct ibv_wc* wc)
+{
+	return ibv_poll_cq(cq, num_entries, wc);
+}
+
+static int verbs_post_recv(struct ibv_qp* qp, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr)
+{
+	return ibv_post_recv(qp, wr, bad_wr);
+}
+
+static struct ibv_srq* verbs_create_srq(struct ibv_pd* pd, struct ibv_srq_init_attr* srq_init_attr)
+{
+	return ibv_create_srq(pd, srq_init_attr);
+}
+
+static int verbs_destroy_srq(struct ibv_srq* srq)
+{
+	return ibv_destroy_srq(srq);
+}
+
+static int verbs_post_srq_recv(struct ibv_srq* srq, struct ibv_recv_wr* wr, struct ibv_recv_wr** bad_wr)
+{
+	return ibv_post_srq_recv(srq, wr, bad_wr);
+}
+
+static struct ibv_ah* verbs_create_ah(struct ibv_pd* pd, struct ibv_ah_attr* attr)
+{
+	return ibv_create_ah(pd, attr);
+}
+
+static int verbs_destroy_ah(struct ibv_ah* ah)
+{
+	return ibv_destroy_ah(ah);
+}
+
+static struct ibv_qp* verbs_create_qp_ex(struct ibv_context* context, struct ibv_qp_init_attr_ex* qp_init_attr_ex)
+{
+	return ibv_create_qp_ex(context, qp_init_attr_ex);
+}
+
+static struct ibv_qp_ex* verbs_qp_to_qp_ex(struct ibv_qp* qp)
+{
+	return ibv_qp_to_qp_ex(qp);
+}
+
+const TransportOps verbs_transport = {
+	.name = "verbs",
+	.fork_init = verbs_fork_init,
+	.get_device_list = verbs_get_device_list,
+	.free_device_list = verbs_free_device_list,
+	.get_device_name = verbs_get_device_name,
+	.open_device = verbs_open_device,
+	.close_device = verbs_close_device,
+	.query_gid = verbs_query_gid,
+	.query_port = verbs_query_port,
+	.query_device = verbs_query_device,
+	.alloc_pd = verbs_alloc_pd,
+	.dealloc_pd = verbs_dealloc_pd,
+	.reg_mr = verbs_reg_mr,
+	.dereg_mr = verbs_dereg_mr,
+	.create_comp_channel = verbs_create_comp_channel,
+	.destroy_comp_channel = verbs_destroy_comp_channel,
+	.create_cq = verbs_create_cq,
+	.destroy_cq = verbs_destroy_cq,
+	.create_qp = verbs_create_qp,
+	.modify_qp = verbs_modify_qp,
+	.destroy_qp = verbs_destroy_qp,
+	.post_send = verbs_post_send,
+	.req_notify_cq = verbs_req_notify_cq,
+	.poll_cq = verbs_poll_cq,
+	.post_recv = verbs_post_recv,
+	.create_srq = verbs_create_srq,
+	.destroy_srq = verbs_destroy_srq,
+	.post_srq_recv = verbs_post_srq_recv,
+	.create_ah = verbs_create_ah,
+	.destroy_ah = verbs_destroy_ah,
+	.create_qp_ex = verbs_create_qp_ex,
+	.qp_to_qp_ex = verbs_qp_to_qp_ex
+};
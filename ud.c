@@ -0,0 +1,585 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "ud.h"
+#include "verbs_wrappers.h"
+#include "numa_placement.h"
+#include "transport.h"
+#include "metrics.h"
+#include "timeline.h"
+#include "detector.h"
+#include "memutils.h"
+#include "logging.h"
+
+#define UD_RECV_SLOT (UD_GRH_SIZE + UD_MESSAGE_SIZE)
+// Completions taken per poll.
+#define UD_POLL_BATCH 64
+// The server asks for a completion of every this many echoes.
+#define UD_ECHO_SIGNAL_INTERVAL 64
+#define UD_MAX_SENDS_PER_QP 64
+
+static const int UD_MODE_PROBE = 1;
+static const int UD_MODE_FLOOD = 2;
+
+static int ud_mode = 0;
+static uint32_t ud_flood_qps = UD_DEFAULT_FLOOD_QPS;
+static uint32_t ud_sends_per_qp = UD_DEFAULT_SENDS_PER_QP;
+static volatile int keep_running = 1;
+
+struct UdConnection
+{
+	uint8_t port_num;
+	struct ibv_cq* cq;
+	struct ibv_qp** qps;
+	uint32_t number_of_qps;
+	QpBatch* peer_info;
+	// The server's address, created once and used by every SEND.
+	struct ibv_ah* ah;
+	// [probe message][flood message][UD_CLIENT_RECV_RING receive slots]
+	char* buf;
+	uint32_t buf_size;
+	struct ibv_mr* mr;
+	uint64_t seq;
+	uint32_t sends_pending;
+	uint32_t next_qp;
+	uint32_t sends_per_qp;
+	struct ibv_send_wr wrs[UD_MAX_SENDS_PER_QP];
+	struct ibv_sge sge;
+	uint64_t lost;
+};
+
+struct UdServer
+{
+	uint8_t port_num;
+	struct ibv_cq* cq;
+	struct ibv_srq* srq;
+	struct ibv_qp** qps;
+	uint32_t number_of_qps;
+	QpBatch* peer_info;
+	// The client's address, created once and used by every echo.
+	struct ibv_ah* ah;
+	char* buf;
+	uint32_t buf_size;
+	struct ibv_mr* mr;
+	uint64_t received;
+	uint64_t echoed;
+	uint32_t unsignaled;
+	pthread_t echo_thread;
+	volatile int running;
+};
+
+void configure_ud(const char* spec)
+{
+	char* end = NULL;
+	if (0 == strcmp(spec, "probe"))
+	{
+		ud_mode = UD_MODE_PROBE;
+		return;
+	}
+	if (0 != strncmp(spec, "flood", 5) || ('\0' != spec[5] && ':' != spec[5]))
+	{
+		log_msg("Bad UD mode %s, expected probe or flood[:qps[:sends_per_qp]]", spec);
+		exit(-1);
+	}
+	ud_mode = UD_MODE_FLOOD;
+	if (':' == spec[5])
+	{
+		ud_flood_qps = strtoul(spec + 6, &end, 10);
+		if (':' == *end)
+		{
+			ud_sends_per_qp = strtoul(end + 1, &end, 10);
+		}
+		if ('\0' != *end || 0 == ud_flood_qps || ud_flood_qps > UD_MAX_QPS || 0 == ud_sends_per_qp || ud_sends_per_qp > UD_MAX_SENDS_PER_QP)
+		{
+			log_msg("Bad UD flood %s: expected 1-%u QPs and 1-%u SENDs per QP", spec, UD_MAX_QPS, UD_MAX_SENDS_PER_QP);
+			exit(-1);
+		}
+	}
+	log_msg("UD flood over %u QPs, %u SENDs per QP at a time", ud_flood_qps, ud_sends_per_qp);
+}
+
+uint32_t ud_requested_qps(void)
+{
+	return (UD_MODE_FLOOD == ud_mode) ? ud_flood_qps : 1;
+}
+
+static struct ibv_qp_init_attr ud_qp_init_attr(struct ibv_cq* cq, struct ibv_srq* srq, uint32_t max_recv_wr)
+{
+	struct ibv_qp_init_attr attr = {
+		.qp_context = QP_CONTEXT,
+		.send_cq = cq,
+		.recv_cq = cq,
+		.srq = srq,
+		.qp_type = IBV_QPT_UD,
+		.sq_sig_all = 0,
+		.cap.max_send_sge = 1,
+		.cap.max_recv_sge = 1,
+		.cap.max_recv_wr = max_recv_wr,
+		.cap.max_send_wr = UD_SEND_QUEUE,
+		.cap.max_inline_data = UD_MESSAGE_SIZE
+	};
+	return attr;
+}
+
+// UD QPs need no peer to go to RTS: the destination comes with every SEND.
+static void setup_ud_qp(struct ibv_qp* qp, uint8_t port_num)
+{
+	struct ibv_qp_attr attr = {
+		.qp_state = IBV_QPS_INIT,
+		.pkey_index = 0,
+		.port_num = port_num,
+		.qkey = UD_QKEY
+	};
+	if (0 != transport->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT | IBV_QP_QKEY))
+	{
+		log_msg("Failed to change UD QP states: RESET -> INIT");
+		exit(-1);
+	}
+	attr.qp_state = IBV_QPS_RTR;
+	if (0 != transport->modify_qp(qp, &attr, IBV_QP_STATE))
+	{
+		log_msg("Failed to change UD QP states: INIT -> RTR");
+		exit(-1);
+	}
+	attr.qp_state = IBV_QPS_RTS;
+	attr.sq_psn = 1;
+	if (0 != transport->modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_SQ_PSN))
+	{
+		log_msg("Failed to change UD QP states: RTR -> RTS");
+		exit(-1);
+	}
+}
+
+static void post_recv_slot(UdConnection* ud, uint32_t slot)
+{
+	struct ibv_sge sge = {
+		.addr = (uint64_t)(ud->buf + 2 * UD_MESSAGE_SIZE + slot * UD_RECV_SLOT),
+		.length = UD_RECV_SLOT,
+		.lkey = ud->mr->lkey
+	};
+	struct ibv_recv_wr wr = {
+		.wr_id = slot,
+		.next = NULL,
+		.sg_list = &sge,
+		.num_sge = 1
+	};
+	do_post_recv(ud->qps[0], &wr);
+}
+
+UdConnection* ud_connect(ClientConnection* conn, uint32_t number_of_qps)
+{
+	ClientLane* lane = &conn->lanes[0];
+	UdConnection* ud = do_malloc(sizeof(*ud));
+	memset(ud, 0, sizeof(*ud));
+	ud->port_num = lane->endpoint.port;
+	ud->number_of_qps = number_of_qps;
+	ud->sends_per_qp = ud_sends_per_qp;
+	ud->peer_info = receive_qp_batch_from_peer(conn->sock);
+
+	ud->cq = create_cq(lane->dev_ctx, CQE_SIZE, NULL, NULL, select_comp_vector(lane->dev_ctx, get_placement_node()));
+	ud->qps = do_malloc(number_of_qps * sizeof(*ud->qps));
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		// Only the first QP sends probes, so only it needs receives for the echoes.
+		struct ibv_qp_init_attr attr = ud_qp_init_attr(ud->cq, NULL, (0 == i) ? UD_CLIENT_RECV_RING : 1);
+		ud->qps[i] = create_qp(lane->pd, &attr);
+		setup_ud_qp(ud->qps[i], ud->port_num);
+	}
+	log_msg("[UD] %u UD QPs are ready", number_of_qps);
+
+	ud->buf_size = 2 * UD_MESSAGE_SIZE + UD_CLIENT_RECV_RING * UD_RECV_SLOT;
+	ud->buf = alloc_mr(ud->buf_size);
+	memset(ud->buf, 0, ud->buf_size);
+	ud->mr = register_mr(lane->pd, ud->buf, ud->buf_size, IBV_ACCESS_LOCAL_WRITE);
+	for (uint32_t slot = 0 ; slot < UD_CLIENT_RECV_RING ; ++slot)
+	{
+		post_recv_slot(ud, slot);
+	}
+	ud->ah = create_ah(lane->pd, ud->peer_info->port_lid, ud->port_num);
+
+	// The flood's WRs differ only in their destination QP, which is patched per QP.
+	ud->sge.addr = (uint64_t)(ud->buf + UD_MESSAGE_SIZE);
+	ud->sge.length = UD_MESSAGE_SIZE;
+	ud->sge.lkey = ud->mr->lkey;
+	for (uint32_t i = 0 ; i < UD_MAX_SENDS_PER_QP ; ++i)
+	{
+		struct ibv_send_wr* wr = &ud->wrs[i];
+		wr->wr_id = 0;
+		wr->next = (i + 1 < UD_MAX_SENDS_PER_QP) ? &ud->wrs[i + 1] : NULL;
+		wr->sg_list = &ud->sge;
+		wr->num_sge = 1;
+		wr->opcode = IBV_WR_SEND;
+		wr->send_flags = IBV_SEND_INLINE;
+		wr->wr.ud.ah = ud->ah;
+		wr->wr.ud.remote_qkey = ud->peer_info->qkey;
+	}
+
+	send_qp_batch_to_peer(conn->sock, ud->qps, number_of_qps, lane->dev_ctx, ud->port_num, UD_QKEY);
+	return ud;
+}
+
+void ud_disconnect(UdConnection* ud)
+{
+	if (NULL == ud)
+	{
+		return;
+	}
+	if (ud->lost > 0)
+	{
+		log_msg("[UD] %llu probes were lost", ud->lost);
+	}
+	for (uint32_t i = 0 ; i < ud->number_of_qps ; ++i)
+	{
+		destroy_qp(ud->qps[i]);
+	}
+	destroy_ah(ud->ah);
+	dereg_mr(ud->mr);
+	free_mr(ud->buf, ud->buf_size);
+	destroy_cq(ud->cq);
+	free(ud->qps);
+	free(ud->peer_info);
+	free(ud);
+}
+
+// Handles a client completion. Returns the sequence number of an echo, 0 for anything else.
+static uint64_t client_completion(UdConnection* ud, const struct ibv_wc* wc)
+{
+	if (IBV_WC_RECV != wc->opcode)
+	{
+		--ud->sends_pending;
+		return 0;
+	}
+	uint32_t slot = wc->wr_id;
+	const UdMessage* msg = (const UdMessage*)(ud->buf + 2 * UD_MESSAGE_SIZE + slot * UD_RECV_SLOT + UD_GRH_SIZE);
+	uint64_t seq = msg->seq;
+	post_recv_slot(ud, slot);
+	return seq;
+}
+
+static uint64_t mono_now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+uint64_t ud_probe(UdConnection* ud)
+{
+	UdMessage* msg = (UdMessage*)ud->buf;
+	msg->seq = ++ud->seq;
+	msg->flags = UD_ECHO;
+	struct ibv_sge sge = {
+		.addr = (uint64_t)ud->buf,
+		.length = UD_MESSAGE_SIZE,
+		.lkey = ud->mr->lkey
+	};
+	struct ibv_send_wr wr = {
+		.wr_id = msg->seq,
+		.next = NULL,
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = IBV_WR_SEND,
+		.send_flags = IBV_SEND_SIGNALED | IBV_SEND_INLINE,
+		.wr.ud.ah = ud->ah,
+		.wr.ud.remote_qpn = ud->peer_info->qp_nums[0],
+		.wr.ud.remote_qkey = ud->peer_info->qkey
+	};
+
+	uint64_t start = mono_now_ns();
+	uint64_t deadline = start + (uint64_t)UD_PROBE_TIMEOUT_MS * 1000000;
+	uint64_t echo_ns = 0;
+	do_post_send(ud->qps[0], &wr, 1);
+	++ud->sends_pending;
+	// The SEND always completes locally; only its echo may never come.
+	struct ibv_wc wc[UD_POLL_BATCH];
+	while (0 == echo_ns || 0 != ud->sends_pending)
+	{
+		int ne = do_cq_poll(ud->qps[0], wc, UD_POLL_BATCH);
+		uint64_t now = mono_now_ns();
+		for (int i = 0 ; i < ne ; ++i)
+		{
+			// Late echoes of lost probes are dropped.
+			if (client_completion(ud, &wc[i]) == ud->seq && 0 == echo_ns)
+			{
+				echo_ns = now;
+			}
+		}
+		if (0 == echo_ns && 0 == ud->sends_pending && now > deadline)
+		{
+			++ud->lost;
+			return 0;
+		}
+	}
+	return echo_ns - start;
+}
+
+uint32_t ud_flood_step(UdConnection* ud, uint32_t max_sends)
+{
+	uint32_t sent = 0;
+	for (uint32_t k = 0 ; k < ud->number_of_qps && sent < max_sends ; ++k)
+	{
+		uint32_t qp_idx = ud->next_qp;
+		ud->next_qp = (ud->next_qp + 1) % ud->number_of_qps;
+		uint32_t n = (max_sends - sent < ud->sends_per_qp) ? max_sends - sent : ud->sends_per_qp;
+		uint32_t remote_qpn = ud->peer_info->qp_nums[qp_idx % ud->peer_info->number_of_qps];
+		for (uint32_t i = 0 ; i < n ; ++i)
+		{
+			ud->wrs[i].wr.ud.remote_qpn = remote_qpn;
+			ud->wrs[i].send_flags = IBV_SEND_INLINE;
+		}
+		// One completion per chain.
+		struct ibv_send_wr* last = &ud->wrs[n - 1];
+		struct ibv_send_wr* next = last->next;
+		last->send_flags |= IBV_SEND_SIGNALED;
+		last->next = NULL;
+		do_post_send(ud->qps[qp_idx], ud->wrs, n);
+		last->next = next;
+		++ud->sends_pending;
+		sent += n;
+	}
+	struct ibv_wc wc[UD_POLL_BATCH];
+	while (0 != ud->sends_pending)
+	{
+		int ne = do_cq_poll(ud->qps[0], wc, UD_POLL_BATCH);
+		for (int i = 0 ; i < ne ; ++i)
+		{
+			client_completion(ud, &wc[i]);
+		}
+	}
+	return sent;
+}
+
+static void sigint_handler(int value)
+{
+	keep_running = 0;
+}
+
+static void probe_loop(UdConnection* ud)
+{
+	metrics_register_thread("ud_probe");
+	LatencyDetector* detector = do_malloc(sizeof(*detector));
+	detector_init(detector, "ud_probe", UD_PROBE_INTERVAL_US);
+	uint64_t i = 0;
+	while (keep_running)
+	{
+		uint64_t diff = ud_probe(ud);
+		uint64_t now = timeline_now_ns();
+		if (0 == diff)
+		{
+			timeline_record_at(now, "ud_probe", "lost", 1);
+			log_msg("%10llu) lost", i);
+		}
+		else
+		{
+			histogram_record(&thread_metrics->latency_ns, diff);
+			timeline_record_at(now, "ud_probe", "rtt_us", diff / 1000.0);
+			detector_add(detector, now, diff);
+			__atomic_store_n(&thread_metrics->alarms, detector_alarms(detector), __ATOMIC_RELAXED);
+			log_msg("%10llu) %llu", i, diff / 1000);
+		}
+		usleep(UD_PROBE_INTERVAL_US); // Sleeping to ensure the cache is flushed.
+		++i;
+	}
+	free(detector);
+}
+
+static void flood_loop(UdConnection* ud)
+{
+	metrics_register_thread("ud_flood");
+	uint64_t last_report = mono_now_ns();
+	uint64_t sends_since_report = 0;
+	while (keep_running)
+	{
+		sends_since_report += ud_flood_step(ud, UINT32_MAX);
+		uint64_t now = mono_now_ns();
+		if (now - last_report >= 1000000000)
+		{
+			double rate = sends_since_report * 1e9 / (now - last_report);
+			timeline_record("ud_flood", "sends_per_sec", rate);
+			log_msg("[UD] %.0f SENDs/s over %u QPs", rate, ud->number_of_qps);
+			sends_since_report = 0;
+			last_report = now;
+		}
+	}
+}
+
+void logic_ud(ClientConnection* conn)
+{
+	__sighandler_t prev = signal(SIGINT, sigint_handler);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+	log_msg("%s over UD infinitely use Ctrl+C (SIGINT) to stop...", (UD_MODE_FLOOD == ud_mode) ? "Flooding" : "Probing");
+	if (UD_MODE_FLOOD == ud_mode)
+	{
+		flood_loop(conn->ud);
+	}
+	else
+	{
+		probe_loop(conn->ud);
+	}
+	prev = signal(SIGINT, prev);
+	if (SIG_ERR == prev)
+	{
+		log_msg("Failed to set signal. Leaving...");
+		exit(-1);
+	}
+}
+
+static void post_srq_slots(UdServer* server, const uint32_t* slots, uint32_t count)
+{
+	struct ibv_sge sges[UD_POLL_BATCH];
+	struct ibv_recv_wr wrs[UD_POLL_BATCH];
+	for (uint32_t i = 0 ; i < count ; ++i)
+	{
+		sges[i].addr = (uint64_t)(server->buf + slots[i] * UD_RECV_SLOT);
+		sges[i].length = UD_RECV_SLOT;
+		sges[i].lkey = server->mr->lkey;
+		wrs[i].wr_id = slots[i];
+		wrs[i].next = (i + 1 < count) ? &wrs[i + 1] : NULL;
+		wrs[i].sg_list = &sges[i];
+		wrs[i].num_sge = 1;
+	}
+	do_post_srq_recv(server->srq, wrs);
+}
+
+// Echoes from the first QP, the one probes are sent to. Echoes are sent inline, straight out of
+// the receive buffer, so it can be reposted right away.
+static void echo(UdServer* server, const struct ibv_wc* wc, const char* msg)
+{
+	struct ibv_sge sge = {
+		.addr = (uint64_t)msg,
+		.length = UD_MESSAGE_SIZE,
+		.lkey = server->mr->lkey
+	};
+	struct ibv_send_wr wr = {
+		.wr_id = 0,
+		.next = NULL,
+		.sg_list = &sge,
+		.num_sge = 1,
+		.opcode = IBV_WR_SEND,
+		.send_flags = IBV_SEND_INLINE,
+		.wr.ud.ah = server->ah,
+		.wr.ud.remote_qpn = wc->src_qp,
+		.wr.ud.remote_qkey = server->peer_info->qkey
+	};
+	if (++server->unsignaled == UD_ECHO_SIGNAL_INTERVAL)
+	{
+		wr.send_flags |= IBV_SEND_SIGNALED;
+		server->unsignaled = 0;
+	}
+	do_post_send(server->qps[0], &wr, 1);
+	++server->echoed;
+}
+
+// Busy polls, so echoes go out as soon as their probes arrive.
+static void* echo_loop(void* arg)
+{
+	UdServer* server = arg;
+	struct ibv_wc wc[UD_POLL_BATCH];
+	uint32_t slots[UD_POLL_BATCH];
+	while (server->running)
+	{
+		int ne = do_cq_poll(server->qps[0], wc, UD_POLL_BATCH);
+		uint32_t count = 0;
+		for (int i = 0 ; i < ne ; ++i)
+		{
+			if (IBV_WC_RECV != wc[i].opcode)
+			{
+				continue;
+			}
+			++server->received;
+			const char* msg = server->buf + wc[i].wr_id * UD_RECV_SLOT + UD_GRH_SIZE;
+			if (((const UdMessage*)msg)->flags & UD_ECHO)
+			{
+				echo(server, &wc[i], msg);
+			}
+			slots[count++] = wc[i].wr_id;
+		}
+		if (count > 0)
+		{
+			post_srq_slots(server, slots, count);
+		}
+	}
+	return NULL;
+}
+
+UdServer* ud_server_create(int sock, struct ibv_context* dev_ctx, struct ibv_pd* pd, uint8_t port_num, uint32_t number_of_qps)
+{
+	if (number_of_qps > UD_MAX_QPS)
+	{
+		log_msg("Peer asked for %u UD QPs, at most %u are supported! leaving...", number_of_qps, UD_MAX_QPS);
+		exit(-1);
+	}
+	UdServer* server = do_malloc(sizeof(*server));
+	memset(server, 0, sizeof(*server));
+	server->port_num = port_num;
+	server->number_of_qps = number_of_qps;
+	server->cq = create_cq(dev_ctx, CQE_SIZE, NULL, NULL, select_comp_vector(dev_ctx, get_placement_node()));
+	server->srq = create_srq(pd, UD_SRQ_SIZE);
+	server->buf_size = UD_SRQ_SIZE * UD_RECV_SLOT;
+	server->buf = alloc_mr(server->buf_size);
+	server->mr = register_mr(pd, server->buf, server->buf_size, IBV_ACCESS_LOCAL_WRITE);
+	uint32_t slots[UD_POLL_BATCH];
+	for (uint32_t slot = 0 ; slot < UD_SRQ_SIZE ; )
+	{
+		uint32_t count = 0;
+		for ( ; count < UD_POLL_BATCH && slot < UD_SRQ_SIZE ; ++count, ++slot)
+		{
+			slots[count] = slot;
+		}
+		post_srq_slots(server, slots, count);
+	}
+
+	server->qps = do_malloc(number_of_qps * sizeof(*server->qps));
+	for (uint32_t i = 0 ; i < number_of_qps ; ++i)
+	{
+		struct ibv_qp_init_attr attr = ud_qp_init_attr(server->cq, server->srq, 0);
+		server->qps[i] = create_qp(pd, &attr);
+		setup_ud_qp(server->qps[i], port_num);
+	}
+	log_msg("[UD] %u UD QPs share an SRQ of %u receives", number_of_qps, UD_SRQ_SIZE);
+	send_qp_batch_to_peer(sock, server->qps, number_of_qps, dev_ctx, port_num, UD_QKEY);
+	server->peer_info = receive_qp_batch_from_peer(sock);
+	server->ah = create_ah(pd, server->peer_info->port_lid, port_num);
+
+	server->running = 1;
+	int ans = pthread_create(&server->echo_thread, NULL, echo_loop, server);
+	if (0 != ans)
+	{
+		log_msg("Failed to create the UD echo thread! errno = %s", strerror(ans));
+		exit(-1);
+	}
+	return server;
+}
+
+void ud_server_destroy(UdServer* server)
+{
+	if (NULL == server)
+	{
+		return;
+	}
+	server->running = 0;
+	pthread_join(server->echo_thread, NULL);
+	log_msg("[UD] Received %llu messages, echoed %llu", server->received, server->echoed);
+	for (uint32_t i = 0 ; i < server->number_of_qps ; ++i)
+	{
+		destroy_qp(server->qps[i]);
+	}
+	destroy_srq(server->srq);
+	destroy_ah(server->ah);
+	dereg_mr(server->mr);
+	free_mr(server->buf, server->buf_size);
+	destroy_cq(server->cq);
+	free(server->qps);
+	free(server->peer_info);
+	free(server);
+}
@@ -1,6 +1,13 @@
 #include "verbs_wrappers.h"
+#include "numa_placement.h"
+#include "memutils.h"
+#include "cm.h"
+#include "transport.h"
+#include "metrics.h"
 
 void* const QP_CONTEXT = (void*)0x12345678;
+const uint32_t QP_MAX_SEND_WR = 2048;
+int use_wr_builder = 0;
 
 struct ibv_qp_init_attr create_qp_init_attr(struct ibv_cq* cq)
 {
@@ -12,11 +19,12 @@ struct ibv_qp_init_attr create_qp_init_attr(struct ibv_cq* cq)
 		.recv_cq = cq,
 		.srq = NULL,
 		.qp_type = qptype,
-		.sq_sig_all = 1,
+		// WRs ask for their own completions (IBV_SEND_SIGNALED), so callers can signal selectively.
+		.sq_sig_all = 0,
 		.cap.max_send_sge = 10,
 		.cap.max_recv_sge = 10,
 		.cap.max_recv_wr = 10,
-		.cap.max_send_wr = 2048,
+		.cap.max_send_wr = QP_MAX_SEND_WR,
 		.cap.max_inline_data = 32
 	};
 
@@ -26,7 +34,7 @@ struct ibv_qp_init_attr create_qp_init_attr(struct ibv_cq* cq)
 void destroy_qp(struct ibv_qp* qp)
 {
 	log_msg("Destroying QP now");
-	if (0 != ibv_destroy_qp(qp))
+	if (0 != transport->destroy_qp(qp))
 	{
 		log_msg("Failed to destroy QP!");
 		exit(-1);
@@ -37,7 +45,7 @@ void destroy_qp(struct ibv_qp* qp)
 struct ibv_qp* create_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* attr)
 {
 	log_msg("Creating QP!\n\tpd = %p\n\tattr = %p", pd, attr);
-	struct ibv_qp* qp = ibv_create_qp(pd, attr);
+	struct ibv_qp* qp = transport->create_qp(pd, attr);
 	if (NULL == qp)
 	{
 		log_msg("Failed to create QP!");
@@ -47,10 +55,91 @@ struct ibv_qp* create_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* attr)
 	return qp;
 }
 
+struct ibv_qp* create_builder_qp(struct ibv_pd* pd, struct ibv_qp_init_attr* attr)
+{
+	log_msg("Creating extended QP!\n\tpd = %p\n\tattr = %p", pd, attr);
+	struct ibv_qp_init_attr_ex attr_ex = {
+		.qp_context = attr->qp_context,
+		.send_cq = attr->send_cq,
+		.recv_cq = attr->recv_cq,
+		.srq = attr->srq,
+		.cap = attr->cap,
+		.qp_type = attr->qp_type,
+		.sq_sig_all = attr->sq_sig_all,
+		.comp_mask = IBV_QP_INIT_ATTR_PD | IBV_QP_INIT_ATTR_SEND_OPS_FLAGS,
+		.pd = pd,
+		// A UD QP can only send.
+		.send_ops_flags = (IBV_QPT_UD == attr->qp_type) ? IBV_QP_EX_WITH_SEND : IBV_QP_EX_WITH_RDMA_READ | IBV_QP_EX_WITH_RDMA_WRITE | IBV_QP_EX_WITH_SEND
+	};
+	struct ibv_qp* qp = transport->create_qp_ex(pd->context, &attr_ex);
+	if (NULL == qp)
+	{
+		log_msg("Failed to create extended QP! errno = %s (%d)", strerror(errno), errno);
+		exit(-1);
+	}
+	log_msg("QP created successfully!");
+	return qp;
+}
+
+struct ibv_srq* create_srq(struct ibv_pd* pd, uint32_t max_wr)
+{
+	log_msg("Creating SRQ!\n\tpd = %p\n\tmax_wr = %u", pd, max_wr);
+	struct ibv_srq_init_attr attr = {
+		.srq_context = NULL,
+		.attr.max_wr = max_wr,
+		.attr.max_sge = 1
+	};
+	struct ibv_srq* srq = transport->create_srq(pd, &attr);
+	if (NULL == srq)
+	{
+		log_msg("Failed to create SRQ! errno = %s (%d)", strerror(errno), errno);
+		exit(-1);
+	}
+	log_msg("SRQ created successfully!");
+	return srq;
+}
+
+void destroy_srq(struct ibv_srq* srq)
+{
+	if (0 != transport->destroy_srq(srq))
+	{
+		log_msg("Failed to destroy SRQ!");
+		exit(-1);
+	}
+}
+
+struct ibv_ah* create_ah(struct ibv_pd* pd, uint16_t dlid, uint8_t port_num)
+{
+	struct ibv_ah_attr attr = {
+		.dlid = dlid,
+		.sl = 0,
+		.src_path_bits = 0,
+		.is_global = 0,
+		.port_num = port_num
+	};
+	struct ibv_ah* ah = transport->create_ah(pd, &attr);
+	if (NULL == ah)
+	{
+		log_msg("Failed to create an address handle for LID %hu! errno = %s (%d)", dlid, strerror(errno), errno);
+		exit(-1);
+	}
+	log_msg("Created an address handle for LID %hu", dlid);
+	return ah;
+}
+
+void destroy_ah(struct ibv_ah* ah)
+{
+	if (0 != transport->destroy_ah(ah))
+	{
+		log_msg("Failed to destroy address handle!");
+		exit(-1);
+	}
+}
+
 struct ibv_comp_channel* create_comp_channel(struct ibv_context* ctx)
 {
 	log_msg("Creating completion channel!\n\tctx = %p", ctx);
-	struct ibv_comp_channel* cch = ibv_create_comp_channel(ctx);
+	struct ibv_comp_channel* cch = transport->create_comp_channel(ctx);
 	if (NULL == cch)
 	{
 		log_msg("Failed to create completion channel");
@@ -63,7 +152,7 @@ struct ibv_comp_channel* create_comp_channel(struct ibv_context* ctx)
 void destroy_comp_channel(struct ibv_comp_channel* ch)
 {
 	log_msg("Destroying completion channel!\n\tch = %p", ch);
-	if (0 != ibv_destroy_comp_channel(ch))
+	if (0 != transport->destroy_comp_channel(ch))
 	{	
 		log_msg("Failed to destroy completion channel");
 		exit(-1);
@@ -74,7 +163,7 @@ void destroy_comp_channel(struct ibv_comp_channel* ch)
 struct ibv_cq* create_cq(struct ibv_context* ctx, int cqe, void* cq_context, struct ibv_comp_channel* ch, int comp_vector)
 {
 	log_msg("Creating CQ!\n\tcontext = %p\n\tcqe = %d\n\t private context = %p\n\tcompletion channel = %p\n\tcompletion vector = %d", ctx, cqe, cq_context, ch, comp_vector);
-	struct ibv_cq* cq = ibv_create_cq(ctx, cqe, cq_context, ch, comp_vector);
+	struct ibv_cq* cq = transport->create_cq(ctx, cqe, cq_context, ch, comp_vector);
 	if (NULL == cq)
 	{	
 		log_msg("Failed to create CQ!");
@@ -87,7 +176,7 @@ struct ibv_cq* create_cq(struct ibv_context* ctx, int cqe, void* cq_context, str
 void destroy_cq(struct ibv_cq* cq)
 {
 	log_msg("Destroying CQ!\n\tcq = %p", cq);
-	if (0 != ibv_destroy_cq(cq))	
+	if (0 != transport->destroy_cq(cq))	
 	{
 		log_msg("Failed to destroy CQ");
 		exit(-1);
@@ -99,7 +188,7 @@ void destroy_cq(struct ibv_cq* cq)
 void dealloc_pd(struct ibv_pd* pd)
 {
 	log_msg("Deallocating PD:\n\tpd = %p", pd);
-	if (0 != ibv_dealloc_pd(pd))
+	if (0 != transport->dealloc_pd(pd))
 	{
 		log_msg("Failed to deallocate pd!");
 		exit(-1);
@@ -110,7 +199,7 @@ void dealloc_pd(struct ibv_pd* pd)
 void dereg_mr(struct ibv_mr* mr)
 {
 	log_msg("Deregistering MR:\n\tmr = %p", mr);
-	if (0 != ibv_dereg_mr(mr))
+	if (0 != transport->dereg_mr(mr))
 	{
 		log_msg("Failed to deregister MR");
 		exit(-1);
@@ -122,31 +211,38 @@ struct ibv_mr* register_mr(struct ibv_pd* pd, void* buf, size_t buf_len, enum ib
 	log_msg("Trying to register MR:");
 	log_msg("\tpd = %p\n\tbuf = %p\n\tbuf_len = %u\n\taccess = %u", pd, buf, buf_len, access);
 
-	struct ibv_mr* ret_val = ibv_reg_mr(pd, buf, buf_len, access);
+	struct ibv_mr* ret_val = transport->reg_mr(pd, buf, buf_len, access);
 	if (NULL == ret_val)
 	{
 		log_msg("Failed to register MR! errno: %s (%u)", strerror(errno), errno);
 		exit(-1);
 	}
 	log_msg("MR Register finished successfully!");
+	check_memory_placement("MR", buf);
 	return ret_val;
 }
 void* alloc_mr(unsigned int size)
 {
 	log_msg("Allocating MR of size %u", size);
-	void* mr = malloc(size);
-	if (NULL == mr)
+	void* mr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (MAP_FAILED == mr)
 	{
 		log_msg("Failed to allocate MR!");
 		exit(-1);
 	}
+	bind_memory_to_node(mr, size, get_placement_node());
 	log_msg("Allocated MR successfully!");
 	return mr;
 }
 
+void free_mr(void* mr, unsigned int size)
+{
+	free_at_addr(mr, size);
+}
+
 struct ibv_pd* alloc_pd(struct ibv_context* ctx)
 {
-	struct ibv_pd* ret_val = ibv_alloc_pd(ctx);
+	struct ibv_pd* ret_val = transport->alloc_pd(ctx);
 	if (NULL == ret_val)
 	{
 		log_msg("Failed to alloc pd");
@@ -159,7 +255,7 @@ struct ibv_pd* alloc_pd(struct ibv_context* ctx)
 struct ibv_device** get_device_list()
 {
 	int num_devices = 0;
-	struct ibv_device** devlist = ibv_get_device_list(&num_devices);
+	struct ibv_device** devlist = transport->get_device_list(&num_devices);
 	if (NULL == devlist)
 	{
 		log_msg("Failed to get device list");
@@ -169,11 +265,24 @@ struct ibv_device** get_device_list()
 	return devlist;
 }
 
-struct ibv_context* get_dev_context()
+struct ibv_context* get_dev_context(const char* requested_name, uint8_t port_num)
 {
 	struct ibv_device** devlist = get_device_list();
-	struct ibv_device* dev = devlist[0];
-	const char* dev_name = ibv_get_device_name(dev);
+	struct ibv_device* dev = NULL;
+	for (int i = 0 ; NULL != devlist[i] ; ++i)
+	{
+		if (NULL == requested_name || '\0' == requested_name[0] || 0 == strcmp(transport->get_device_name(devlist[i]), requested_name))
+		{
+			dev = devlist[i];
+			break;
+		}
+	}
+	if (NULL == dev)
+	{
+		log_msg("Device %s not found! leaving", (NULL == requested_name || '\0' == requested_name[0]) ? "(any)" : requested_name);
+		exit(-1);
+	}
+	const char* dev_name = transport->get_device_name(dev);
 	if (NULL == dev_name)
 	{
 		log_msg("Failed to get device name! leaving");
@@ -183,8 +292,8 @@ struct ibv_context* get_dev_context()
 
 	log_msg("Picked device: %s", dev_name);
 
-	struct ibv_context* dev_ctx = ibv_open_device(dev);
-	ibv_free_device_list(devlist);
+	struct ibv_context* dev_ctx = transport->open_device(dev);
+	transport->free_device_list(devlist);
 
 	if (NULL == dev_ctx)
 	{
@@ -193,26 +302,26 @@ struct ibv_context* get_dev_context()
 	}
 	log_msg("Sucess - context ptr = %p", dev_ctx);
 	union ibv_gid gid;
-	if (0 != ibv_query_gid(dev_ctx, 1, 0, &gid))
+	if (0 != transport->query_gid(dev_ctx, port_num, 0, &gid))
 	{
 		log_msg("ibv_query_gid failed");
 		exit(-1);
 	}
-	log_msg("Device port 1 gid 0 = %llx : %llx", gid.global.subnet_prefix, gid.global.interface_id);
+	log_msg("Device port %hhu gid 0 = %llx : %llx", port_num, gid.global.subnet_prefix, gid.global.interface_id);
 
 	return dev_ctx;
 }
 
 void do_close_device(struct ibv_context* dev_ctx)
 {
-	if (ibv_close_device(dev_ctx))
+	if (transport->close_device(dev_ctx))
 	{
 		log_msg("Failed to close device!");
 		exit(-1);
 	}
 }
 
-void do_rdma_read(void* remote_address, void* local_address, uint32_t rkey, uint32_t lkey, uint32_t size, struct ibv_qp* qp)
+void do_rdma_op(enum ibv_wr_opcode opcode, uint64_t wr_id, void* remote_address, void* local_address, uint32_t rkey, uint32_t lkey, uint32_t size, struct ibv_qp* qp)
 {
 	struct ibv_sge sge_entry = {
 		.addr = (uint64_t)local_address,
@@ -221,28 +330,72 @@ void do_rdma_read(void* remote_address, void* local_address, uint32_t rkey, uint
 	};
 	struct ibv_send_wr* bad_wr = NULL;
 	struct ibv_send_wr wr = {
-		.wr_id = 1,
+		.wr_id = wr_id,
 		.next = NULL,
 		.sg_list = &sge_entry,
 		.num_sge = 1,
-		.opcode = IBV_WR_RDMA_READ,
-		.send_flags = 0,
+		.opcode = opcode,
+		.send_flags = IBV_SEND_SIGNALED,
 		.wr.rdma.remote_addr = (uint64_t)remote_address,
 		.wr.rdma.rkey = rkey
 	};
-	int	ans = ibv_req_notify_cq(qp->send_cq, 0);
+	int	ans = transport->req_notify_cq(qp->send_cq, 0);
 	if (0 != ans)
 	{
 		log_msg("Failed to req_notify_cq! errno = %s (%d)", strerror(ans), ans);
 		exit(-1);
 	}
-	ans = ibv_post_send(qp, &wr, &bad_wr);
+	ans = transport->post_send(qp, &wr, &bad_wr);
 	if (0 != ans)
 	{
+		metrics_add(&thread_metrics->errors, 1);
 		log_msg("Failed to post_send! errno = %s (%d)", strerror(ans), ans);
 		exit(-1);
 	}
+	metrics_add(&thread_metrics->ops, 1);
+
+}
 
+void do_rdma_read(void* remote_address, void* local_address, uint32_t rkey, uint32_t lkey, uint32_t size, struct ibv_qp* qp)
+{
+	do_rdma_op(IBV_WR_RDMA_READ, 1, remote_address, local_address, rkey, lkey, size, qp);
+}
+
+void do_post_send(struct ibv_qp* qp, struct ibv_send_wr* wr, uint32_t number_of_wrs)
+{
+	struct ibv_send_wr* bad_wr = NULL;
+	int ans = transport->post_send(qp, wr, &bad_wr);
+	if (0 != ans)
+	{
+		metrics_add(&thread_metrics->errors, 1);
+		log_msg("Failed to post_send! errno = %s (%d)", strerror(ans), ans);
+		exit(-1);
+	}
+	metrics_add(&thread_metrics->ops, number_of_wrs);
+}
+
+void do_post_recv(struct ibv_qp* qp, struct ibv_recv_wr* wr)
+{
+	struct ibv_recv_wr* bad_wr = NULL;
+	int ans = transport->post_recv(qp, wr, &bad_wr);
+	if (0 != ans)
+	{
+		metrics_add(&thread_metrics->errors, 1);
+		log_msg("Failed to post_recv! errno = %s (%d)", strerror(ans), ans);
+		exit(-1);
+	}
+}
+
+void do_post_srq_recv(struct ibv_srq* srq, struct ibv_recv_wr* wr)
+{
+	struct ibv_recv_wr* bad_wr = NULL;
+	int ans = transport->post_srq_recv(srq, wr, &bad_wr);
+	if (0 != ans)
+	{
+		metrics_add(&thread_metrics->errors, 1);
+		log_msg("Failed to post_srq_recv! errno = %s (%d)", strerror(ans), ans);
+		exit(-1);
+	}
 }
 
 void do_cq_empty(struct ibv_qp* qp, uint32_t num_events)
@@ -251,18 +404,54 @@ void do_cq_empty(struct ibv_qp* qp, uint32_t num_events)
 	while ( i < num_events )
 	{
 		struct ibv_wc wc;
-		int ne = ibv_poll_cq(qp->send_cq, 1, &wc);
-//		if (!ne)  break;
+		int ne = transport->poll_cq(qp->send_cq, 1, &wc);
+		metrics_add(&thread_metrics->cq_polls, 1);
+		if (!ne)
+		{
+			metrics_add(&thread_metrics->cq_empty_polls, 1);
+			continue;
+		}
 		if (ne < 0)
 		{
+			metrics_add(&thread_metrics->errors, 1);
 			log_msg("Error in ibv_poll_cq! Value returned = %d", ne);
 			exit(-1);
 		}
 		if (wc.status != IBV_WC_SUCCESS)
 		{
+			metrics_add(&thread_metrics->errors, 1);
 			log_msg("Received WQE but the WR failed! Status = %s (%d)", ibv_wc_status_str(wc.status), wc.status);
 			exit(-1);
 		}
+		metrics_add(&thread_metrics->completions, ne);
 		i += ne;
 	}
-}
\ No newline at end of file
+}
+
+int do_cq_poll(struct ibv_qp* qp, struct ibv_wc* wc, int max_events)
+{
+	int ne = transport->poll_cq(qp->send_cq, max_events, wc);
+	metrics_add(&thread_metrics->cq_polls, 1);
+	if (ne < 0)
+	{
+		metrics_add(&thread_metrics->errors, 1);
+		log_msg("Error in ibv_poll_cq! Value returned = %d", ne);
+		exit(-1);
+	}
+	if (0 == ne)
+	{
+		metrics_add(&thread_metrics->cq_empty_polls, 1);
+		return 0;
+	}
+	for (int i = 0 ; i < ne ; ++i)
+	{
+		if (wc[i].status != IBV_WC_SUCCESS)
+		{
+			metrics_add(&thread_metrics->errors, 1);
+			log_msg("Received WQE but the WR failed! Status = %s (%d)", ibv_wc_status_str(wc[i].status), wc[i].status);
+			exit(-1);
+		}
+	}
+	metrics_add(&thread_metrics->completions, ne);
+	return ne;
+}
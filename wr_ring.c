@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "wr_ring.h"
+#include "verbs_wrappers.h"
+#include "geometry.h"
+#include "transport.h"
+#include "metrics.h"
+#include "memutils.h"
+#include "logging.h"
+
+void wr_ring_init(WrRing* ring, ClientLane* lane)
+{
+	ConnectionInfoExchange* peer_info = lane->peer_info;
+	uint32_t number_of_regions = peer_info->header.number_of_mrs;
+	memset(ring, 0, sizeof(*ring));
+	ring->number_of_regions = number_of_regions;
+	ring->stride = geometry.prefetch_group_size;
+	ring->region_addrs = do_malloc_aligned(number_of_regions * sizeof(*ring->region_addrs));
+	ring->region_rkeys = do_malloc_aligned(number_of_regions * sizeof(*ring->region_rkeys));
+	ring->region_reads = do_malloc_aligned(number_of_regions * sizeof(*ring->region_reads));
+	for (uint32_t i = 0 ; i < number_of_regions ; ++i)
+	{
+		uint32_t size = peer_info->mrs[i].size_in_bytes;
+		ring->region_addrs[i] = peer_info->mrs[i].remote_addr;
+		ring->region_rkeys[i] = peer_info->mrs[i].rkey;
+		// Reads at offsets 0, stride, 2 * stride... below the size, and at least the first one.
+		ring->region_reads[i] = (size > ring->stride) ? (size + ring->stride - 1) / ring->stride : 1;
+	}
+	ring->region = 0;
+	ring->reads_left = ring->region_reads[0];
+	ring->next_addr = ring->region_addrs[0];
+
+	ring->qp = lane->qp;
+	ring->qpx = lane->qpx;
+	ring->lkey = lane->mr->lkey;
+	ring->local_addr = (uint64_t)lane->buf;
+	ring->wrs = do_malloc_aligned(QP_MAX_SEND_WR * sizeof(*ring->wrs));
+	ring->sges = do_malloc_aligned(QP_MAX_SEND_WR * sizeof(*ring->sges));
+	memset(ring->wrs, 0, QP_MAX_SEND_WR * sizeof(*ring->wrs));
+	for (uint32_t i = 0 ; i < QP_MAX_SEND_WR ; ++i)
+	{
+		ring->sges[i].addr = ring->local_addr;
+		ring->sges[i].length = 1;
+		ring->sges[i].lkey = ring->lkey;
+		ring->wrs[i].next = (i + 1 < QP_MAX_SEND_WR) ? &ring->wrs[i + 1] : NULL;
+		ring->wrs[i].sg_list = &ring->sges[i];
+		ring->wrs[i].num_sge = 1;
+		ring->wrs[i].opcode = IBV_WR_RDMA_READ;
+	}
+}
+
+void wr_ring_destroy(WrRing* ring)
+{
+	free(ring->sges);
+	free(ring->wrs);
+	free(ring->region_reads);
+	free(ring->region_rkeys);
+	free(ring->region_addrs);
+}
+
+static inline void advance(WrRing* ring)
+{
+	ring->next_addr += ring->stride;
+	if (0 == --ring->reads_left)
+	{
+		if (++ring->region == ring->number_of_regions)
+		{
+			ring->region = 0;
+			++ring->sweeps;
+		}
+		ring->reads_left = ring->region_reads[ring->region];
+		ring->next_addr = ring->region_addrs[ring->region];
+	}
+}
+
+// Whether the next read is the last of a batch of max_reads, n of which are already built.
+static inline int is_last_read(const WrRing* ring, uint32_t n, uint32_t max_reads, int stop_at_sweep_end)
+{
+	if (n + 1 == max_reads)
+	{
+		return 1;
+	}
+	return stop_at_sweep_end && 1 == ring->reads_left && ring->region + 1 == ring->number_of_regions;
+}
+
+// Posts through the WR builder API: no WR structures at all, the provider writes the send queue directly.
+static uint32_t post_with_builder(WrRing* ring, uint32_t max_reads, uint32_t signal_interval, int signal_last, int stop_at_sweep_end)
+{
+	struct ibv_qp_ex* qpx = ring->qpx;
+	uint32_t n = 0;
+	int done = 0;
+	ibv_wr_start(qpx);
+	while (!done)
+	{
+		uint64_t seq = ring->posted + n + 1;
+		done = is_last_read(ring, n, max_reads, stop_at_sweep_end);
+		qpx->wr_id = seq;
+		qpx->wr_flags = (0 == seq % signal_interval || (signal_last && done)) ? IBV_SEND_SIGNALED : 0;
+		if (qpx->wr_flags)
+		{
+			ring->last_signaled = seq;
+		}
+		ibv_wr_rdma_read(qpx, ring->region_rkeys[ring->region], ring->next_addr);
+		ibv_wr_set_sge(qpx, ring->lkey, ring->local_addr, 1);
+		++n;
+		advance(ring);
+	}
+	int ans = ibv_wr_complete(qpx);
+	if (0 != ans)
+	{
+		metrics_add(&thread_metrics->errors, 1);
+		log_msg("Failed to ibv_wr_complete! errno = %s (%d)", strerror(ans), ans);
+		exit(-1);
+	}
+	metrics_add(&thread_metrics->ops, n);
+	return n;
+}
+
+uint32_t wr_ring_post(WrRing* ring, uint32_t max_reads, uint32_t signal_interval, int signal_last, int stop_at_sweep_end)
+{
+	// Never post more than the send queue can hold.
+	if (max_reads > QP_MAX_SEND_WR)
+	{
+		max_reads = QP_MAX_SEND_WR;
+	}
+	if (0 == max_reads)
+	{
+		return 0;
+	}
+	uint32_t n = 0;
+	if (NULL != ring->qpx)
+	{
+		n = post_with_builder(ring, max_reads, signal_interval, signal_last, stop_at_sweep_end);
+		ring->posted += n;
+		return n;
+	}
+
+	int done = 0;
+	while (!done)
+	{
+		uint64_t seq = ring->posted + n + 1;
+		done = is_last_read(ring, n, max_reads, stop_at_sweep_end);
+		struct ibv_send_wr* wr = &ring->wrs[n];
+		wr->wr_id = seq;
+		wr->send_flags = (0 == seq % signal_interval || (signal_last && done)) ? IBV_SEND_SIGNALED : 0;
+		if (wr->send_flags)
+		{
+			ring->last_signaled = seq;
+		}
+		wr->wr.rdma.remote_addr = ring->next_addr;
+		wr->wr.rdma.rkey = ring->region_rkeys[ring->region];
+		++n;
+		advance(ring);
+	}
+
+	// Cut the prebuilt chain after the last WR of the batch for the post.
+	struct ibv_send_wr* last = &ring->wrs[n - 1];
+	struct ibv_send_wr* next = last->next;
+	last->next = NULL;
+	do_post_send(ring->qp, ring->wrs, n);
+	last->next = next;
+	ring->posted += n;
+	return n;
+}